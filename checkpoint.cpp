@@ -0,0 +1,207 @@
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include <boost/format.hpp>
+
+#include "checkpoint.hpp"
+#include "options.hpp"
+
+namespace {
+
+pg_result_t exec_params(PGconn *conn, ExecStatusType expect,
+                        std::string const &sql, int nparams,
+                        char const *const *params)
+{
+    pg_result_t res(PQexecParams(conn, sql.c_str(), nparams, nullptr, params,
+                                 nullptr, nullptr, 0));
+    if (PQresultStatus(res.get()) != expect) {
+        throw std::runtime_error(
+            (boost::format("%1% failed: %2%") % sql % PQerrorMessage(conn))
+                .str());
+    }
+
+    return res;
+}
+
+std::string file_stamp(std::string const &filename)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return filename;
+    }
+
+    return (boost::format("%1% (%2% bytes, modified %3%)") % filename %
+            st.st_size % st.st_mtime)
+        .str();
+}
+
+std::string next_line(std::istringstream &in)
+{
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+} // anonymous namespace
+
+std::string import_fingerprint(options_t const &options)
+{
+    std::string files;
+    for (auto const &filename : options.input_files) {
+        if (!files.empty()) {
+            files += ", ";
+        }
+        files += file_stamp(filename);
+    }
+
+    std::string hstore_columns;
+    for (auto const &column : options.hstore_columns) {
+        if (!hstore_columns.empty()) {
+            hstore_columns += ',';
+        }
+        hstore_columns += column;
+    }
+
+    std::string fingerprint;
+    auto const add = [&](char const *name, std::string const &value) {
+        fingerprint += name;
+        fingerprint += '=';
+        fingerprint += value;
+        fingerprint += '\n';
+    };
+    auto const add_flag = [&](char const *name, bool value) {
+        add(name, value ? "yes" : "no");
+    };
+
+    add("input files", files);
+    add("input reader", options.input_reader);
+    add("bbox", options.bbox.get_value_or(""));
+    add("style", file_stamp(options.style));
+    add("tag transform script",
+        options.tag_transform_script
+            ? file_stamp(*options.tag_transform_script)
+            : "");
+    add("output", options.output_backend);
+    add("prefix", options.prefix);
+    add("projection", std::to_string(options.projection->target_srs()));
+    add_flag("slim", options.slim);
+    add_flag("drop", options.droptemp);
+    add_flag("unlogged", options.unlogged);
+    add("flat nodes", options.flat_node_file.get_value_or(""));
+    add("middle dir", options.middle_dir.get_value_or(""));
+    add_flag("locations on ways", options.locations_on_ways);
+    add("hstore mode", std::to_string(options.hstore_mode));
+    add("hstore columns", hstore_columns);
+    add_flag("hstore index", options.enable_hstore_index);
+    add_flag("hstore match only", options.hstore_match_only);
+    add_flag("multi geometry", options.enable_multi);
+    add_flag("keep coastlines", options.keep_coastlines);
+    add_flag("extra attributes", options.extra_attributes);
+    add_flag("reproject area", options.reproject_area);
+    add("main index tablespace", options.tblsmain_index.get_value_or(""));
+    add("main data tablespace", options.tblsmain_data.get_value_or(""));
+    add("slim index tablespace", options.tblsslim_index.get_value_or(""));
+    add("slim data tablespace", options.tblsslim_data.get_value_or(""));
+
+    return fingerprint;
+}
+
+checkpoint_t::checkpoint_t(database_options_t const &database_options,
+                           std::string const &prefix)
+: m_table(prefix + "_osm2pgsql_state"),
+  m_conn(PQconnectdb(database_options.conninfo().c_str()))
+{
+    if (PQstatus(m_conn) != CONNECTION_OK) {
+        std::string const err = PQerrorMessage(m_conn);
+        PQfinish(m_conn);
+        throw std::runtime_error(
+            (boost::format("Connection to database failed: %1%\n") % err)
+                .str());
+    }
+
+    pgsql_exec_simple(m_conn, PGRES_COMMAND_OK,
+                      "SET client_min_messages = WARNING");
+    pgsql_exec_simple(m_conn, PGRES_COMMAND_OK,
+                      (boost::format("CREATE TABLE IF NOT EXISTS %1% "
+                                     "(phase text PRIMARY KEY, info text)") %
+                       m_table)
+                          .str());
+}
+
+checkpoint_t::~checkpoint_t() { PQfinish(m_conn); }
+
+void checkpoint_t::reset(std::string const &fingerprint)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pgsql_exec_simple(m_conn, PGRES_COMMAND_OK, "TRUNCATE " + m_table);
+    }
+    mark_done("options", fingerprint);
+}
+
+void checkpoint_t::check_fingerprint(std::string const &fingerprint)
+{
+    auto const recorded = info("options");
+    if (!recorded) {
+        throw std::runtime_error("There is no interrupted import which was "
+                                 "run with --checkpoints, it can not be "
+                                 "resumed.");
+    }
+
+    // report the first item which differs
+    std::istringstream was(*recorded);
+    std::istringstream now(fingerprint);
+    while (was || now) {
+        auto const was_line = next_line(was);
+        auto const now_line = next_line(now);
+        if (was_line != now_line) {
+            throw std::runtime_error(
+                (boost::format("The import can not be resumed, it was run "
+                               "with different input or options:\n"
+                               "  was: %1%\n  now: %2%") %
+                 was_line % now_line)
+                    .str());
+        }
+    }
+}
+
+bool checkpoint_t::done(std::string const &phase)
+{
+    return static_cast<bool>(info(phase));
+}
+
+boost::optional<std::string> checkpoint_t::info(std::string const &phase)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    char const *params[1] = {phase.c_str()};
+    auto const res =
+        exec_params(m_conn, PGRES_TUPLES_OK,
+                    "SELECT info FROM " + m_table + " WHERE phase = $1", 1,
+                    params);
+
+    if (PQntuples(res.get()) == 0) {
+        return boost::none;
+    }
+
+    return std::string(PQgetvalue(res.get(), 0, 0));
+}
+
+void checkpoint_t::mark_done(std::string const &phase, std::string const &info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    char const *params[2] = {phase.c_str(), info.c_str()};
+    exec_params(m_conn, PGRES_COMMAND_OK,
+                "DELETE FROM " + m_table + " WHERE phase = $1", 1, params);
+    exec_params(m_conn, PGRES_COMMAND_OK,
+                "INSERT INTO " + m_table + " VALUES ($1, $2)", 2, params);
+}
+
+void checkpoint_t::drop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pgsql_exec_simple(m_conn, PGRES_COMMAND_OK, "DROP TABLE IF EXISTS " + m_table);
+}
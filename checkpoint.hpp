@@ -0,0 +1,74 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <mutex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+
+#include "pgsql.hpp"
+
+class database_options_t;
+struct options_t;
+
+/**
+ * Describe everything an import depends on: the input files, the style and
+ * tag transform script (by name, size and modification time) and the
+ * options which change what ends up in the database. One "name=value" line
+ * per item.
+ */
+std::string import_fingerprint(options_t const &options);
+
+/**
+ * Persistent markers for completed import phases.
+ *
+ * The markers live in the table <prefix>_osm2pgsql_state, one row per
+ * completed phase ("parse", "pending", "cluster:<table>" and
+ * "index:<table>") next to the fingerprint of the import ("options"), so
+ * that an import which died late can be continued with
+ * --resume instead of being restarted from scratch. The table is dropped
+ * once the import is complete. It is only kept with --checkpoints (and
+ * read with --resume), as it needs a database connection of its own.
+ *
+ * All access goes through a single connection guarded by a mutex, so the
+ * markers can be set from the threads of the indexing pool.
+ */
+class checkpoint_t : public boost::noncopyable
+{
+public:
+    checkpoint_t(database_options_t const &database_options,
+                 std::string const &prefix);
+    ~checkpoint_t();
+
+    /**
+     * Drop all markers, used when a new import starts. The fingerprint
+     * of the import is recorded as phase "options".
+     */
+    void reset(std::string const &fingerprint);
+
+    /**
+     * Make sure that the import to resume was started with --checkpoints
+     * and the given fingerprint, throws otherwise.
+     */
+    void check_fingerprint(std::string const &fingerprint);
+
+    /// Has the given phase been completed?
+    bool done(std::string const &phase);
+
+    /// Extra information recorded for a completed phase.
+    boost::optional<std::string> info(std::string const &phase);
+
+    /// Record that the given phase has been completed.
+    void mark_done(std::string const &phase, std::string const &info = "");
+
+    /// Remove the table, used when the import is complete.
+    void drop();
+
+private:
+    std::string m_table;
+    PGconn *m_conn;
+    std::mutex m_mutex;
+};
+
+#endif
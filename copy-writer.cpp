@@ -0,0 +1,114 @@
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include "copy-writer.hpp"
+
+copy_writer_t::copy_writer_t(std::string const &context, size_t buffer_size,
+                             metrics::value_t *bytes)
+: m_context(context), m_buffer_size(buffer_size), m_bytes(bytes)
+{
+}
+
+copy_writer_t::~copy_writer_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Anything not sent yet is only left over when an error occurred,
+        // the connection will be closed anyway.
+        m_queue.clear();
+        m_stop = true;
+    }
+    m_cond.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void copy_writer_t::send(PGconn *conn)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&copy_writer_t::run, this);
+    }
+
+    // one buffer is on the wire, allow one more to wait for it
+    m_cond.wait(lock, [this] { return m_queue.empty() || !m_error.empty(); });
+    throw_on_error();
+
+    if (m_bytes) {
+        m_bytes->fetch_add(m_buffer.size(), std::memory_order_relaxed);
+    }
+
+    m_queue.push_back(chunk_t{conn, std::move(m_buffer)});
+    m_buffer.clear();
+    if (!m_spare.empty()) {
+        m_buffer.swap(m_spare.back());
+        m_spare.pop_back();
+    } else {
+        m_buffer.reserve(m_buffer_size);
+    }
+
+    m_cond.notify_all();
+}
+
+void copy_writer_t::finish(PGconn *conn)
+{
+    if (!m_buffer.empty()) {
+        send(conn);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+    throw_on_error();
+}
+
+void copy_writer_t::throw_on_error()
+{
+    if (!m_error.empty()) {
+        throw std::runtime_error(m_error);
+    }
+}
+
+void copy_writer_t::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;) {
+        m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return;
+        }
+
+        chunk_t chunk = std::move(m_queue.front());
+        m_queue.pop_front();
+        bool const failed = !m_error.empty();
+        m_busy = true;
+        lock.unlock();
+
+        // The connection stays in blocking mode, this thread is the only
+        // one waiting for the server while the COPY is running.
+        std::string error;
+        if (!failed &&
+            (PQputCopyData(chunk.conn, chunk.data.data(),
+                           static_cast<int>(chunk.data.size())) != 1 ||
+             PQflush(chunk.conn) != 0)) {
+            error = (boost::format("%1% - bad result during COPY: %2%") %
+                     m_context % PQerrorMessage(chunk.conn))
+                        .str();
+        }
+        chunk.data.clear();
+
+        lock.lock();
+        m_busy = false;
+        if (!error.empty()) {
+            m_error = error;
+        }
+        if (m_spare.size() < 2) {
+            m_spare.push_back(std::move(chunk.data));
+        }
+        m_cond.notify_all();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef COPY_WRITER_H
+#define COPY_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libpq-fe.h>
+
+#include "metrics.hpp"
+
+/**
+ * Buffered sender for the data of a COPY ... FROM STDIN.
+ *
+ * Rows are collected in buffer(). Once it holds more than the configured
+ * size, the whole buffer is handed to a background thread which feeds it
+ * to the server while the caller goes on producing the next buffer. At
+ * most two full buffers are waiting for the server at any time, the
+ * producer blocks when it gets further ahead.
+ *
+ * The connection must not be used for anything else while data is in
+ * flight. Call finish() before ending the COPY or issuing other commands.
+ */
+class copy_writer_t
+{
+public:
+    /**
+     * \param context     Name used in error messages, usually the table.
+     * \param buffer_size Size in bytes at which a buffer is sent off.
+     * \param bytes       Optional counter for the bytes sent.
+     */
+    copy_writer_t(std::string const &context, size_t buffer_size,
+                  metrics::value_t *bytes = nullptr);
+    ~copy_writer_t();
+
+    copy_writer_t(copy_writer_t const &) = delete;
+    copy_writer_t &operator=(copy_writer_t const &) = delete;
+
+    /// The buffer complete rows are appended to.
+    std::string &buffer() { return m_buffer; }
+
+    /// Call after appending one or more complete rows to buffer().
+    void row_done(PGconn *conn)
+    {
+        if (m_buffer.size() >= m_buffer_size) {
+            send(conn);
+        }
+    }
+
+    /**
+     * Send everything still buffered and wait until the server has it.
+     * Throws if sending any of the data failed.
+     */
+    void finish(PGconn *conn);
+
+private:
+    struct chunk_t
+    {
+        PGconn *conn;
+        std::string data;
+    };
+
+    void send(PGconn *conn);
+    void run();
+    void throw_on_error();
+
+    std::string m_context;
+    size_t m_buffer_size;
+    metrics::value_t *m_bytes;
+    std::string m_buffer;
+
+    std::mutex m_mutex;
+    /// signalled whenever the queue or the state of the thread changes
+    std::condition_variable m_cond;
+    std::deque<chunk_t> m_queue;
+    /// sent buffers kept for reuse, so that their memory is recycled
+    std::vector<std::string> m_spare;
+    bool m_busy = false;
+    bool m_stop = false;
+    std::string m_error;
+    std::thread m_thread;
+};
+
+#endif
@@ -292,46 +292,43 @@ void expire_tiles::from_wkb(const char *wkb, osmid_t osm_id)
     }
 }
 
-void expire_tiles::from_wkb_point(ewkb::parser_t *wkb)
+void expire_tiles::from_point(osmium::geom::Coordinates const &pt)
 {
-    auto c = wkb->read_point();
-    from_bbox(c.x, c.y, c.x, c.y);
+    from_bbox(pt.x, pt.y, pt.x, pt.y);
 }
 
-void expire_tiles::from_wkb_line(ewkb::parser_t *wkb)
+void expire_tiles::from_segment(osmium::geom::Coordinates const &a,
+                                osmium::geom::Coordinates const &b)
 {
-    auto sz = wkb->read_length();
-
-    if (sz == 0) {
-        return;
+    if (maxzoom != 0) {
+        from_line(a.x, a.y, b.x, b.y);
     }
+}
 
-    if (sz == 1) {
-        from_wkb_point(wkb);
+void expire_tiles::from_points(osmium::geom::Coordinates const *points,
+                               size_t count)
+{
+    if (count == 1) {
+        from_point(points[0]);
     } else {
-        auto prev = wkb->read_point();
-        for (size_t i = 1; i < sz; ++i) {
-            auto cur = wkb->read_point();
-            from_line(prev.x, prev.y, cur.x, cur.y);
-            prev = cur;
+        for (size_t i = 1; i < count; ++i) {
+            from_line(points[i - 1].x, points[i - 1].y, points[i].x,
+                      points[i].y);
         }
     }
 }
 
-void expire_tiles::from_wkb_polygon(ewkb::parser_t *wkb, osmid_t osm_id)
+void expire_tiles::from_polygon(
+    std::vector<osmium::geom::Coordinates> const &points,
+    std::vector<size_t> const &ring_sizes, osmid_t osm_id)
 {
-    auto num_rings = wkb->read_length();
-    assert(num_rings > 0);
-
-    auto start = wkb->save_pos();
-
-    auto num_pt = wkb->read_length();
-    auto initpt = wkb->read_point();
-
-    osmium::geom::Coordinates min{initpt}, max{initpt};
+    if (maxzoom == 0 || ring_sizes.empty() || ring_sizes[0] == 0) {
+        return;
+    }
 
-    for (size_t i = 1; i < num_pt; ++i) {
-        auto c = wkb->read_point();
+    osmium::geom::Coordinates min{points[0]}, max{points[0]};
+    for (size_t i = 1; i < ring_sizes[0]; ++i) {
+        auto const &c = points[i];
         if (c.x < min.x)
             min.x = c.x;
         if (c.y < min.y)
@@ -348,19 +345,58 @@ void expire_tiles::from_wkb_polygon(ewkb::parser_t *wkb, osmid_t osm_id)
                 "\rLarge polygon (%.0f x %.0f metres, OSM ID %" PRIdOSMID
                 ") - only expiring perimeter\n",
                 max.x - min.x, max.y - min.y, osm_id);
-        wkb->rewind(start);
-        for (unsigned ring = 0; ring < num_rings; ++ring) {
-            from_wkb_line(wkb);
+        auto const *ring = points.data();
+        for (auto const sz : ring_sizes) {
+            from_points(ring, sz);
+            ring += sz;
         }
+    }
+    // inner rings are ignored otherwise
+}
+
+void expire_tiles::from_wkb_point(ewkb::parser_t *wkb)
+{
+    from_point(wkb->read_point());
+}
+
+void expire_tiles::from_wkb_line(ewkb::parser_t *wkb)
+{
+    auto sz = wkb->read_length();
+
+    if (sz == 0) {
+        return;
+    }
+
+    if (sz == 1) {
+        from_wkb_point(wkb);
     } else {
-        // ignore inner rings
-        for (unsigned ring = 1; ring < num_rings; ++ring) {
-            auto inum_pt = wkb->read_length();
-            wkb->skip_points(inum_pt);
+        auto prev = wkb->read_point();
+        for (size_t i = 1; i < sz; ++i) {
+            auto cur = wkb->read_point();
+            from_line(prev.x, prev.y, cur.x, cur.y);
+            prev = cur;
         }
     }
 }
 
+void expire_tiles::from_wkb_polygon(ewkb::parser_t *wkb, osmid_t osm_id)
+{
+    auto num_rings = wkb->read_length();
+    assert(num_rings > 0);
+
+    std::vector<osmium::geom::Coordinates> points;
+    std::vector<size_t> ring_sizes;
+    for (unsigned ring = 0; ring < num_rings; ++ring) {
+        auto num_pt = wkb->read_length();
+        for (unsigned i = 0; i < num_pt; ++i) {
+            points.push_back(wkb->read_point());
+        }
+        ring_sizes.push_back(num_pt);
+    }
+
+    from_polygon(points, ring_sizes, osm_id);
+}
+
 /*
  * Expire tiles based on an osm element.
  * What type of element (node, line, polygon) osm_id refers to depends on
@@ -3,6 +3,9 @@
 
 #include <memory>
 #include <unordered_set>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
 
 #include "osmtypes.hpp"
 
@@ -53,6 +56,25 @@ struct expire_tiles
 
     int from_bbox(double min_lon, double min_lat, double max_lon, double max_lat);
     void from_wkb(const char* wkb, osmid_t osm_id);
+
+    /**
+     * Expire tiles of geometries given as projected coordinates. These
+     * give the same result as from_wkb() on the equivalent geometry and
+     * are used by the geometry builder while it creates the WKB.
+     */
+    void from_point(osmium::geom::Coordinates const &pt);
+    void from_segment(osmium::geom::Coordinates const &a,
+                      osmium::geom::Coordinates const &b);
+
+    /**
+     * Expire tiles of a single polygon. `points` contains the points of
+     * all rings one after the other, the outer ring first, and
+     * `ring_sizes` the number of points in each ring.
+     */
+    void from_polygon(std::vector<osmium::geom::Coordinates> const &points,
+                      std::vector<size_t> const &ring_sizes, osmid_t osm_id);
+
+    bool enabled() const { return maxzoom != 0; }
     int from_db(table_t* table, osmid_t osm_id);
 
     /**
@@ -107,6 +129,7 @@ struct expire_tiles
             }
             last_quadkey = *it;
         }
+        m_dirty_tiles.clear();
     }
 
     /**
@@ -148,6 +171,7 @@ private:
     void expire_tile(uint32_t x, uint32_t y);
     int normalise_tile_x_coord(int x);
     void from_line(double lon_a, double lat_a, double lon_b, double lat_b);
+    void from_points(osmium::geom::Coordinates const *points, size_t count);
 
     void from_wkb_point(ewkb::parser_t *wkb);
     void from_wkb_line(ewkb::parser_t *wkb);
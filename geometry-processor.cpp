@@ -98,7 +98,5 @@ size_t relation_helper::set(osmium::Relation const &rel, middle_t const *mid)
 
 void relation_helper::add_way_locations(middle_t const *mid)
 {
-    for (auto &w : data.select<osmium::Way>()) {
-        mid->nodes_get_list(&(w.nodes()));
-    }
+    mid->nodes_get_ways(&data);
 }
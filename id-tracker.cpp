@@ -1,31 +1,78 @@
 #include "id-tracker.hpp"
 
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <map>
+#include <stdexcept>
 #include <vector>
 #include <limits>
 #include <algorithm>
+#include <atomic>
 
+#include <boost/format.hpp>
 #include <boost/optional.hpp>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #define BLOCK_BITS (16)
 #define BLOCK_SIZE (1 << BLOCK_BITS)
 #define BLOCK_MASK (BLOCK_SIZE - 1)
 
 namespace {
+
+/// Magic string at the start of a file written by id_tracker::save().
+char const file_magic[8] = {'O', '2', 'P', 'I', 'D', 'T', 'R', '1'};
+
+// number of 64 bit words in a block
+constexpr size_t const BLOCK_WORDS = BLOCK_SIZE >> 6;
+
+inline size_t popcount(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_popcountll(v));
+#else
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<size_t>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// index of the lowest set bit, v must not be 0
+inline size_t count_trailing_zeros(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctzll(v));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return idx;
+#else
+    size_t n = 0;
+    while ((v & 0xff) == 0) { n += 8; v >>= 8; }
+    while ((v & 1) == 0) { ++n; v >>= 1; }
+    return n;
+#endif
+}
+
 /* block used to be just a std::vector<bool> of fixed size. however,
  * it seems there's significant overhead in exposing std::vector<bool>::iterator
  * and so this is now a minimal re-implementation.
  *
- * each block is BLOCK_SIZE bits, stored as a vector of uint32_t elements.
+ * each block is BLOCK_SIZE bits, stored as a vector of uint64_t elements.
  */
 struct block {
-    block() : bits(BLOCK_SIZE >> 5, 0) {}
-    inline bool operator[](size_t i) const { return (bits[i >> 5] & (1 << (i & 0x1f))) > 0; }
+    block() : bits(BLOCK_WORDS, 0) {}
+    inline bool operator[](size_t i) const { return (bits[i >> 6] & (uint64_t(1) << (i & 0x3f))) != 0; }
     //returns true if the value actually caused a bit to flip
     inline bool set(size_t i, bool value) {
-        uint32_t &bit = bits[i >> 5];
-        uint32_t old = bit;
-        uint32_t mask = 1 << (i & 0x1f);
+        uint64_t &bit = bits[i >> 6];
+        uint64_t old = bit;
+        uint64_t mask = uint64_t(1) << (i & 0x3f);
         //allow the bit to become 1 if not already
         if (value) {
             bit |= mask;
@@ -42,21 +89,84 @@ struct block {
     //
     // returns BLOCK_SIZE if a set bit isn't found
     size_t next_set(size_t start) const {
-        uint32_t bit_i = start >> 5;
+        size_t word_i = start >> 6;
+        if (word_i >= BLOCK_WORDS) { return BLOCK_SIZE; }
+
+        // ignore the bits before start in the first word
+        uint64_t word = bits[word_i] & (~uint64_t(0) << (start & 0x3f));
+        while (word == 0) {
+            if (++word_i == BLOCK_WORDS) { return BLOCK_SIZE; }
+            word = bits[word_i];
+        }
+
+        return (word_i << 6) | count_trailing_zeros(word);
+    }
 
-        while ((bit_i < (BLOCK_SIZE >> 5)) && (bits[bit_i] == 0)) {
-            ++bit_i;
+    // set all bits set in other, returns the number of bits which flipped
+    size_t merge(block const &other) {
+        size_t added = 0;
+        for (size_t i = 0; i < BLOCK_WORDS; ++i) {
+            added += popcount(other.bits[i] & ~bits[i]);
+            bits[i] |= other.bits[i];
         }
+        return added;
+    }
+
+    // clear all bits set in other, returns the number of bits which flipped
+    size_t subtract(block const &other) {
+        size_t removed = 0;
+        for (size_t i = 0; i < BLOCK_WORDS; ++i) {
+            removed += popcount(bits[i] & other.bits[i]);
+            bits[i] &= ~other.bits[i];
+        }
+        return removed;
+    }
+
+    // clear all bits not set in other, returns the number of bits which flipped
+    size_t intersect(block const &other) {
+        size_t removed = 0;
+        for (size_t i = 0; i < BLOCK_WORDS; ++i) {
+            removed += popcount(bits[i] & ~other.bits[i]);
+            bits[i] &= other.bits[i];
+        }
+        return removed;
+    }
 
-        if (bit_i >= (BLOCK_SIZE >> 5)) { return BLOCK_SIZE; }
-        uint32_t bit = bits[bit_i];
-        size_t idx = bit_i << 5;
-        while ((bit & 1) == 0) { ++idx; bit >>= 1; }
-        return idx;
+    size_t count() const {
+        size_t n = 0;
+        for (auto const word : bits) {
+            n += popcount(word);
+        }
+        return n;
     }
+
+    uint64_t word(size_t i) const { return bits[i]; }
+    void set_word(size_t i, uint64_t value) { bits[i] = value; }
+
 private:
-    std::vector<uint32_t> bits;
+    std::vector<uint64_t> bits;
 };
+
+void write_or_throw(void const *data, size_t size, FILE *file,
+                    std::string const &filename)
+{
+    if (fwrite(data, size, 1, file) != 1) {
+        throw std::runtime_error((boost::format("Writing %1% failed: %2%") %
+                                  filename % strerror(errno))
+                                     .str());
+    }
+}
+
+void read_or_throw(void *data, size_t size, FILE *file,
+                   std::string const &filename)
+{
+    if (fread(data, size, 1, file) != 1) {
+        throw std::runtime_error(
+            (boost::format("Reading %1% failed: file is truncated") % filename)
+                .str());
+    }
+}
+
 } // anonymous namespace
 
 struct id_tracker::pimpl {
@@ -66,9 +176,21 @@ struct id_tracker::pimpl {
     bool get(osmid_t id) const;
     bool set(osmid_t id, bool value);
     osmid_t pop_min();
+    osmid_t next_marked(osmid_t id) const;
+
+    // must be called whenever a block is removed from the map
+    void forget_blocks()
+    {
+        last_block = nullptr;
+        next_start = boost::none;
+    }
 
     typedef std::map<osmid_t, block> map_t;
     map_t pending;
+    // the block last looked at by get(). lookups tend to be clustered, so
+    // this saves most of the map lookups. map nodes are stable, so the
+    // pointer stays valid until the block is erased.
+    mutable std::atomic<map_t::value_type const *> last_block;
     osmid_t old_id;
     size_t count;
     // a cache of the next starting point to search for in the block.
@@ -79,16 +201,40 @@ struct id_tracker::pimpl {
 
 bool id_tracker::pimpl::get(osmid_t id) const {
     const osmid_t block = id >> BLOCK_BITS, offset = id & BLOCK_MASK;
+
+    auto const *cached = last_block.load(std::memory_order_relaxed);
+    if (cached && cached->first == block) {
+        return cached->second[offset];
+    }
+
     map_t::const_iterator itr = pending.find(block);
     bool result = false;
 
     if (itr != pending.end()) {
+        last_block.store(&*itr, std::memory_order_relaxed);
         result = itr->second[offset];
     }
 
     return result;
 }
 
+osmid_t id_tracker::pimpl::next_marked(osmid_t id) const {
+    const osmid_t block = id >> BLOCK_BITS;
+    size_t offset = id & BLOCK_MASK;
+
+    for (auto itr = pending.lower_bound(block); itr != pending.end(); ++itr) {
+        if (itr->first != block) {
+            offset = 0;
+        }
+        size_t const found = itr->second.next_set(offset);
+        if (found != BLOCK_SIZE) {
+            return (itr->first << BLOCK_BITS) | osmid_t(found);
+        }
+    }
+
+    return max();
+}
+
 bool id_tracker::pimpl::set(osmid_t id, bool value) {
     const osmid_t block = id >> BLOCK_BITS, offset = id & BLOCK_MASK;
     bool flipped = pending[block].set(offset, value);
@@ -121,7 +267,7 @@ osmid_t id_tracker::pimpl::pop_min() {
             // since next_start is relative to the current
             // block, which is ceasing to exist, then we need to
             // reset it.
-            next_start = boost::none;
+            forget_blocks();
         }
     }
 
@@ -129,7 +275,8 @@ osmid_t id_tracker::pimpl::pop_min() {
 }
 
 id_tracker::pimpl::pimpl()
-    : pending(), old_id(min()), count(0), next_start(boost::none) {
+    : pending(), last_block(nullptr), old_id(min()), count(0),
+      next_start(boost::none) {
 }
 
 id_tracker::pimpl::~pimpl() {
@@ -171,6 +318,202 @@ osmid_t id_tracker::pop_mark() {
 
 size_t id_tracker::size() const { return impl->count; }
 
+osmid_t id_tracker::next_marked(osmid_t id) const
+{
+    return impl->next_marked(id);
+}
+
+void id_tracker::clear()
+{
+    impl->pending.clear();
+    impl->forget_blocks();
+    impl->count = 0;
+    impl->old_id = min();
+}
+
+void id_tracker::set_union(id_tracker const &other)
+{
+    for (auto const &b : other.impl->pending) {
+        impl->count += impl->pending[b.first].merge(b.second);
+    }
+
+    impl->old_id = min();
+    impl->next_start = boost::none;
+}
+
+void id_tracker::set_difference(id_tracker const &other)
+{
+    auto &pending = impl->pending;
+    for (auto const &b : other.impl->pending) {
+        auto itr = pending.find(b.first);
+        if (itr != pending.end()) {
+            impl->count -= itr->second.subtract(b.second);
+        }
+    }
+}
+
+void id_tracker::set_intersection(id_tracker const &other)
+{
+    auto &pending = impl->pending;
+    auto const &others = other.impl->pending;
+    for (auto itr = pending.begin(); itr != pending.end();) {
+        auto const oitr = others.find(itr->first);
+        if (oitr == others.end()) {
+            impl->count -= itr->second.count();
+            itr = pending.erase(itr);
+        } else {
+            impl->count -= itr->second.intersect(oitr->second);
+            ++itr;
+        }
+    }
+    impl->forget_blocks();
+}
+
+void id_tracker::merge(id_tracker &other)
+{
+    for (auto &b : other.impl->pending) {
+        auto itr = impl->pending.find(b.first);
+        if (itr == impl->pending.end()) {
+            impl->count += b.second.count();
+            impl->pending.emplace(b.first, std::move(b.second));
+        } else {
+            impl->count += itr->second.merge(b.second);
+        }
+    }
+
+    other.clear();
+
+    // same as for mark(): newly added ids may be before the last
+    // popped one
+    impl->old_id = min();
+    impl->next_start = boost::none;
+}
+
+/*
+ * File layout: the magic string followed by one record per non-empty block:
+ * the block number (int64), the number n of stored 64 bit words (uint32)
+ * and then either the full bitmap (n == BLOCK_WORDS) or n pairs of word
+ * index (uint32) and word (uint64).
+ */
+void id_tracker::save(std::string const &filename) const
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error((boost::format("Cannot open %1%: %2%") %
+                                  filename % strerror(errno))
+                                     .str());
+    }
+
+    try {
+        write_or_throw(file_magic, sizeof(file_magic), file, filename);
+
+        std::vector<uint32_t> used;
+        for (auto const &b : impl->pending) {
+            used.clear();
+            for (uint32_t i = 0; i < BLOCK_WORDS; ++i) {
+                if (b.second.word(i) != 0) {
+                    used.push_back(i);
+                }
+            }
+            if (used.empty()) {
+                continue;
+            }
+
+            int64_t const block_id = b.first;
+            write_or_throw(&block_id, sizeof(block_id), file, filename);
+
+            // a list of (index, word) pairs needs 12 bytes per word
+            bool const dense = used.size() * 12 >= BLOCK_WORDS * 8;
+            uint32_t const n = dense ? BLOCK_WORDS : used.size();
+            write_or_throw(&n, sizeof(n), file, filename);
+
+            if (dense) {
+                for (uint32_t i = 0; i < BLOCK_WORDS; ++i) {
+                    uint64_t const word = b.second.word(i);
+                    write_or_throw(&word, sizeof(word), file, filename);
+                }
+            } else {
+                for (auto const i : used) {
+                    uint64_t const word = b.second.word(i);
+                    write_or_throw(&i, sizeof(i), file, filename);
+                    write_or_throw(&word, sizeof(word), file, filename);
+                }
+            }
+        }
+    } catch (...) {
+        fclose(file);
+        throw;
+    }
+
+    if (fclose(file) != 0) {
+        throw std::runtime_error((boost::format("Writing %1% failed: %2%") %
+                                  filename % strerror(errno))
+                                     .str());
+    }
+}
+
+void id_tracker::load(std::string const &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error((boost::format("Cannot open %1%: %2%") %
+                                  filename % strerror(errno))
+                                     .str());
+    }
+
+    id_tracker loaded;
+
+    try {
+        char magic[sizeof(file_magic)];
+        read_or_throw(magic, sizeof(magic), file, filename);
+        if (memcmp(magic, file_magic, sizeof(magic)) != 0) {
+            throw std::runtime_error(
+                (boost::format("%1% is not an id tracker file") % filename)
+                    .str());
+        }
+
+        int64_t block_id;
+        while (fread(&block_id, sizeof(block_id), 1, file) == 1) {
+            uint32_t n;
+            read_or_throw(&n, sizeof(n), file, filename);
+            if (n > BLOCK_WORDS) {
+                throw std::runtime_error(
+                    (boost::format("%1% is corrupt") % filename).str());
+            }
+
+            block &b = loaded.impl->pending[block_id];
+            if (n == BLOCK_WORDS) {
+                for (uint32_t i = 0; i < BLOCK_WORDS; ++i) {
+                    uint64_t word;
+                    read_or_throw(&word, sizeof(word), file, filename);
+                    b.set_word(i, word);
+                }
+            } else {
+                for (uint32_t j = 0; j < n; ++j) {
+                    uint32_t i;
+                    uint64_t word;
+                    read_or_throw(&i, sizeof(i), file, filename);
+                    read_or_throw(&word, sizeof(word), file, filename);
+                    if (i >= BLOCK_WORDS) {
+                        throw std::runtime_error(
+                            (boost::format("%1% is corrupt") % filename)
+                                .str());
+                    }
+                    b.set_word(i, word);
+                }
+            }
+            loaded.impl->count += b.count();
+        }
+    } catch (...) {
+        fclose(file);
+        throw;
+    }
+
+    fclose(file);
+
+    merge(loaded);
+}
+
 osmid_t id_tracker::last_returned() const { return impl->old_id; }
 
 bool id_tracker::is_valid(osmid_t id) { return id != max(); }
@@ -4,6 +4,7 @@
 #include "osmtypes.hpp"
 #include <boost/noncopyable.hpp>
 #include <memory>
+#include <string>
 
 /**
   * Tracker for if an element needs to be revisited later in the process, also
@@ -14,7 +15,7 @@
   *
   * Instead, the size of the leaf nodes is increased. This was initially a
   * vector<bool>, but the cost of exposing the iterator was too high.
-  * Instead, it's a uint32, with a function to find the next bit set in the block
+  * Instead, it's a uint64, with a function to find the next bit set in the block
   *
   * These details aren't exposed in the public interface, which just has
   * pop_mark.
@@ -32,6 +33,60 @@ struct id_tracker : public boost::noncopyable {
     size_t size() const;
     osmid_t last_returned() const;
 
+    /**
+     * Returns the smallest marked id >= id or max() if there is none.
+     * Unlike pop_mark() this leaves the tracker unchanged.
+     */
+    osmid_t next_marked(osmid_t id) const;
+
+    /**
+     * Call func for every marked id in [first, last) in ascending order.
+     */
+    template <typename F>
+    void for_each(F &&func, osmid_t first = min(), osmid_t last = max()) const
+    {
+        for (osmid_t id = next_marked(first); id < last;
+             id = next_marked(id + 1)) {
+            func(id);
+        }
+    }
+
+    /// Forget all marked ids.
+    void clear();
+
+    /// Mark all ids marked in other.
+    void set_union(id_tracker const &other);
+
+    /// Unmark all ids marked in other.
+    void set_difference(id_tracker const &other);
+
+    /// Unmark all ids not marked in other.
+    void set_intersection(id_tracker const &other);
+
+    /**
+     * Move all ids marked in other into this tracker, leaving other
+     * empty. Works on whole blocks, so is much faster than popping
+     * and marking each id.
+     */
+    void merge(id_tracker &other);
+
+    /**
+     * Write the marked ids to a file. Sparse blocks are stored as a list
+     * of their non-zero words, dense ones as a plain bitmap. The file uses
+     * host byte order and is meant to be read back on the same machine.
+     *
+     * Nothing in osm2pgsql itself uses this yet. --resume only continues
+     * imports after the pending phase, when there are no pending ids left
+     * to hand over to the next run.
+     */
+    void save(std::string const &filename) const;
+
+    /**
+     * Mark all ids stored in a file written by save() in addition to
+     * those already marked.
+     */
+    void load(std::string const &filename);
+
     static bool is_valid(osmid_t);
     static osmid_t max();
     static osmid_t min();
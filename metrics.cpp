@@ -0,0 +1,240 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <boost/format.hpp>
+
+#include "metrics.hpp"
+
+namespace {
+
+struct family_t
+{
+    char const *type;
+    std::map<std::string, std::unique_ptr<metrics::value_t>> series;
+};
+
+std::mutex &registry_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, family_t> &registry()
+{
+    static std::map<std::string, family_t> families;
+    return families;
+}
+
+metrics::value_t &lookup(char const *type, std::string const &name,
+                         std::string const &labels)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex());
+
+    auto &family = registry()[name];
+    family.type = type;
+
+    auto &value = family.series[labels];
+    if (!value) {
+        value.reset(new metrics::value_t(0));
+    }
+
+    return *value;
+}
+
+/// Resident set size in bytes or -1 if not available on this platform.
+int64_t resident_memory()
+{
+#ifdef _WIN32
+    return -1;
+#else
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return -1;
+    }
+
+    long size, resident;
+    int const ret = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+
+    if (ret != 2) {
+        return -1;
+    }
+
+    return static_cast<int64_t>(resident) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+} // anonymous namespace
+
+namespace metrics {
+
+value_t &counter(std::string const &name, std::string const &labels)
+{
+    return lookup("counter", name, labels);
+}
+
+value_t &gauge(std::string const &name, std::string const &labels)
+{
+    return lookup("gauge", name, labels);
+}
+
+std::string render()
+{
+    std::string out;
+
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+
+        for (auto const &family : registry()) {
+            out += "# TYPE " + family.first + " " + family.second.type + "\n";
+            for (auto const &series : family.second.series) {
+                out += family.first;
+                if (!series.first.empty()) {
+                    out += "{" + series.first + "}";
+                }
+                out += " " + std::to_string(series.second->load(
+                                 std::memory_order_relaxed)) +
+                       "\n";
+            }
+        }
+    }
+
+    int64_t const rss = resident_memory();
+    if (rss >= 0) {
+        out += "# TYPE osm2pgsql_resident_memory_bytes gauge\n";
+        out += "osm2pgsql_resident_memory_bytes " + std::to_string(rss) + "\n";
+    }
+
+    return out;
+}
+
+#ifdef _WIN32
+
+server_t::server_t(int)
+: m_fd(-1), m_port(0), m_stop(true)
+{
+    throw std::runtime_error("The metrics endpoint is not supported on this "
+                             "platform.");
+}
+
+server_t::~server_t() {}
+
+void server_t::run() {}
+
+#else
+
+server_t::server_t(int port)
+: m_fd(socket(AF_INET, SOCK_STREAM, 0)), m_port(port), m_stop(false)
+{
+    if (m_fd < 0) {
+        throw std::runtime_error(
+            (boost::format("Cannot create metrics socket: %1%") %
+             strerror(errno))
+                .str());
+    }
+
+    int const on = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(addr);
+    if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(m_fd, 4) != 0 ||
+        getsockname(m_fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        std::string const err = strerror(errno);
+        close(m_fd);
+        throw std::runtime_error(
+            (boost::format("Cannot listen on metrics port %1%: %2%") % port %
+             err)
+                .str());
+    }
+    m_port = ntohs(addr.sin_port);
+
+    fprintf(stderr, "Serving metrics on http://127.0.0.1:%d/metrics\n",
+            m_port);
+
+    m_thread = std::thread(&server_t::run, this);
+}
+
+server_t::~server_t()
+{
+    m_stop = true;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    close(m_fd);
+}
+
+void server_t::run()
+{
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+
+    while (!m_stop) {
+        // wake up regularly to notice shutdown
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+
+        int const client = accept(m_fd, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+
+        // a client that sends or reads nothing must not keep the thread
+        // from noticing shutdown
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 500000;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // The request itself is irrelevant, every path returns the metrics.
+        char request[1024];
+        if (recv(client, request, sizeof(request), 0) > 0) {
+            std::string const body = render();
+            std::string const response =
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " +
+                std::to_string(body.size()) + "\r\n\r\n" + body;
+
+            char const *data = response.data();
+            size_t left = response.size();
+            while (left > 0) {
+                auto const sent = send(client, data, left, MSG_NOSIGNAL);
+                if (sent <= 0) {
+                    break;
+                }
+                data += sent;
+                left -= static_cast<size_t>(sent);
+            }
+        }
+
+        close(client);
+    }
+}
+
+#endif
+
+} // namespace metrics
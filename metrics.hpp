@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/**
+ * Live counters for monitoring long-running imports.
+ *
+ * Counters are registered by name (plus an optional Prometheus label set)
+ * and live until the program exits, so code on hot paths should look them
+ * up once and keep the reference. Updating a counter is a relaxed atomic
+ * operation and therefore safe from the pending processing threads.
+ */
+namespace metrics {
+
+typedef std::atomic<int64_t> value_t;
+
+/**
+ * Get the monotonic counter with the given name and labels, e.g.
+ * counter("osm2pgsql_copy_bytes_total", "table=\"planet_osm_line\"").
+ */
+value_t &counter(std::string const &name, std::string const &labels = "");
+
+/**
+ * Get the gauge with the given name and labels. Gauges may go up and down.
+ */
+value_t &gauge(std::string const &name, std::string const &labels = "");
+
+/**
+ * Render all registered metrics plus the resident set size of the
+ * process in the Prometheus text exposition format.
+ */
+std::string render();
+
+/**
+ * Minimal HTTP server answering every request on 127.0.0.1:port with the
+ * output of render(). Runs in a background thread until destroyed. Port 0
+ * lets the system choose a free port.
+ */
+class server_t
+{
+public:
+    explicit server_t(int port);
+    ~server_t();
+
+    server_t(server_t const &) = delete;
+    server_t &operator=(server_t const &) = delete;
+
+    /// The port the server is listening on.
+    int port() const { return m_port; }
+
+private:
+    void run();
+
+    int m_fd;
+    int m_port;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+};
+
+} // namespace metrics
+
+#endif
@@ -0,0 +1,1199 @@
+/* Implements the mid-layer processing for osm2pgsql
+ * using files in a local directory.
+ *
+ * This layer stores data read in from the planet.osm file
+ * and is then read by the backend processing code to
+ * emit the final geometry-enabled output formats
+*/
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/format.hpp>
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/memory/item.hpp>
+#include <osmium/osm.hpp>
+#include <osmium/util/file.hpp>
+
+#include "middle-file.hpp"
+#include "node-persistent-cache.hpp"
+#include "node-ram-cache.hpp"
+#include "options.hpp"
+
+namespace {
+
+std::FILE *open_file(std::string const &filename, char const *mode)
+{
+    std::FILE *file = std::fopen(filename.c_str(), mode);
+    if (!file) {
+        throw std::runtime_error(
+            (boost::format("Unable to open middle file '%1%': %2%") %
+             filename % std::strerror(errno))
+                .str());
+    }
+    return file;
+}
+
+void seek(std::FILE *file, uint64_t pos)
+{
+#ifdef _WIN32
+    int const res = _fseeki64(file, static_cast<__int64>(pos), SEEK_SET);
+#else
+    int const res = fseeko(file, static_cast<off_t>(pos), SEEK_SET);
+#endif
+    if (res != 0) {
+        throw std::runtime_error(
+            (boost::format("Seek in middle file failed: %1%") %
+             std::strerror(errno))
+                .str());
+    }
+}
+
+void write(std::FILE *file, void const *data, size_t size,
+           std::string const &filename)
+{
+    if (std::fwrite(data, 1, size, file) != size) {
+        throw std::runtime_error(
+            (boost::format("Writing to middle file '%1%' failed: %2%") %
+             filename % std::strerror(errno))
+                .str());
+    }
+}
+
+bool file_exists(std::string const &filename)
+{
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::fclose(file);
+    return true;
+}
+
+/// Rename a file, replacing the target if it exists.
+void rename_file(std::string const &from, std::string const &to)
+{
+#ifdef _WIN32
+    std::remove(to.c_str());
+#endif
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        throw std::runtime_error(
+            (boost::format("Renaming middle file '%1%' failed: %2%") % from %
+             std::strerror(errno))
+                .str());
+    }
+}
+
+void flush_file(std::FILE *file, std::string const &filename)
+{
+    if (std::fflush(file) != 0) {
+        throw std::runtime_error(
+            (boost::format("Writing to middle file '%1%' failed: %2%") %
+             filename % std::strerror(errno))
+                .str());
+    }
+}
+
+} // anonymous namespace
+
+constexpr uint64_t object_file_t::removed;
+
+object_file_t::index_file_t::index_file_t(std::string const &filename)
+: fd(osmium::io::detail::open_for_reading(filename)),
+  map(osmium::util::file_size(filename) / sizeof(index_entry_t),
+      osmium::util::MemoryMapping::mapping_mode::readonly, fd)
+{
+}
+
+object_file_t::index_file_t::~index_file_t()
+{
+    map.unmap();
+    ::close(fd);
+}
+
+object_file_t::object_file_t(std::string const &filename, bool append)
+: m_filename(filename), m_data(nullptr), m_log(nullptr), m_size(0),
+  m_flushed(0), m_base_size(0), m_log_entries(0), m_append(append)
+{
+    auto const logname = m_filename + ".idx";
+    auto const indexname = m_filename + ".ids";
+
+    if (append) {
+        recover();
+
+        m_data = open_file(m_filename, "r+b");
+        if (std::fseek(m_data, 0, SEEK_END) != 0) {
+            throw std::runtime_error(
+                (boost::format("Seek in middle file '%1%' failed: %2%") %
+                 m_filename % std::strerror(errno))
+                    .str());
+        }
+#ifdef _WIN32
+        auto const size = _ftelli64(m_data);
+#else
+        auto const size = ftello(m_data);
+#endif
+        if (size < 0) {
+            throw std::runtime_error(
+                (boost::format("Reading middle file '%1%' failed: %2%") %
+                 m_filename % std::strerror(errno))
+                    .str());
+        }
+        m_size = static_cast<uint64_t>(size);
+        m_flushed = m_size;
+
+        // There is no index file yet when the import was interrupted.
+        if (file_exists(indexname)) {
+            m_index.reset(new index_file_t(indexname));
+            m_base_size = m_index->base_size();
+        } else {
+            m_base_size = m_size;
+        }
+
+        // After a crash the log may have been written out further than the
+        // data. Objects are only ever appended, so only the object at the
+        // highest position can be incomplete, all others are followed by
+        // it. The log is cut at the first entry that points past the data
+        // or to that object if it is incomplete, and also at a record that
+        // was only partly written.
+        std::FILE *log = open_file(logname, "rb");
+        std::pair<osmid_t, uint64_t> entry;
+        size_t entries = 0;
+        size_t last = 0;
+        uint64_t last_pos = 0;
+        while (std::fread(&entry, sizeof(entry), 1, log) == 1) {
+            if (entry.second > m_size) {
+                break;
+            }
+            if (entry.second > last_pos) {
+                last = entries;
+                last_pos = entry.second;
+            }
+            ++entries;
+        }
+
+        if (last_pos > 0 && !object_fits(last_pos)) {
+            entries = last;
+        }
+
+        // Apply the changes from the log, later entries replace earlier
+        // ones.
+        std::rewind(log);
+        for (size_t i = 0; i < entries; ++i) {
+            if (std::fread(&entry, sizeof(entry), 1, log) != 1) {
+                throw std::runtime_error(
+                    (boost::format("Reading middle file '%1%' failed.") %
+                     logname)
+                        .str());
+            }
+            m_changes.set(entry.first, entry.second ? entry.second : removed);
+        }
+        std::fclose(log);
+        m_log_entries = entries;
+
+        m_log = open_file(logname, "ab");
+        if (osmium::util::file_size(logname) != entries * sizeof(entry)) {
+#ifdef _WIN32
+            int const fd = _fileno(m_log);
+#else
+            int const fd = fileno(m_log);
+#endif
+            osmium::util::resize_file(fd, entries * sizeof(entry));
+        }
+    } else {
+        for (auto const &name : {indexname, indexname + ".tmp",
+                                 indexname + ".new", m_filename + ".new"}) {
+            std::remove(name.c_str());
+        }
+        m_data = open_file(m_filename, "w+b");
+        m_log = open_file(logname, "wb");
+    }
+}
+
+object_file_t::~object_file_t()
+{
+    if (m_data) {
+        std::fclose(m_data);
+    }
+    if (m_log) {
+        std::fclose(m_log);
+    }
+}
+
+void object_file_t::recover()
+{
+    auto const indexname = m_filename + ".ids";
+
+    if (file_exists(m_filename + ".new")) {
+        // the objects were not completely copied, the old files are valid
+        std::remove((m_filename + ".new").c_str());
+        std::remove((indexname + ".new").c_str());
+    } else if (file_exists(indexname + ".new")) {
+        // the new data file is in place, its index and an empty log not
+        std::fclose(open_file(m_filename + ".idx", "wb"));
+        rename_file(indexname + ".new", indexname);
+    }
+
+    std::remove((indexname + ".tmp").c_str());
+}
+
+uint64_t object_file_t::position(osmid_t id) const
+{
+    auto const pos = m_changes.get(id);
+    if (pos == removed) {
+        return 0;
+    }
+    if (pos || !m_index) {
+        return pos;
+    }
+
+    auto const it = std::lower_bound(
+        m_index->begin(), m_index->end(), id,
+        [](index_entry_t const &e, osmid_t i) { return e.id < i; });
+
+    return (it != m_index->end() && it->id == id) ? it->pos : 0;
+}
+
+bool object_file_t::object_fits(uint64_t pos) const
+{
+    osmium::memory::item_size_type size;
+    if (pos - 1 + sizeof(size) > m_size) {
+        return false;
+    }
+
+    seek(m_data, pos - 1);
+    if (std::fread(&size, sizeof(size), 1, m_data) != 1) {
+        throw std::runtime_error(
+            (boost::format("Reading middle file '%1%' failed.") % m_filename)
+                .str());
+    }
+
+    return pos - 1 + osmium::memory::padded_length(size) <= m_size;
+}
+
+void object_file_t::log(osmid_t id, uint64_t pos)
+{
+    m_changes.set(id, pos ? pos : removed);
+    std::pair<osmid_t, uint64_t> const entry{id, pos};
+    write(m_log, &entry, sizeof(entry), m_filename);
+    ++m_log_entries;
+}
+
+void object_file_t::add(osmium::OSMObject const &obj)
+{
+    // the data handle is only ever used for appending
+    seek(m_data, m_size);
+    write(m_data, obj.data(), obj.padded_size(), m_filename);
+    log(obj.id(), m_size + 1);
+    m_size += obj.padded_size();
+}
+
+void object_file_t::remove(osmid_t id)
+{
+    if (position(id)) {
+        log(id, 0);
+    }
+}
+
+std::FILE *object_file_t::open_reader() const
+{
+    return open_file(m_filename, "rb");
+}
+
+bool object_file_t::get(std::FILE *in, osmid_t id,
+                        osmium::memory::Buffer &buffer) const
+{
+    auto const pos = position(id);
+    if (!pos) {
+        return false;
+    }
+
+    // the handle in would not see the write buffer of m_data
+    assert(pos <= m_flushed);
+
+    seek(in, pos - 1);
+
+    osmium::memory::item_size_type size;
+    if (std::fread(&size, sizeof(size), 1, in) != 1) {
+        throw std::runtime_error(
+            (boost::format("Reading middle file '%1%' failed.") % m_filename)
+                .str());
+    }
+
+    auto const padded = osmium::memory::padded_length(size);
+    auto *data = buffer.reserve_space(padded);
+    std::memcpy(data, &size, sizeof(size));
+    if (std::fread(data + sizeof(size), 1, padded - sizeof(size), in) !=
+        padded - sizeof(size)) {
+        throw std::runtime_error(
+            (boost::format("Reading middle file '%1%' failed.") % m_filename)
+                .str());
+    }
+    buffer.commit();
+
+    return true;
+}
+
+void object_file_t::flush()
+{
+    flush_file(m_data, m_filename);
+    m_flushed = m_size;
+    flush_file(m_log, m_filename);
+}
+
+void object_file_t::flush_object(osmid_t id)
+{
+    if (position(id) > m_flushed) {
+        flush_file(m_data, m_filename);
+        m_flushed = m_size;
+    }
+}
+
+void object_file_t::write_index(std::string const &name, std::FILE *in,
+                                std::FILE *data)
+{
+    std::FILE *out = open_file(name, "wb");
+    uint64_t data_size = 0;
+
+    // the header is written last, when the size is known
+    index_entry_t entry{0, 0};
+    write(out, &entry, sizeof(entry), name);
+
+    auto emit = [&](osmid_t id, uint64_t pos) {
+        if (data) {
+            osmium::memory::item_size_type size;
+            seek(in, pos - 1);
+            if (std::fread(&size, sizeof(size), 1, in) != 1) {
+                throw std::runtime_error(
+                    (boost::format("Reading middle file '%1%' failed.") %
+                     m_filename)
+                        .str());
+            }
+            std::vector<char> object(osmium::memory::padded_length(size));
+            std::memcpy(object.data(), &size, sizeof(size));
+            if (std::fread(object.data() + sizeof(size), 1,
+                           object.size() - sizeof(size),
+                           in) != object.size() - sizeof(size)) {
+                throw std::runtime_error(
+                    (boost::format("Reading middle file '%1%' failed.") %
+                     m_filename)
+                        .str());
+            }
+            write(data, object.data(), object.size(), m_filename);
+            pos = data_size + 1;
+            data_size += object.size();
+        }
+        entry = index_entry_t{id, pos};
+        write(out, &entry, sizeof(entry), name);
+    };
+
+    // merge the changes into the old index, both are sorted by id
+    index_entry_t const *it = nullptr;
+    index_entry_t const *end = nullptr;
+    if (m_index) {
+        it = m_index->begin();
+        end = m_index->end();
+    }
+    m_changes.for_each([&](osmid_t id, uint64_t pos) {
+        for (; it != end && it->id < id; ++it) {
+            emit(it->id, it->pos);
+        }
+        if (it != end && it->id == id) {
+            ++it;
+        }
+        if (pos != removed) {
+            emit(id, pos);
+        }
+    });
+    for (; it != end; ++it) {
+        emit(it->id, it->pos);
+    }
+
+    seek(out, 0);
+    entry = index_entry_t{0, data ? data_size : m_base_size};
+    write(out, &entry, sizeof(entry), name);
+    if (std::fclose(out) != 0) {
+        throw std::runtime_error(
+            (boost::format("Writing to middle file '%1%' failed: %2%") %
+             name % std::strerror(errno))
+                .str());
+    }
+}
+
+void object_file_t::checkpoint(bool closing)
+{
+    // A file written in one go has no replaced objects worth mentioning.
+    if (!m_append) {
+        m_base_size = m_size;
+    }
+
+    bool const copy = closing && m_size > 2 * m_base_size;
+    if (!copy &&
+        (m_log_entries == 0 ||
+         (!closing &&
+          m_log_entries < std::max<size_t>(m_index ? m_index->size() / 4 : 0,
+                                           1 << 20)))) {
+        return;
+    }
+
+    flush();
+
+    auto const logname = m_filename + ".idx";
+    auto const indexname = m_filename + ".ids";
+
+    if (copy) {
+        fprintf(stderr, "Mid: copying the objects in %s\n", m_filename.c_str());
+
+        // Until the new data file is renamed the old files are used, after
+        // that recover() finishes the job.
+        std::FILE *data = open_file(m_filename + ".new", "wb");
+        std::FILE *in = open_reader();
+        write_index(indexname + ".tmp", in, data);
+        std::fclose(in);
+        if (std::fclose(data) != 0) {
+            throw std::runtime_error(
+                (boost::format("Writing to middle file '%1%' failed: %2%") %
+                 m_filename % std::strerror(errno))
+                    .str());
+        }
+        rename_file(indexname + ".tmp", indexname + ".new");
+
+        std::fclose(m_data);
+        m_data = nullptr;
+        rename_file(m_filename + ".new", m_filename);
+
+        std::fclose(m_log);
+        m_log = nullptr;
+        m_log = open_file(logname, "wb");
+
+        m_index.reset();
+        rename_file(indexname + ".new", indexname);
+
+        m_data = open_file(m_filename, "r+b");
+        m_index.reset(new index_file_t(indexname));
+        m_size = m_index->base_size();
+        m_flushed = m_size;
+        m_base_size = m_size;
+    } else {
+        // Entries still in the log after a crash are applied again, which
+        // does not change anything.
+        write_index(indexname + ".tmp", nullptr, nullptr);
+        m_index.reset();
+        rename_file(indexname + ".tmp", indexname);
+        m_index.reset(new index_file_t(indexname));
+
+        std::fclose(m_log);
+        m_log = nullptr;
+        m_log = open_file(logname, "wb");
+    }
+
+    m_changes.clear();
+    m_log_entries = 0;
+}
+
+void object_file_t::remove_files()
+{
+    m_index.reset();
+    for (auto const &name :
+         {m_filename, m_filename + ".idx", m_filename + ".ids"}) {
+        std::remove(name.c_str());
+    }
+}
+
+reverse_index_t::run_t::run_t(uint64_t seq_, std::string const &filename,
+                              size_t size)
+: seq(seq_), fd(osmium::io::detail::open_for_reading(filename)),
+  map(size, osmium::util::MemoryMapping::mapping_mode::readonly, fd)
+{
+}
+
+reverse_index_t::run_t::~run_t()
+{
+    map.unmap();
+    ::close(fd);
+}
+
+reverse_index_t::reverse_index_t(std::string const &filename, bool append,
+                                 size_t max_changes)
+: m_filename(filename), m_max_changes(max_changes), m_log(nullptr),
+  m_next_seq(0)
+{
+    auto const seqs = read_manifest();
+    for (auto seq : seqs) {
+        m_next_seq = std::max(m_next_seq, seq + 1);
+    }
+
+    if (append) {
+        // All runs are merged again, the older ones stay as they are.
+        for (auto seq : seqs) {
+            auto const name = run_name(seq);
+            auto const size = osmium::util::file_size(name) / sizeof(entry_t);
+            m_pending.emplace_back(new run_t(seq, name, size));
+        }
+
+        // Only the changes since the last run was written are in the log.
+        // There is none if the index was created on import.
+        std::FILE *log = std::fopen((m_filename + ".log").c_str(), "rb");
+        if (log) {
+            entry_t entry;
+            while (std::fread(&entry, sizeof(entry), 1, log) == 1) {
+                m_changes.push_back(entry);
+            }
+            std::fclose(log);
+        }
+
+        m_log = open_file(m_filename + ".log", "ab");
+        merge();
+    } else {
+        // An import can simply be started again after a crash, so there is
+        // no log and the changes only go into the runs.
+        for (auto seq : seqs) {
+            std::remove(run_name(seq).c_str());
+        }
+        std::remove((m_filename + ".log").c_str());
+        write_manifest();
+    }
+}
+
+reverse_index_t::~reverse_index_t()
+{
+    if (m_log) {
+        std::fclose(m_log);
+    }
+}
+
+std::string reverse_index_t::run_name(uint64_t seq) const
+{
+    return m_filename + "." + std::to_string(seq);
+}
+
+std::vector<uint64_t> reverse_index_t::read_manifest() const
+{
+    std::vector<uint64_t> seqs;
+
+    std::FILE *file = std::fopen(m_filename.c_str(), "rb");
+    if (file) {
+        uint64_t seq;
+        while (std::fread(&seq, sizeof(seq), 1, file) == 1) {
+            seqs.push_back(seq);
+        }
+        std::fclose(file);
+    }
+
+    return seqs;
+}
+
+void reverse_index_t::write_manifest() const
+{
+    auto const tmpname = m_filename + ".tmp";
+    std::FILE *file = open_file(tmpname, "wb");
+    for (auto const *runs : {&m_runs, &m_pending}) {
+        for (auto const &run : *runs) {
+            write(file, &run->seq, sizeof(run->seq), tmpname);
+        }
+    }
+    if (std::fclose(file) != 0) {
+        throw std::runtime_error(
+            (boost::format("Writing to middle file '%1%' failed: %2%") %
+             tmpname % std::strerror(errno))
+                .str());
+    }
+
+    rename_file(tmpname, m_filename);
+}
+
+void reverse_index_t::change(osmid_t member, osmid_t parent, bool add)
+{
+    entry_t const entry{member, parent, add};
+    m_changes.push_back(entry);
+    if (m_log) {
+        write(m_log, &entry, sizeof(entry), m_filename);
+    }
+
+    if (m_changes.size() >= m_max_changes) {
+        spill();
+    }
+}
+
+void reverse_index_t::spill()
+{
+    if (m_changes.empty()) {
+        return;
+    }
+
+    // keep the order of changes to the same pair, the last one counts
+    std::stable_sort(m_changes.begin(), m_changes.end(),
+                     [](entry_t const &a, entry_t const &b) {
+                         return a.key() < b.key();
+                     });
+
+    auto const seq = m_next_seq++;
+    auto const name = run_name(seq);
+    std::FILE *out = open_file(name, "wb");
+    size_t size = 0;
+    for (size_t i = 0; i < m_changes.size(); ++i) {
+        auto const &c = m_changes[i];
+        if (i + 1 < m_changes.size() && m_changes[i + 1].key() == c.key()) {
+            continue;
+        }
+        write(out, &c, sizeof(c), name);
+        ++size;
+    }
+    std::fclose(out);
+    m_changes.clear();
+
+    push(&m_pending, std::unique_ptr<run_t>(new run_t(seq, name, size)),
+         false);
+    write_manifest();
+
+    // everything in the log is in the runs now
+    if (m_log) {
+        std::fclose(m_log);
+        m_log = open_file(m_filename + ".log", "wb");
+    }
+}
+
+void reverse_index_t::push(run_list_t *runs, std::unique_ptr<run_t> run,
+                           bool drop_removed)
+{
+    runs->push_back(std::move(run));
+
+    // Keep every run at least twice as large as the next newer one, so
+    // that each entry is only merged a logarithmic number of times.
+    while (runs->size() >= 2 &&
+           (*runs)[runs->size() - 2]->size() <=
+               2 * runs->back()->size()) {
+        auto &older = *(*runs)[runs->size() - 2];
+        auto &newer = *runs->back();
+        // removals only need to be kept while there is an older run
+        auto merged =
+            merge_runs(older, newer, drop_removed && runs->size() == 2);
+
+        std::vector<std::string> obsolete{run_name(older.seq),
+                                          run_name(newer.seq)};
+        runs->pop_back();
+        runs->pop_back();
+        if (merged) {
+            runs->push_back(std::move(merged));
+        }
+
+        write_manifest();
+        for (auto const &name : obsolete) {
+            std::remove(name.c_str());
+        }
+    }
+}
+
+std::unique_ptr<reverse_index_t::run_t>
+reverse_index_t::merge_runs(run_t const &older, run_t const &newer,
+                            bool drop_removed)
+{
+    auto const seq = m_next_seq++;
+    auto const name = run_name(seq);
+    std::FILE *out = open_file(name, "wb");
+    size_t size = 0;
+
+    auto emit = [&](entry_t const &e) {
+        if (e.added() || !drop_removed) {
+            write(out, &e, sizeof(e), name);
+            ++size;
+        }
+    };
+
+    auto a = older.begin();
+    auto b = newer.begin();
+    while (a != older.end() || b != newer.end()) {
+        if (b == newer.end() ||
+            (a != older.end() && a->key() < b->key())) {
+            emit(*a++);
+        } else {
+            if (a != older.end() && a->key() == b->key()) {
+                ++a;
+            }
+            emit(*b++);
+        }
+    }
+
+    std::fclose(out);
+
+    if (size == 0) {
+        std::remove(name.c_str());
+        return nullptr;
+    }
+
+    return std::unique_ptr<run_t>(new run_t(seq, name, size));
+}
+
+void reverse_index_t::merge()
+{
+    spill();
+
+    if (m_pending.empty()) {
+        return;
+    }
+
+    // the manifest has to list the pending runs until they are moved over
+    while (!m_pending.empty()) {
+        auto run = std::move(m_pending.front());
+        m_pending.erase(m_pending.begin());
+        push(&m_runs, std::move(run), true);
+    }
+    write_manifest();
+}
+
+void reverse_index_t::get_parents(osmid_t member,
+                                  std::vector<osmid_t> *parents) const
+{
+    // parents already decided by a newer run
+    std::vector<osmid_t> seen;
+
+    for (auto it = m_runs.rbegin(); it != m_runs.rend(); ++it) {
+        auto const &run = **it;
+        auto e = std::lower_bound(
+            run.begin(), run.end(), member,
+            [](entry_t const &a, osmid_t m) { return a.member < m; });
+
+        auto const known = seen.size();
+        for (; e != run.end() && e->member == member; ++e) {
+            if (std::find(seen.begin(), seen.begin() + known, e->parent()) !=
+                seen.begin() + known) {
+                continue;
+            }
+            seen.push_back(e->parent());
+            if (e->added()) {
+                parents->push_back(e->parent());
+            }
+        }
+    }
+
+    std::sort(parents->begin(), parents->end());
+}
+
+void reverse_index_t::flush()
+{
+    if (m_log) {
+        flush_file(m_log, m_filename);
+    } else {
+        spill();
+    }
+}
+
+void reverse_index_t::remove_files()
+{
+    for (auto const *runs : {&m_runs, &m_pending}) {
+        for (auto const &run : *runs) {
+            std::remove(run_name(run->seq).c_str());
+        }
+    }
+    std::remove((m_filename + ".log").c_str());
+    std::remove(m_filename.c_str());
+}
+
+void reverse_index_t::remove_files(std::string const &filename)
+{
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (file) {
+        uint64_t seq;
+        while (std::fread(&seq, sizeof(seq), 1, file) == 1) {
+            std::remove((filename + "." + std::to_string(seq)).c_str());
+        }
+        std::fclose(file);
+    }
+    std::remove((filename + ".log").c_str());
+    std::remove(filename.c_str());
+}
+
+middle_file_t::store_t::store_t(std::string const &dir, bool append,
+                                bool reverse_indexes)
+: ways(dir + "/ways.dat", append), rels(dir + "/rels.dat", append),
+  m_dir(dir)
+{
+    if (reverse_indexes) {
+        node_ways.reset(new reverse_index_t(dir + "/node-ways.idx", append));
+        node_rels.reset(new reverse_index_t(dir + "/node-rels.idx", append));
+        way_rels.reset(new reverse_index_t(dir + "/way-rels.idx", append));
+        rel_rels.reset(new reverse_index_t(dir + "/rel-rels.idx", append));
+    }
+}
+
+void middle_file_t::store_t::flush()
+{
+    ways.flush();
+    rels.flush();
+    if (node_ways) {
+        node_ways->flush();
+        node_rels->flush();
+        way_rels->flush();
+        rel_rels->flush();
+    }
+}
+
+void middle_file_t::store_t::checkpoint()
+{
+    ways.checkpoint(false);
+    rels.checkpoint(false);
+}
+
+void middle_file_t::store_t::close()
+{
+    flush();
+    ways.checkpoint(true);
+    rels.checkpoint(true);
+}
+
+void middle_file_t::store_t::merge()
+{
+    if (node_ways) {
+        node_ways->merge();
+        node_rels->merge();
+        way_rels->merge();
+        rel_rels->merge();
+    }
+}
+
+void middle_file_t::store_t::remove_files()
+{
+    ways.remove_files();
+    rels.remove_files();
+
+    if (node_ways) {
+        node_ways->remove_files();
+        node_rels->remove_files();
+        way_rels->remove_files();
+        rel_rels->remove_files();
+    } else {
+        // left behind by an earlier run without --drop
+        for (auto const *name : {"/node-ways.idx", "/node-rels.idx",
+                                 "/way-rels.idx", "/rel-rels.idx"}) {
+            reverse_index_t::remove_files(m_dir + name);
+        }
+    }
+}
+
+middle_file_t::middle_file_t()
+: m_writer(false), m_mark_pending(true),
+  m_buffer(4096, osmium::memory::Buffer::auto_grow::yes)
+{
+}
+
+middle_file_t::~middle_file_t() = default;
+
+void middle_file_t::open_readers()
+{
+    m_way_reader.reset(m_store->ways.open_reader());
+    m_rel_reader.reset(m_store->rels.open_reader());
+}
+
+void middle_file_t::start(const options_t *out_options_)
+{
+    out_options = out_options_;
+
+    // The gazetteer does not use the pending processing.
+    m_mark_pending = out_options->output_backend != "gazetteer";
+
+    m_ways_pending.reset(new id_tracker());
+    m_rels_pending.reset(new id_tracker());
+
+    m_cache.reset(new node_ram_cache(out_options->alloc_chunkwise | ALLOC_LOSSY,
+                                     out_options->cache));
+    m_persistent_cache.reset(new node_persistent_cache(out_options, m_cache));
+
+    fprintf(stderr, "Mid: file, directory=%s, cache=%d\n",
+            out_options->middle_dir->c_str(), out_options->cache);
+
+    // The reverse indexes are only needed for updates.
+    m_store = std::make_shared<store_t>(
+        *out_options->middle_dir, out_options->append,
+        out_options->append || !out_options->droptemp);
+    m_writer = true;
+    open_readers();
+}
+
+void middle_file_t::resume(const options_t *out_options_)
+{
+    out_options = out_options_;
+
+    // Only stop() is left to do, which needs the files but no readers.
+    m_store = std::make_shared<store_t>(*out_options->middle_dir, true,
+                                        !out_options->droptemp);
+    m_writer = true;
+}
+
+void middle_file_t::stop(osmium::thread::Pool &)
+{
+    m_cache.reset();
+    m_persistent_cache.reset();
+
+    m_way_reader.reset();
+    m_rel_reader.reset();
+
+    if (out_options->droptemp) {
+        fprintf(stderr, "Mid: removing middle files in %s\n",
+                out_options->middle_dir->c_str());
+        m_store->remove_files();
+    } else {
+        m_store->close();
+    }
+    m_store.reset();
+}
+
+void middle_file_t::analyze(void)
+{
+    /* No need */
+}
+
+void middle_file_t::end(void)
+{
+    /* No need */
+}
+
+void middle_file_t::commit(void)
+{
+    m_store->flush();
+    // an import writes its index files when the middle is closed
+    if (out_options->append) {
+        m_store->checkpoint();
+    }
+    m_store->merge();
+    mark_changed();
+}
+
+void middle_file_t::mark_changed()
+{
+    if (!m_store->node_ways) {
+        return;
+    }
+
+    osmid_t id;
+    while (id_tracker::is_valid(id = m_changed_nodes.pop_mark())) {
+        m_store->node_ways->for_each_parent(
+            id, [this](osmid_t way) { m_ways_pending->mark(way); });
+        m_store->node_rels->for_each_parent(
+            id, [this](osmid_t rel) { m_rels_pending->mark(rel); });
+    }
+
+    while (id_tracker::is_valid(id = m_changed_ways.pop_mark())) {
+        m_store->way_rels->for_each_parent(
+            id, [this](osmid_t rel) { m_rels_pending->mark(rel); });
+    }
+
+    while (id_tracker::is_valid(id = m_changed_rels.pop_mark())) {
+        m_store->rel_rels->for_each_parent(
+            id, [this](osmid_t rel) { m_rels_pending->mark(rel); });
+    }
+}
+
+void middle_file_t::nodes_set(osmium::Node const &node)
+{
+    m_cache->set(node.id(), node.location());
+    m_persistent_cache->set(node.id(), node.location());
+}
+
+size_t middle_file_t::nodes_get_list(osmium::WayNodeList *nodes) const
+{
+    return m_persistent_cache->get_list(nodes);
+}
+
+void middle_file_t::nodes_delete(osmid_t id)
+{
+    m_persistent_cache->set(id, osmium::Location());
+}
+
+void middle_file_t::node_changed(osmid_t id)
+{
+    // The parents are looked up before the pending objects are processed,
+    // once the reverse indexes contain all changes of the diff.
+    if (m_mark_pending) {
+        m_changed_nodes.mark(id);
+    }
+}
+
+void middle_file_t::ways_set(osmium::Way const &way)
+{
+    m_store->ways.add(way);
+    if (m_store->node_ways) {
+        for (auto const &n : way.nodes()) {
+            m_store->node_ways->add(n.ref(), way.id());
+        }
+    }
+}
+
+bool middle_file_t::get_object(object_file_t &file, std::FILE *in, osmid_t id,
+                               osmium::memory::Buffer &buffer) const
+{
+    if (m_writer) {
+        file.flush_object(id);
+    }
+    return file.get(in, id, buffer);
+}
+
+bool middle_file_t::ways_get(osmid_t id, osmium::memory::Buffer &buffer) const
+{
+    return get_object(m_store->ways, m_way_reader.get(), id, buffer);
+}
+
+size_t middle_file_t::rel_way_members_get(osmium::Relation const &rel,
+                                          rolelist_t *roles,
+                                          osmium::memory::Buffer &buffer) const
+{
+    size_t count = 0;
+    for (auto const &m : rel.members()) {
+        if (m.type() == osmium::item_type::way && ways_get(m.ref(), buffer)) {
+            if (roles) {
+                roles->emplace_back(m.role());
+            }
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+void middle_file_t::ways_delete(osmid_t id)
+{
+    m_buffer.clear();
+    if (!get_object(m_store->ways, m_way_reader.get(), id, m_buffer)) {
+        return;
+    }
+
+    for (auto const &n : m_buffer.get<osmium::Way>(0).nodes()) {
+        m_store->node_ways->remove(n.ref(), id);
+    }
+    m_store->ways.remove(id);
+}
+
+void middle_file_t::way_changed(osmid_t id)
+{
+    m_changed_ways.mark(id);
+}
+
+bool middle_file_t::relations_get(osmid_t id,
+                                  osmium::memory::Buffer &buffer) const
+{
+    return get_object(m_store->rels, m_rel_reader.get(), id, buffer);
+}
+
+void middle_file_t::relations_set(osmium::Relation const &rel)
+{
+    m_store->rels.add(rel);
+    if (!m_store->node_ways) {
+        return;
+    }
+
+    for (auto const &m : rel.members()) {
+        switch (m.type()) {
+        case osmium::item_type::node:
+            m_store->node_rels->add(m.ref(), rel.id());
+            break;
+        case osmium::item_type::way:
+            m_store->way_rels->add(m.ref(), rel.id());
+            break;
+        case osmium::item_type::relation:
+            m_store->rel_rels->add(m.ref(), rel.id());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void middle_file_t::relations_delete(osmid_t id)
+{
+    m_buffer.clear();
+    if (!get_object(m_store->rels, m_rel_reader.get(), id, m_buffer)) {
+        return;
+    }
+
+    for (auto const &m : m_buffer.get<osmium::Relation>(0).members()) {
+        switch (m.type()) {
+        case osmium::item_type::node:
+            m_store->node_rels->remove(m.ref(), id);
+            break;
+        case osmium::item_type::way:
+            // the member ways may need to be rendered on their own now
+            m_ways_pending->mark(m.ref());
+            m_store->way_rels->remove(m.ref(), id);
+            break;
+        case osmium::item_type::relation:
+            m_store->rel_rels->remove(m.ref(), id);
+            break;
+        default:
+            break;
+        }
+    }
+    m_store->rels.remove(id);
+}
+
+void middle_file_t::relation_changed(osmid_t id)
+{
+    m_changed_rels.mark(id);
+}
+
+void middle_file_t::iterate_ways(middle_t::pending_processor& pf)
+{
+    m_store->merge();
+    mark_changed();
+
+    osmid_t id;
+    while (id_tracker::is_valid(id = m_ways_pending->pop_mark())) {
+        pf.enqueue_ways(id);
+    }
+    // in case we had higher ones than the middle
+    pf.enqueue_ways(id_tracker::max());
+
+    pf.process_ways();
+}
+
+void middle_file_t::iterate_relations(pending_processor& pf)
+{
+    m_store->merge();
+    mark_changed();
+
+    osmid_t id;
+    while (id_tracker::is_valid(id = m_rels_pending->pop_mark())) {
+        pf.enqueue_relations(id);
+    }
+    // in case we had higher ones than the middle
+    pf.enqueue_relations(id_tracker::max());
+
+    pf.process_relations();
+}
+
+size_t middle_file_t::pending_count() const
+{
+    return m_ways_pending->size() + m_rels_pending->size();
+}
+
+idlist_t middle_file_t::relations_using_way(osmid_t way_id) const
+{
+    idlist_t rel_ids;
+    if (m_store->way_rels) {
+        m_store->way_rels->for_each_parent(
+            way_id, [&rel_ids](osmid_t rel) { rel_ids.push_back(rel); });
+    }
+
+    return rel_ids;
+}
+
+std::shared_ptr<middle_query_t>
+middle_file_t::get_query_instance(std::shared_ptr<middle_t> const &from) const
+{
+    auto *src = dynamic_cast<middle_file_t *>(from.get());
+    assert(src);
+
+    // The instances share the data and indexes, which are only read while
+    // the pending objects are processed. Each one has its own file handles.
+    std::unique_ptr<middle_file_t> mid(new middle_file_t());
+    mid->out_options = src->out_options;
+    mid->m_store = src->m_store;
+    mid->m_cache = src->m_cache;
+    mid->m_persistent_cache = src->m_persistent_cache;
+    mid->m_ways_pending = src->m_ways_pending;
+    mid->m_rels_pending = src->m_rels_pending;
+    mid->open_readers();
+
+    return std::shared_ptr<middle_query_t>(mid.release());
+}
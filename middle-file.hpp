@@ -0,0 +1,376 @@
+/* Implements the mid-layer processing for osm2pgsql
+ * using files in a local directory instead of database tables.
+ *
+ * Ways and relations are appended to data files, their positions are
+ * kept in an index file and a log of the changes since it was written,
+ * both next to the data. Node locations live in the flat node file.
+ * Which ways and relations use a node, way or relation is tracked in
+ * reverse indexes, so that diffs can be applied without any database
+ * access for the middle.
+*/
+
+#ifndef MIDDLE_FILE_H
+#define MIDDLE_FILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/util/memory_mapping.hpp>
+
+#include "id-tracker.hpp"
+#include "middle-ram.hpp"
+#include "middle.hpp"
+
+class node_persistent_cache;
+struct node_ram_cache;
+
+/**
+ * Append-only file of OSM objects. The positions of the objects are kept
+ * in a sorted index file, which is memory mapped, and, for the objects
+ * changed since that was written, in memory. The changes are logged to a
+ * second file, from which they are read again when the file is opened for
+ * updates. checkpoint() folds them into a new index file and copies the
+ * objects into a new data file once it is mostly taken up by replaced
+ * ones.
+ */
+class object_file_t
+{
+public:
+    object_file_t(std::string const &filename, bool append);
+    ~object_file_t();
+
+    object_file_t(object_file_t const &) = delete;
+    object_file_t &operator=(object_file_t const &) = delete;
+
+    void add(osmium::OSMObject const &obj);
+    void remove(osmid_t id);
+
+    /// Open a new handle for reading with get().
+    std::FILE *open_reader() const;
+
+    /**
+     * Append the object to the buffer, reading it through the handle in.
+     * The object must have been written out with flush() or
+     * flush_object().
+     */
+    bool get(std::FILE *in, osmid_t id, osmium::memory::Buffer &buffer) const;
+
+    /// Write out everything added so far.
+    void flush();
+
+    /// Write out the data if the object was added since the last flush.
+    void flush_object(osmid_t id);
+
+    /**
+     * Fold the logged changes into a new index file. Unless closing, this
+     * only happens once the log has grown to a quarter of the index. When
+     * closing, the objects are also copied into a new data file if it has
+     * grown to twice the size it had after the last copy, so no handle
+     * from open_reader() may be used afterwards.
+     */
+    void checkpoint(bool closing);
+
+    /// Remove the data, index and log files.
+    void remove_files();
+
+    std::string const &filename() const { return m_filename; }
+
+private:
+    struct index_entry_t
+    {
+        osmid_t id;
+        uint64_t pos;
+    };
+
+    /**
+     * Memory mapped index file, sorted by id. The first entry is a header
+     * with the size of the data file after the objects were last copied
+     * in pos.
+     */
+    struct index_file_t
+    {
+        explicit index_file_t(std::string const &filename);
+        ~index_file_t();
+
+        index_file_t(index_file_t const &) = delete;
+        index_file_t &operator=(index_file_t const &) = delete;
+
+        index_entry_t const *begin() const { return map.begin() + 1; }
+        index_entry_t const *end() const { return map.end(); }
+        size_t size() const { return map.size() - 1; }
+        uint64_t base_size() const { return map.begin()->pos; }
+
+        int fd;
+        osmium::util::TypedMemoryMapping<index_entry_t> map;
+    };
+
+    /// value in m_changes for a removed object
+    static constexpr uint64_t removed = ~uint64_t(0);
+
+    /// Position of the object in the file plus one, 0 when there is none.
+    uint64_t position(osmid_t id) const;
+
+    /// Is the object starting at the position completely in the file?
+    bool object_fits(uint64_t pos) const;
+
+    void log(osmid_t id, uint64_t pos);
+
+    /// Finish or roll back a checkpoint interrupted by a crash.
+    void recover();
+
+    /**
+     * Write all current positions to a new index file. With a data file
+     * given, the objects are copied there, read through in, and the index
+     * points to the copies.
+     */
+    void write_index(std::string const &name, std::FILE *in, std::FILE *data);
+
+    std::string m_filename;
+    std::FILE *m_data;
+    std::FILE *m_log;
+    uint64_t m_size;
+    /// size of the part of the file known to be written out
+    uint64_t m_flushed;
+    /// size of the file after the objects were last copied
+    uint64_t m_base_size;
+    /// number of changes in the log
+    size_t m_log_entries;
+    bool m_append;
+    std::unique_ptr<index_file_t> m_index;
+    /// position plus one or removed for objects changed since the index
+    elem_cache_t<uint64_t, 10> m_changes;
+};
+
+/**
+ * Relation between objects and the ways or relations they are a member
+ * of.
+ *
+ * The relation is kept on disk in sorted runs of (member, parent) entries
+ * which are memory mapped for lookups. Changes are collected in memory and,
+ * when the index is opened for updates, logged to a file; whenever too many
+ * of them have been collected they are written out as a new run. Runs
+ * only become visible for lookups after merge(). Newer runs are merged into
+ * older ones of similar size, so that there are only ever few of them. The
+ * list of runs is kept in a manifest file, from which the index is opened
+ * again for updates.
+ */
+class reverse_index_t
+{
+public:
+    reverse_index_t(std::string const &filename, bool append,
+                    size_t max_changes = 1 << 20);
+    ~reverse_index_t();
+
+    reverse_index_t(reverse_index_t const &) = delete;
+    reverse_index_t &operator=(reverse_index_t const &) = delete;
+
+    void add(osmid_t member, osmid_t parent) { change(member, parent, true); }
+    void remove(osmid_t member, osmid_t parent)
+    {
+        change(member, parent, false);
+    }
+
+    /// Apply all changes since the last merge, the last one wins.
+    void merge();
+
+    /// Call func(parent) for all parents of the member.
+    template <typename F>
+    void for_each_parent(osmid_t member, F &&func) const
+    {
+        std::vector<osmid_t> parents;
+        get_parents(member, &parents);
+        for (auto parent : parents) {
+            func(parent);
+        }
+    }
+
+    void flush();
+
+    /// Remove the manifest, the log and all runs.
+    void remove_files();
+
+    /// Remove the files of an index that was not opened.
+    static void remove_files(std::string const &filename);
+
+private:
+    /// A (member, parent) pair, 16 bytes on disk.
+    struct entry_t
+    {
+        entry_t() = default;
+        entry_t(osmid_t member_, osmid_t parent, bool add)
+        : member(member_), parent_add(parent * 2 + (add ? 1 : 0))
+        {}
+
+        osmid_t parent() const { return (parent_add - (added() ? 1 : 0)) / 2; }
+
+        /// Was the pair added or removed?
+        bool added() const { return (parent_add & 1) != 0; }
+
+        std::pair<osmid_t, osmid_t> key() const { return {member, parent()}; }
+
+        osmid_t member;
+        /// twice the parent id, plus one if the pair was added
+        int64_t parent_add;
+    };
+
+    static_assert(sizeof(entry_t) == 16, "entries must stay packed");
+
+    /// A sorted file of entries, unique in (member, parent).
+    struct run_t
+    {
+        run_t(uint64_t seq_, std::string const &filename, size_t size);
+        ~run_t();
+
+        run_t(run_t const &) = delete;
+        run_t &operator=(run_t const &) = delete;
+
+        entry_t const *begin() const { return map.begin(); }
+        entry_t const *end() const { return map.end(); }
+        size_t size() const { return map.size(); }
+
+        uint64_t seq;
+        int fd;
+        osmium::util::TypedMemoryMapping<entry_t> map;
+    };
+
+    /// oldest run first
+    using run_list_t = std::vector<std::unique_ptr<run_t>>;
+
+    void change(osmid_t member, osmid_t parent, bool add);
+    void get_parents(osmid_t member, std::vector<osmid_t> *parents) const;
+
+    std::string run_name(uint64_t seq) const;
+    std::vector<uint64_t> read_manifest() const;
+    void write_manifest() const;
+
+    /// Write the collected changes out as a new run.
+    void spill();
+
+    /// Add a run to the list and merge the newest runs of similar size.
+    void push(run_list_t *runs, std::unique_ptr<run_t> run,
+              bool drop_removed);
+
+    /**
+     * Merge two runs into a new one, entries of the newer run win.
+     * Returns nullptr if nothing is left.
+     */
+    std::unique_ptr<run_t> merge_runs(run_t const &older, run_t const &newer,
+                                      bool drop_removed);
+
+    std::string m_filename;
+    size_t m_max_changes;
+    std::FILE *m_log;
+    std::vector<entry_t> m_changes;
+    /// runs visible for lookups
+    run_list_t m_runs;
+    /// runs written since the last merge
+    run_list_t m_pending;
+    uint64_t m_next_seq;
+};
+
+struct middle_file_t : public slim_middle_t {
+    middle_file_t();
+    virtual ~middle_file_t();
+
+    void start(const options_t *out_options_) override;
+    void stop(osmium::thread::Pool &pool) override;
+    void resume(const options_t *out_options_) override;
+    void analyze(void) override;
+    void end(void) override;
+    void commit(void) override;
+
+    void nodes_set(osmium::Node const &node) override;
+    size_t nodes_get_list(osmium::WayNodeList *nodes) const override;
+    void nodes_delete(osmid_t id) override;
+    void node_changed(osmid_t id) override;
+
+    void ways_set(osmium::Way const &way) override;
+    bool ways_get(osmid_t id, osmium::memory::Buffer &buffer) const override;
+    size_t rel_way_members_get(osmium::Relation const &rel, rolelist_t *roles,
+                               osmium::memory::Buffer &buffer) const override;
+
+    void ways_delete(osmid_t id) override;
+    void way_changed(osmid_t id) override;
+
+    bool relations_get(osmid_t id, osmium::memory::Buffer &buffer) const override;
+    void relations_set(osmium::Relation const &rel) override;
+    void relations_delete(osmid_t id) override;
+    void relation_changed(osmid_t id) override;
+
+    void iterate_ways(middle_t::pending_processor& pf) override;
+    void iterate_relations(pending_processor& pf) override;
+
+    size_t pending_count() const override;
+
+    idlist_t relations_using_way(osmid_t way_id) const override;
+
+    std::shared_ptr<middle_query_t>
+    get_query_instance(std::shared_ptr<middle_t> const &mid) const override;
+
+private:
+    /// Everything shared between the middle and its query instances.
+    struct store_t
+    {
+        store_t(std::string const &dir, bool append, bool reverse_indexes);
+
+        void flush();
+        void merge();
+        /// Write the index files of the objects if the logs are large.
+        void checkpoint();
+        /// Flush and fold the logs in before the middle is closed.
+        void close();
+        void remove_files();
+
+        object_file_t ways;
+        object_file_t rels;
+        /// not there when the middle is dropped after the import
+        std::unique_ptr<reverse_index_t> node_ways;
+        std::unique_ptr<reverse_index_t> node_rels;
+        std::unique_ptr<reverse_index_t> way_rels;
+        std::unique_ptr<reverse_index_t> rel_rels;
+
+    private:
+        std::string m_dir;
+    };
+
+    struct file_closer_t
+    {
+        void operator()(std::FILE *file) const { std::fclose(file); }
+    };
+
+    void open_readers();
+
+    /**
+     * Read an object through the handle in. The middle writing the files
+     * may read what it has just added, so it flushes it first. Query
+     * instances only ever read flushed data.
+     */
+    bool get_object(object_file_t &file, std::FILE *in, osmid_t id,
+                    osmium::memory::Buffer &buffer) const;
+
+    /// Turn the objects changed in a diff into pending ways and relations.
+    void mark_changed();
+
+    std::shared_ptr<store_t> m_store;
+    /// this is the middle writing the files, not a query instance
+    bool m_writer;
+    std::unique_ptr<std::FILE, file_closer_t> m_way_reader;
+    std::unique_ptr<std::FILE, file_closer_t> m_rel_reader;
+
+    std::shared_ptr<node_ram_cache> m_cache;
+    std::shared_ptr<node_persistent_cache> m_persistent_cache;
+
+    bool m_mark_pending;
+    id_tracker m_changed_nodes, m_changed_ways, m_changed_rels;
+    std::shared_ptr<id_tracker> m_ways_pending, m_rels_pending;
+
+    /// scratch space for old versions of objects
+    osmium::memory::Buffer m_buffer;
+};
+
+#endif
@@ -16,6 +16,7 @@ using namespace std;
 #define alloca _alloca
 #endif
 
+#include <algorithm>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -32,9 +33,12 @@ using namespace std;
 
 #include <libpq-fe.h>
 
+#include "checkpoint.hpp"
+#include "copy-writer.hpp"
 #include "middle-pgsql.hpp"
 #include "node-persistent-cache.hpp"
 #include "node-ram-cache.hpp"
+#include "number-format.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
 #include "output-pgsql.hpp"
@@ -165,6 +169,7 @@ int pgsql_endCopy(middle_pgsql_t::table_desc *table)
     // Terminate any pending COPY */
     if (table->copyMode) {
         PGconn *sql_conn = table->sql_conn;
+        table->copy_writer->finish(sql_conn);
         int stop = PQputCopyEnd(sql_conn, nullptr);
         if (stop != 1) {
             fprintf(stderr, "COPY_END for %s failed: %s\n", table->copy, PQerrorMessage(sql_conn));
@@ -180,6 +185,44 @@ int pgsql_endCopy(middle_pgsql_t::table_desc *table)
     }
     return 0;
 }
+
+/// End any COPY and run all statements queued for the table.
+void pgsql_sync(middle_pgsql_t::table_desc *table)
+{
+    if (table->pipeline) {
+        table->pipeline->sync();
+    }
+    pgsql_endCopy(table);
+}
+
+/// Result handler for the mark queries, marks all ids in the tracker.
+pg_pipeline_t::handler_t mark_handler(std::shared_ptr<id_tracker> const &tracker)
+{
+    return [tracker](PGresult *res) {
+        for (int i = 0; i < PQntuples(res); ++i) {
+            tracker->mark(strtoosmid(PQgetvalue(res, i, 0), nullptr, 10));
+        }
+    };
+}
+
+/// Hand a complete COPY row to the table's writer.
+void copy_row(middle_pgsql_t::table_desc *table, std::string const &row)
+{
+    table->copy_writer->buffer() += row;
+    table->copy_writer->row_done(table->sql_conn);
+}
+
+/// PostgreSQL array literal of the ids.
+std::string id_array(idlist_t const &ids)
+{
+    std::string list("{");
+    for (auto const id : ids) {
+        util::append_int(list, id);
+        list += ',';
+    }
+    list[list.size() - 1] = '}';
+    return list;
+}
 } // anonymous namespace
 
 
@@ -264,23 +307,26 @@ void middle_pgsql_t::local_nodes_set(osmium::Node const &node)
         copy_buffer.c_str(),
     };
 
-    copy_buffer = std::to_string(node.id());
+    copy_buffer.clear();
+
+    util::append_int(copy_buffer, node.id());
     copy_buffer += delim;
 
     paramValues[1] = paramValues[0] + copy_buffer.size();
-    copy_buffer += std::to_string(node.location().y());
+    util::append_int(copy_buffer, node.location().y());
     copy_buffer += delim;
 
     paramValues[2] = paramValues[0] + copy_buffer.size();
-    copy_buffer += std::to_string(node.location().x());
+    util::append_int(copy_buffer, node.location().x());
 
     if (copy) {
         copy_buffer += '\n';
-        pgsql_CopyData(__FUNCTION__, node_table->sql_conn, copy_buffer);
+        copy_row(node_table, copy_buffer);
     } else {
         buffer_correct_params(paramValues, 4);
-        pgsql_execPrepared(node_table->sql_conn, "insert_node", 3,
-                           (const char *const *)paramValues, PGRES_COMMAND_OK);
+        node_table->pipeline->exec_prepared(
+            node_table->sql_conn, "insert_node", 3,
+            (const char *const *)paramValues, PGRES_COMMAND_OK);
     }
 }
 
@@ -293,12 +339,19 @@ size_t middle_pgsql_t::local_nodes_get_list(osmium::WayNodeList *nodes) const
     // at the same time build a list for querying missing nodes from DB
     size_t pos = 0;
     for (auto &n : *nodes) {
-        auto loc = cache->get(n.ref());
+        // the cache was already asked for the nodes of prefetched ways
+        osmium::Location loc;
+        auto const el = prefetched_locs.find(n.ref());
+        if (el != prefetched_locs.end()) {
+            loc = el->second;
+        } else {
+            loc = cache->get(n.ref());
+        }
         if (loc.valid()) {
             n.set_location(loc);
             ++count;
         } else {
-            buffer += std::to_string(n.ref());
+            util::append_int(buffer, n.ref());
             buffer += ',';
         }
         ++pos;
@@ -311,35 +364,43 @@ size_t middle_pgsql_t::local_nodes_get_list(osmium::WayNodeList *nodes) const
     // get any remaining nodes from the DB
     buffer[buffer.size() - 1] = '}';
 
-    pgsql_endCopy(node_table);
+    std::unordered_map<osmid_t, osmium::Location> locs;
+    local_nodes_fetch(buffer, &locs);
+
+    for (auto &n : *nodes) {
+        auto el = locs.find(n.ref());
+        if (el != locs.end()) {
+            n.set_location(el->second);
+            ++count;
+        }
+
+    }
+
+    return count;
+}
+
+void middle_pgsql_t::local_nodes_fetch(
+    std::string const &ids,
+    std::unordered_map<osmid_t, osmium::Location> *locs) const
+{
+    pgsql_sync(node_table);
 
     PGconn *sql_conn = node_table->sql_conn;
 
     char const *paramValues[1];
-    paramValues[0] = buffer.c_str();
+    paramValues[0] = ids.c_str();
     auto res = pgsql_execPrepared(sql_conn, "get_node_list", 1, paramValues,
                                   PGRES_TUPLES_OK);
     auto countPG = PQntuples(res.get());
 
-    std::unordered_map<osmid_t, osmium::Location> locs;
+    locs->reserve(locs->size() + static_cast<size_t>(countPG));
     for (int i = 0; i < countPG; ++i) {
-        locs.emplace(
+        locs->emplace(
             strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10),
             osmium::Location(
                 (int)strtol(PQgetvalue(res.get(), i, 2), nullptr, 10),
                 (int)strtol(PQgetvalue(res.get(), i, 1), nullptr, 10)));
     }
-
-    for (auto &n : *nodes) {
-        auto el = locs.find(n.ref());
-        if (el != locs.end()) {
-            n.set_location(el->second);
-            ++count;
-        }
-
-    }
-
-    return count;
 }
 
 void middle_pgsql_t::nodes_set(osmium::Node const &node)
@@ -360,6 +421,61 @@ size_t middle_pgsql_t::nodes_get_list(osmium::WayNodeList *nodes) const
         : local_nodes_get_list(nodes);
 }
 
+size_t middle_pgsql_t::nodes_get_ways(osmium::memory::Buffer *ways) const
+{
+    if (out_options->flat_node_cache_enabled) {
+        return middle_query_t::nodes_get_ways(ways);
+    }
+
+    // Take what is in the cache and collect the rest, so that all member
+    // ways of a relation need only a single query.
+    size_t count = 0;
+    std::vector<osmid_t> missing;
+    for (auto &w : ways->select<osmium::Way>()) {
+        for (auto &n : w.nodes()) {
+            auto loc = cache->get(n.ref());
+            if (loc.valid()) {
+                n.set_location(loc);
+                ++count;
+            } else {
+                missing.push_back(n.ref());
+            }
+        }
+    }
+
+    if (missing.empty()) {
+        return count;
+    }
+
+    // ways of a relation share their end nodes
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+    std::string buffer("{");
+    for (auto const id : missing) {
+        util::append_int(buffer, id);
+        buffer += ',';
+    }
+    buffer[buffer.size() - 1] = '}';
+
+    std::unordered_map<osmid_t, osmium::Location> locs;
+    local_nodes_fetch(buffer, &locs);
+
+    for (auto &w : ways->select<osmium::Way>()) {
+        for (auto &n : w.nodes()) {
+            if (!n.location().valid()) {
+                auto el = locs.find(n.ref());
+                if (el != locs.end()) {
+                    n.set_location(el->second);
+                    ++count;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
 void middle_pgsql_t::local_nodes_delete(osmid_t osm_id)
 {
     char const *paramValues[1];
@@ -369,7 +485,8 @@ void middle_pgsql_t::local_nodes_delete(osmid_t osm_id)
 
     sprintf( buffer, "%" PRIdOSMID, osm_id );
     paramValues[0] = buffer;
-    pgsql_execPrepared(node_table->sql_conn, "delete_node", 1, paramValues, PGRES_COMMAND_OK );
+    node_table->pipeline->exec_prepared(node_table->sql_conn, "delete_node", 1,
+                                        paramValues, PGRES_COMMAND_OK);
 }
 
 void middle_pgsql_t::nodes_delete(osmid_t osm_id)
@@ -398,21 +515,15 @@ void middle_pgsql_t::node_changed(osmid_t osm_id)
 
     //keep track of whatever ways and rels these nodes intersect
     //TODO: dont need to stop the copy above since we are only reading?
-    auto res = pgsql_execPrepared(way_table->sql_conn, "mark_ways_by_node", 1,
-                                  paramValues, PGRES_TUPLES_OK);
-    for (int i = 0; i < PQntuples(res.get()); ++i) {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res.get(), i, 0), &end, 10);
-        ways_pending_tracker->mark(marked);
-    }
+    //the results come in when the pipelines are synced
+    way_table->pipeline->exec_prepared(way_table->sql_conn, "mark_ways_by_node",
+                                       1, paramValues, PGRES_TUPLES_OK,
+                                       mark_handler(ways_pending_tracker));
 
     //do the rels too
-    res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_node", 1, paramValues, PGRES_TUPLES_OK );
-    for (int i = 0; i < PQntuples(res.get()); ++i) {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res.get(), i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
+    rel_table->pipeline->exec_prepared(rel_table->sql_conn, "mark_rels_by_node",
+                                       1, paramValues, PGRES_TUPLES_OK,
+                                       mark_handler(rels_pending_tracker));
 }
 
 void middle_pgsql_t::ways_set(osmium::Way const &way)
@@ -423,7 +534,9 @@ void middle_pgsql_t::ways_set(osmium::Way const &way)
     // Three params: id, nodes, tags */
     const char *paramValues[4] = { copy_buffer.c_str(), };
 
-    copy_buffer = std::to_string(way.id());
+    copy_buffer.clear();
+
+    util::append_int(copy_buffer, way.id());
     copy_buffer += delim;
 
     paramValues[1] = paramValues[0] + copy_buffer.size();
@@ -432,7 +545,7 @@ void middle_pgsql_t::ways_set(osmium::Way const &way)
     } else {
         copy_buffer += "{";
         for (auto const &n : way.nodes()) {
-            copy_buffer += std::to_string(n.ref());
+            util::append_int(copy_buffer, n.ref());
             copy_buffer += ',';
         }
         copy_buffer[copy_buffer.size() - 1] = '}';
@@ -449,21 +562,29 @@ void middle_pgsql_t::ways_set(osmium::Way const &way)
 
     if (copy) {
         copy_buffer += '\n';
-        pgsql_CopyData(__FUNCTION__, way_table->sql_conn, copy_buffer);
+        copy_row(way_table, copy_buffer);
     } else {
         buffer_correct_params(paramValues, 3);
-        pgsql_execPrepared(way_table->sql_conn, "insert_way", 3,
-                           (const char * const *)paramValues, PGRES_COMMAND_OK);
+        way_table->pipeline->exec_prepared(
+            way_table->sql_conn, "insert_way", 3,
+            (const char *const *)paramValues, PGRES_COMMAND_OK);
     }
 }
 
 bool middle_pgsql_t::ways_get(osmid_t id, osmium::memory::Buffer &buffer) const
 {
+    auto const pre = prefetched_way_pos.find(id);
+    if (pre != prefetched_way_pos.end()) {
+        buffer.add_item(prefetched_ways.get<osmium::Way>(pre->second));
+        buffer.commit();
+        return true;
+    }
+
     char const *paramValues[1];
     PGconn *sql_conn = way_table->sql_conn;
 
-    // Make sure we're out of copy mode */
-    pgsql_endCopy(way_table);
+    // Make sure we're out of copy mode and nothing is queued */
+    pgsql_sync(way_table);
 
     char tmp[16];
     snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
@@ -489,6 +610,67 @@ bool middle_pgsql_t::ways_get(osmid_t id, osmium::memory::Buffer &buffer) const
     return true;
 }
 
+void middle_pgsql_t::ways_prefetch(idlist_t const &ids) const
+{
+    prefetched_ways.clear();
+    prefetched_way_pos.clear();
+    prefetched_locs.clear();
+
+    if (ids.empty()) {
+        return;
+    }
+
+    pgsql_sync(way_table);
+
+    std::string const list = id_array(ids);
+    char const *paramValues[1] = {list.c_str()};
+    auto res = pgsql_execPrepared(way_table->sql_conn, "get_way_list", 1,
+                                  paramValues, PGRES_TUPLES_OK);
+
+    int const countPG = PQntuples(res.get());
+    prefetched_way_pos.reserve(static_cast<size_t>(countPG));
+    for (int i = 0; i < countPG; ++i) {
+        auto const id = strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10);
+        prefetched_way_pos.emplace(id, prefetched_ways.committed());
+        {
+            osmium::builder::WayBuilder builder(prefetched_ways);
+            builder.set_id(id);
+
+            pgsql_parse_nodes(PQgetvalue(res.get(), i, 1), prefetched_ways,
+                              builder);
+            pgsql_parse_tags(PQgetvalue(res.get(), i, 2), prefetched_ways,
+                             builder);
+        }
+        prefetched_ways.commit();
+    }
+
+    // the flat node file needs no queries
+    if (out_options->flat_node_cache_enabled) {
+        return;
+    }
+
+    // and the nodes of all these ways, from the cache if possible, so
+    // that nodes_get_list() does not have to look at the cache again
+    idlist_t missing;
+    for (auto const &w : prefetched_ways.select<osmium::Way>()) {
+        for (auto const &n : w.nodes()) {
+            auto const loc = cache->get(n.ref());
+            if (loc.valid()) {
+                prefetched_locs.emplace(n.ref(), loc);
+            } else {
+                missing.push_back(n.ref());
+            }
+        }
+    }
+
+    if (!missing.empty()) {
+        std::sort(missing.begin(), missing.end());
+        missing.erase(std::unique(missing.begin(), missing.end()),
+                      missing.end());
+        local_nodes_fetch(id_array(missing), &prefetched_locs);
+    }
+}
+
 size_t middle_pgsql_t::rel_way_members_get(osmium::Relation const &rel,
                                            rolelist_t *roles,
                                            osmium::memory::Buffer &buffer) const
@@ -511,7 +693,7 @@ size_t middle_pgsql_t::rel_way_members_get(osmium::Relation const &rel,
     // replace last , with } to complete list of ids
     tmp2[tmp2.length() - 1] = '}'; 
 
-    pgsql_endCopy(way_table);
+    pgsql_sync(way_table);
 
     PGconn *sql_conn = way_table->sql_conn;
 
@@ -520,11 +702,13 @@ size_t middle_pgsql_t::rel_way_members_get(osmium::Relation const &rel,
                                   PGRES_TUPLES_OK);
     int countPG = PQntuples(res.get());
 
-    idlist_t wayidspg;
-
+    // row of each way in the result, relations with thousands of members
+    // are too large for a linear search per member
+    std::unordered_map<osmid_t, int> wayidspg;
+    wayidspg.reserve(static_cast<size_t>(countPG));
     for (int i = 0; i < countPG; i++) {
-        wayidspg.push_back(
-            strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10));
+        wayidspg.emplace(strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10),
+                         i);
     }
 
     // Match the list of ways coming from postgres in a different order
@@ -534,26 +718,25 @@ size_t middle_pgsql_t::rel_way_members_get(osmium::Relation const &rel,
         if (m.type() != osmium::item_type::way) {
             continue;
         }
-        for (int j = 0; j < countPG; j++) {
-            if (m.ref() == wayidspg[j]) {
-                {
-                    osmium::builder::WayBuilder builder(buffer);
-                    builder.set_id(m.ref());
-
-                    pgsql_parse_nodes(PQgetvalue(res.get(), j, 1), buffer,
-                                      builder);
-                    pgsql_parse_tags(PQgetvalue(res.get(), j, 2), buffer,
-                                     builder);
-                }
+        auto const row = wayidspg.find(m.ref());
+        if (row == wayidspg.end()) {
+            continue;
+        }
 
-                buffer.commit();
-                if (roles) {
-                    roles->emplace_back(m.role());
-                }
-                outres++;
-                break;
-            }
+        int const j = row->second;
+        {
+            osmium::builder::WayBuilder builder(buffer);
+            builder.set_id(m.ref());
+
+            pgsql_parse_nodes(PQgetvalue(res.get(), j, 1), buffer, builder);
+            pgsql_parse_tags(PQgetvalue(res.get(), j, 2), buffer, builder);
+        }
+
+        buffer.commit();
+        if (roles) {
+            roles->emplace_back(m.role());
         }
+        outres++;
     }
 
     return outres;
@@ -569,14 +752,15 @@ void middle_pgsql_t::ways_delete(osmid_t osm_id)
 
     sprintf( buffer, "%" PRIdOSMID, osm_id );
     paramValues[0] = buffer;
-    pgsql_execPrepared(way_table->sql_conn, "delete_way", 1, paramValues, PGRES_COMMAND_OK );
+    way_table->pipeline->exec_prepared(way_table->sql_conn, "delete_way", 1,
+                                       paramValues, PGRES_COMMAND_OK);
 }
 
 void middle_pgsql_t::iterate_ways(middle_t::pending_processor& pf)
 {
-
-    // Make sure we're out of copy mode */
+    // Make sure we're out of copy mode and have all marks */
     pgsql_endCopy( way_table );
+    sync_pipelines();
 
     // enqueue the jobs
     osmid_t id;
@@ -603,13 +787,9 @@ void middle_pgsql_t::way_changed(osmid_t osm_id)
 
     //keep track of whatever rels this way intersects
     //TODO: dont need to stop the copy above since we are only reading?
-    auto res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels_by_way", 1,
-                                  paramValues, PGRES_TUPLES_OK);
-    for (int i = 0; i < PQntuples(res.get()); ++i) {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res.get(), i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
+    rel_table->pipeline->exec_prepared(rel_table->sql_conn, "mark_rels_by_way",
+                                       1, paramValues, PGRES_TUPLES_OK,
+                                       mark_handler(rels_pending_tracker));
 }
 
 void middle_pgsql_t::relations_set(osmium::Relation const &rel)
@@ -627,15 +807,17 @@ void middle_pgsql_t::relations_set(osmium::Relation const &rel)
     bool copy = rel_table->copyMode;
     char delim = copy ? '\t' : '\0';
 
-    copy_buffer = std::to_string(rel.id());
+    copy_buffer.clear();
+
+    util::append_int(copy_buffer, rel.id());
     copy_buffer+= delim;
 
     paramValues[1] = paramValues[0] + copy_buffer.size();
-    copy_buffer += std::to_string(parts[0].size());
+    util::append_int(copy_buffer, parts[0].size());
     copy_buffer+= delim;
 
     paramValues[2] = paramValues[0] + copy_buffer.size();
-    copy_buffer += std::to_string(parts[0].size() + parts[1].size());
+    util::append_int(copy_buffer, parts[0].size() + parts[1].size());
     copy_buffer+= delim;
 
     paramValues[3] = paramValues[0] + copy_buffer.size();
@@ -645,7 +827,7 @@ void middle_pgsql_t::relations_set(osmium::Relation const &rel)
         copy_buffer += "{";
         for (int i = 0; i < 3; ++i) {
             for (auto it : parts[i]) {
-                copy_buffer += std::to_string(it);
+                util::append_int(copy_buffer, it);
                 copy_buffer += ',';
             }
         }
@@ -662,7 +844,7 @@ void middle_pgsql_t::relations_set(osmium::Relation const &rel)
         for (auto const &m : rel.members()) {
             copy_buffer += '"';
             copy_buffer += osmium::item_type_to_char(m.type());
-            copy_buffer += std::to_string(m.ref());
+            util::append_int(copy_buffer, m.ref());
             copy_buffer += "\",\"";
             buffer_store_string(m.role(), copy);
             copy_buffer += "\",";
@@ -681,23 +863,31 @@ void middle_pgsql_t::relations_set(osmium::Relation const &rel)
 
     if (copy) {
         copy_buffer+= '\n';
-        pgsql_CopyData(__FUNCTION__, rel_table->sql_conn, copy_buffer);
+        copy_row(rel_table, copy_buffer);
     } else {
         buffer_correct_params(paramValues, 6);
-        pgsql_execPrepared(rel_table->sql_conn, "insert_rel", 6,
-                           (const char * const *)paramValues, PGRES_COMMAND_OK);
+        rel_table->pipeline->exec_prepared(
+            rel_table->sql_conn, "insert_rel", 6,
+            (const char *const *)paramValues, PGRES_COMMAND_OK);
     }
 }
 
 bool middle_pgsql_t::relations_get(osmid_t id, osmium::memory::Buffer &buffer) const
 {
+    auto const pre = prefetched_rel_pos.find(id);
+    if (pre != prefetched_rel_pos.end()) {
+        buffer.add_item(prefetched_rels.get<osmium::Relation>(pre->second));
+        buffer.commit();
+        return true;
+    }
+
     char tmp[16];
     char const *paramValues[1];
     PGconn *sql_conn = rel_table->sql_conn;
     taglist_t member_temp;
 
-    // Make sure we're out of copy mode */
-    pgsql_endCopy(rel_table);
+    // Make sure we're out of copy mode and nothing is queued */
+    pgsql_sync(rel_table);
 
     snprintf(tmp, sizeof(tmp), "%" PRIdOSMID, id);
     paramValues[0] = tmp;
@@ -723,6 +913,40 @@ bool middle_pgsql_t::relations_get(osmid_t id, osmium::memory::Buffer &buffer) c
     return true;
 }
 
+void middle_pgsql_t::relations_prefetch(idlist_t const &ids) const
+{
+    prefetched_rels.clear();
+    prefetched_rel_pos.clear();
+
+    if (ids.empty()) {
+        return;
+    }
+
+    pgsql_sync(rel_table);
+
+    std::string const list = id_array(ids);
+    char const *paramValues[1] = {list.c_str()};
+    auto res = pgsql_execPrepared(rel_table->sql_conn, "get_rel_list", 1,
+                                  paramValues, PGRES_TUPLES_OK);
+
+    int const countPG = PQntuples(res.get());
+    prefetched_rel_pos.reserve(static_cast<size_t>(countPG));
+    for (int i = 0; i < countPG; ++i) {
+        auto const id = strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10);
+        prefetched_rel_pos.emplace(id, prefetched_rels.committed());
+        {
+            osmium::builder::RelationBuilder builder(prefetched_rels);
+            builder.set_id(id);
+
+            pgsql_parse_members(PQgetvalue(res.get(), i, 1), prefetched_rels,
+                                builder);
+            pgsql_parse_tags(PQgetvalue(res.get(), i, 2), prefetched_rels,
+                             builder);
+        }
+        prefetched_rels.commit();
+    }
+}
+
 void middle_pgsql_t::relations_delete(osmid_t osm_id)
 {
     char const *paramValues[1];
@@ -733,23 +957,21 @@ void middle_pgsql_t::relations_delete(osmid_t osm_id)
 
     sprintf( buffer, "%" PRIdOSMID, osm_id );
     paramValues[0] = buffer;
-    pgsql_execPrepared(rel_table->sql_conn, "delete_rel", 1, paramValues, PGRES_COMMAND_OK );
+    rel_table->pipeline->exec_prepared(rel_table->sql_conn, "delete_rel", 1,
+                                       paramValues, PGRES_COMMAND_OK);
 
     //keep track of whatever ways this relation interesects
     //TODO: dont need to stop the copy above since we are only reading?
-    auto res = pgsql_execPrepared(way_table->sql_conn, "mark_ways_by_rel", 1,
-                                  paramValues, PGRES_TUPLES_OK);
-    for (int i = 0; i < PQntuples(res.get()); ++i) {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res.get(), i, 0), &end, 10);
-        ways_pending_tracker->mark(marked);
-    }
+    way_table->pipeline->exec_prepared(way_table->sql_conn, "mark_ways_by_rel",
+                                       1, paramValues, PGRES_TUPLES_OK,
+                                       mark_handler(ways_pending_tracker));
 }
 
 void middle_pgsql_t::iterate_relations(pending_processor& pf)
 {
-    // Make sure we're out of copy mode */
+    // Make sure we're out of copy mode and have all marks */
     pgsql_endCopy( rel_table );
+    sync_pipelines();
 
     // enqueue the jobs
     osmid_t id;
@@ -777,21 +999,17 @@ void middle_pgsql_t::relation_changed(osmid_t osm_id)
     //keep track of whatever ways and rels these nodes intersect
     //TODO: dont need to stop the copy above since we are only reading?
     //TODO: can we just mark the id without querying? the where clause seems intersect reltable.parts with the id
-    auto res = pgsql_execPrepared(rel_table->sql_conn, "mark_rels", 1,
-                                  paramValues, PGRES_TUPLES_OK);
-    for (int i = 0; i < PQntuples(res.get()); ++i) {
-        char *end;
-        osmid_t marked = strtoosmid(PQgetvalue(res.get(), i, 0), &end, 10);
-        rels_pending_tracker->mark(marked);
-    }
+    rel_table->pipeline->exec_prepared(rel_table->sql_conn, "mark_rels", 1,
+                                       paramValues, PGRES_TUPLES_OK,
+                                       mark_handler(rels_pending_tracker));
 }
 
 idlist_t middle_pgsql_t::relations_using_way(osmid_t way_id) const
 {
     char const *paramValues[1];
     char buffer[64];
-    // Make sure we're out of copy mode */
-    pgsql_endCopy( rel_table );
+    // Make sure we're out of copy mode and nothing is queued */
+    pgsql_sync(rel_table);
 
     sprintf(buffer, "%" PRIdOSMID, way_id);
     paramValues[0] = buffer;
@@ -808,8 +1026,18 @@ idlist_t middle_pgsql_t::relations_using_way(osmid_t way_id) const
     return rel_ids;
 }
 
+void middle_pgsql_t::sync_pipelines() const
+{
+    for (auto const &table : tables) {
+        if (table.pipeline) {
+            table.pipeline->sync();
+        }
+    }
+}
+
 void middle_pgsql_t::analyze(void)
 {
+    sync_pipelines();
     for (auto& table: tables) {
         PGconn *sql_conn = table.sql_conn;
 
@@ -821,6 +1049,7 @@ void middle_pgsql_t::analyze(void)
 
 void middle_pgsql_t::end(void)
 {
+    sync_pipelines();
     for (auto& table: tables) {
         PGconn *sql_conn = table.sql_conn;
 
@@ -943,6 +1172,7 @@ void middle_pgsql_t::connect(table_desc& table) {
         util::exit_nicely();
     }
     table.sql_conn = sql_conn;
+    table.pipeline = std::make_shared<pg_pipeline_t>();
 }
 
 void middle_pgsql_t::start(const options_t *out_options_)
@@ -1028,6 +1258,8 @@ void middle_pgsql_t::start(const options_t *out_options_)
         if (table.copy) {
             pgsql_exec(sql_conn, PGRES_COPY_IN, "%s", table.copy);
             table.copyMode = 1;
+            table.copy_writer = std::make_shared<copy_writer_t>(
+                table.name, out_options->copy_buffer_size * 1024 * 1024);
         }
     }
 }
@@ -1035,7 +1267,7 @@ void middle_pgsql_t::start(const options_t *out_options_)
 void middle_pgsql_t::commit(void) {
     for (auto& table: tables) {
         PGconn *sql_conn = table.sql_conn;
-        pgsql_endCopy(&table);
+        pgsql_sync(&table);
         if (table.stop && table.transactionMode) {
             pgsql_exec(sql_conn, PGRES_COMMAND_OK, "%s", table.stop);
             table.transactionMode = 0;
@@ -1043,18 +1275,44 @@ void middle_pgsql_t::commit(void) {
     }
 }
 
+void middle_pgsql_t::next_diff()
+{
+    for (auto &table : tables) {
+        if (table.start) {
+            pgsql_exec(table.sql_conn, PGRES_COMMAND_OK, "%s", table.start);
+            table.transactionMode = 1;
+        }
+
+        if (table.copy) {
+            pgsql_exec(table.sql_conn, PGRES_COPY_IN, "%s", table.copy);
+            table.copyMode = 1;
+        }
+    }
+}
+
 void middle_pgsql_t::pgsql_stop_one(table_desc *table)
 {
     time_t start, end;
 
+    // when resuming an import, the table has never been started
+    if (!table->sql_conn) {
+        connect(*table);
+    }
+
     PGconn *sql_conn = table->sql_conn;
+    auto const &checkpoint = out_options->checkpoint;
+    std::string const phase = std::string("index:") + table->name;
 
     fprintf(stderr, "Stopping table: %s\n", table->name);
-    pgsql_endCopy(table);
+    pgsql_sync(table);
     time(&start);
-    if (out_options->droptemp)
+    if (checkpoint && checkpoint->done(phase))
     {
-        pgsql_exec(sql_conn, PGRES_COMMAND_OK, "DROP TABLE %s", table->name);
+        fprintf(stderr, "Table %s already finished\n", table->name);
+    }
+    else if (out_options->droptemp)
+    {
+        pgsql_exec(sql_conn, PGRES_COMMAND_OK, "DROP TABLE IF EXISTS %s", table->name);
     }
     else if (build_indexes && table->array_indexes)
     {
@@ -1062,6 +1320,11 @@ void middle_pgsql_t::pgsql_stop_one(table_desc *table)
         pgsql_exec(sql_conn, PGRES_COMMAND_OK, "%s", table->array_indexes);
     }
 
+    if (checkpoint) {
+        checkpoint->mark_done(phase);
+    }
+
+    table->copy_writer.reset();
     PQfinish(sql_conn);
     table->sql_conn = nullptr;
     time(&end);
@@ -1089,9 +1352,23 @@ void middle_pgsql_t::stop(osmium::thread::Pool &pool)
     }
 }
 
+void middle_pgsql_t::resume(const options_t *out_options_)
+{
+    out_options = out_options_;
+
+    if (out_options->output_backend == "gazetteer") {
+        way_table->array_indexes = nullptr;
+    }
+
+    append = false;
+    build_indexes = !out_options->droptemp;
+}
+
 middle_pgsql_t::middle_pgsql_t()
 : num_tables(0), node_table(nullptr), way_table(nullptr), rel_table(nullptr),
-  append(false), mark_pending(true), build_indexes(true)
+  append(false), mark_pending(true), build_indexes(true),
+  prefetched_ways(4096, osmium::memory::Buffer::auto_grow::yes),
+  prefetched_rels(4096, osmium::memory::Buffer::auto_grow::yes)
 {
     // clang-format off
     /*table = t_node,*/
@@ -1135,6 +1412,7 @@ middle_pgsql_t::middle_pgsql_t()
     /*create_index*/ nullptr,
          /*prepare*/ "PREPARE insert_rel (" POSTGRES_OSMID_TYPE ", int2, int2, " POSTGRES_OSMID_TYPE "[], text[], text[]) AS INSERT INTO %p_rels VALUES ($1,$2,$3,$4,$5,$6);\n"
                "PREPARE get_rel (" POSTGRES_OSMID_TYPE ") AS SELECT members, tags, array_upper(members,1)/2 FROM %p_rels WHERE id = $1;\n"
+               "PREPARE get_rel_list (" POSTGRES_OSMID_TYPE "[]) AS SELECT id, members, tags FROM %p_rels WHERE id = ANY($1::" POSTGRES_OSMID_TYPE "[]);\n"
                "PREPARE delete_rel(" POSTGRES_OSMID_TYPE ") AS DELETE FROM %p_rels WHERE id = $1;\n",
 /*prepare_intarray*/
                 "PREPARE rels_using_way(" POSTGRES_OSMID_TYPE ") AS SELECT id FROM %p_rels WHERE parts && ARRAY[$1] AND parts[way_off+1:rel_off] && ARRAY[$1];\n"
@@ -1160,6 +1438,7 @@ middle_pgsql_t::middle_pgsql_t()
 
 middle_pgsql_t::~middle_pgsql_t() {
     for (auto& table: tables) {
+        table.copy_writer.reset();
         if (table.sql_conn) {
             PQfinish(table.sql_conn);
         }
@@ -1204,5 +1483,6 @@ middle_pgsql_t::get_query_instance(std::shared_ptr<middle_t> const &from) const
 }
 
 size_t middle_pgsql_t::pending_count() const {
+    sync_pipelines();
     return ways_pending_tracker->size() + rels_pending_tracker->size();
 }
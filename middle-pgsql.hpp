@@ -14,25 +14,34 @@
 #include "node-persistent-cache.hpp"
 #include "id-tracker.hpp"
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+class copy_writer_t;
+class pg_pipeline_t;
+
 struct middle_pgsql_t : public slim_middle_t {
     middle_pgsql_t();
     virtual ~middle_pgsql_t();
 
     void start(const options_t *out_options_) override;
     void stop(osmium::thread::Pool &pool) override;
+    void resume(const options_t *out_options_) override;
     void analyze(void) override;
     void end(void) override;
     void commit(void) override;
+    void next_diff() override;
 
     void nodes_set(osmium::Node const &node) override;
     size_t nodes_get_list(osmium::WayNodeList *nodes) const override;
+    size_t nodes_get_ways(osmium::memory::Buffer *ways) const override;
     void nodes_delete(osmid_t id) override;
     void node_changed(osmid_t id) override;
 
     void ways_set(osmium::Way const &way) override;
     bool ways_get(osmid_t id, osmium::memory::Buffer &buffer) const override;
+    void ways_prefetch(idlist_t const &ids) const override;
     size_t rel_way_members_get(osmium::Relation const &rel, rolelist_t *roles,
                                osmium::memory::Buffer &buffer) const override;
 
@@ -40,6 +49,7 @@ struct middle_pgsql_t : public slim_middle_t {
     void way_changed(osmid_t id) override;
 
     bool relations_get(osmid_t id, osmium::memory::Buffer &buffer) const override;
+    void relations_prefetch(idlist_t const &ids) const override;
     void relations_set(osmium::Relation const &rel) override;
     void relations_delete(osmid_t id) override;
     void relation_changed(osmid_t id) override;
@@ -75,8 +85,12 @@ struct middle_pgsql_t : public slim_middle_t {
         const char *array_indexes;
 
         int copyMode;    /* True if we are in copy mode */
+        /// sends the rows while in copy mode
+        std::shared_ptr<copy_writer_t> copy_writer;
         int transactionMode;    /* True if we are in an extended transaction */
         struct pg_conn *sql_conn;
+        /// statements queued on sql_conn
+        std::shared_ptr<pg_pipeline_t> pipeline;
     };
 
     std::shared_ptr<middle_query_t>
@@ -85,12 +99,21 @@ struct middle_pgsql_t : public slim_middle_t {
 private:
     void pgsql_stop_one(table_desc *table);
 
+    /// Run the statements queued on all connections.
+    void sync_pipelines() const;
+
     /**
      * Sets up sql_conn for the table
      */
     void connect(table_desc& table);
     void local_nodes_set(osmium::Node const &node);
     size_t local_nodes_get_list(osmium::WayNodeList *nodes) const;
+    /**
+     * Look up node locations in the database. `ids` is a PostgreSQL
+     * array literal of the ids to fetch.
+     */
+    void local_nodes_fetch(std::string const &ids,
+                           std::unordered_map<osmid_t, osmium::Location> *locs) const;
     void local_nodes_delete(osmid_t osm_id);
 
     std::vector<table_desc> tables;
@@ -112,6 +135,13 @@ private:
 
     bool build_indexes;
     std::string copy_buffer;
+
+    /// objects fetched ahead by ways_prefetch() and relations_prefetch()
+    mutable osmium::memory::Buffer prefetched_ways, prefetched_rels;
+    mutable std::unordered_map<osmid_t, size_t> prefetched_way_pos,
+        prefetched_rel_pos;
+    /// node locations of the prefetched ways
+    mutable std::unordered_map<osmid_t, osmium::Location> prefetched_locs;
 };
 
 #endif
@@ -7,32 +7,88 @@
  * emit the final geometry-enabled output formats
 */
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <cassert>
 #include <cstdio>
 
-#include <osmium/builder/attr.hpp>
+#include <osmium/builder/osm_object_builder.hpp>
 
 #include "id-tracker.hpp"
 #include "middle-ram.hpp"
 #include "node-ram-cache.hpp"
 #include "options.hpp"
 
-/* Object storage now uses 2 levels of storage arrays.
- *
- * - Low level storage of 2^16 (~65k) objects in an indexed array
- *   These are allocated dynamically when we need to first store data with
- *   an ID in this block
- *
- * - Fixed array of 2^(32 - 16) = 65k pointers to the dynamically allocated arrays.
- *
- * This allows memory usage to be efficient and scale dynamically without needing to
- * hard code maximum IDs. We now support an ID  range of -2^31 to +2^31.
- * The negative IDs often occur in non-uploaded JOSM data or other data import scripts.
- *
+/* Ways and relations are copied into large append-only buffers (see
+ * object_store_t). The position of each object is kept in a sparse index
+ * (see elem_cache_t), which only allocates memory for the id ranges
+ * actually used and supports the full 64 bit id space. The negative IDs
+ * often occur in non-uploaded JOSM data or other data import scripts.
  */
 
+namespace {
+
+/// Objects are stored in buffers of this size, larger ones get their own.
+constexpr size_t const store_segment_size = 64 * 1024 * 1024;
+
+} // anonymous namespace
+
+object_store_t::position_t
+object_store_t::add(osmium::memory::Item const &item)
+{
+    size_t const size = item.padded_size();
+
+    if (m_segments.empty() ||
+        m_segments.back().capacity() - m_segments.back().committed() < size) {
+        m_segments.emplace_back(std::max(store_segment_size, size),
+                                osmium::memory::Buffer::auto_grow::no);
+    }
+
+    auto &segment = m_segments.back();
+    position_t const offset = segment.committed();
+    segment.add_item(item);
+    segment.commit();
+
+    return (position_t(m_segments.size()) << 32) | offset;
+}
+
+size_t object_store_t::used_memory() const
+{
+    size_t size = 0;
+    for (auto const &segment : m_segments) {
+        size += segment.capacity();
+    }
+    return size;
+}
+
+object_store_t::position_t middle_ram_t::store(object_store_t &store,
+                                               osmium::OSMObject const &obj)
+{
+    // The tag transforms turn the metadata into tags if it is present.
+    if (out_options->extra_attributes) {
+        return store.add(obj);
+    }
+
+    m_strip_buffer.clear();
+    if (obj.type() == osmium::item_type::way) {
+        auto const &way = static_cast<osmium::Way const &>(obj);
+        osmium::builder::WayBuilder builder(m_strip_buffer);
+        builder.set_id(way.id());
+        builder.add_item(way.tags());
+        builder.add_item(way.nodes());
+    } else {
+        auto const &rel = static_cast<osmium::Relation const &>(obj);
+        osmium::builder::RelationBuilder builder(m_strip_buffer);
+        builder.set_id(rel.id());
+        builder.add_item(rel.tags());
+        builder.add_item(rel.members());
+    }
+    m_strip_buffer.commit();
+
+    return store.add(m_strip_buffer.get<osmium::memory::Item>(0));
+}
+
 void middle_ram_t::nodes_set(osmium::Node const &node)
 {
     cache->set(node.id(), node.location());
@@ -40,12 +96,13 @@ void middle_ram_t::nodes_set(osmium::Node const &node)
 
 void middle_ram_t::ways_set(osmium::Way const &way)
 {
-    ways.set(way.id(), new ramWay(way, out_options->extra_attributes));
+    // with locations on ways the locations are stored with the way
+    ways.set(way.id(), store(way_store, way));
 }
 
 void middle_ram_t::relations_set(osmium::Relation const &rel)
 {
-    rels.set(rel.id(), new ramRel(rel, out_options->extra_attributes));
+    rels.set(rel.id(), store(rel_store, rel));
 }
 
 size_t middle_ram_t::nodes_get_list(osmium::WayNodeList *nodes) const
@@ -53,9 +110,11 @@ size_t middle_ram_t::nodes_get_list(osmium::WayNodeList *nodes) const
     size_t count = 0;
 
     for (auto &n : *nodes) {
-        auto loc = cache->get(n.ref());
-        n.set_location(loc);
-        if (loc.valid()) {
+        // locations which came with the way from the input are kept
+        if (!n.location().valid()) {
+            n.set_location(cache->get(n.ref()));
+        }
+        if (n.location().valid()) {
             ++count;
         }
     }
@@ -93,11 +152,13 @@ void middle_ram_t::iterate_ways(middle_t::pending_processor& pf)
 void middle_ram_t::release_relations()
 {
     rels.clear();
+    rel_store.clear();
 }
 
 void middle_ram_t::release_ways()
 {
     ways.clear();
+    way_store.clear();
 }
 
 bool middle_ram_t::ways_get(osmid_t id, osmium::memory::Buffer &buffer) const
@@ -106,14 +167,14 @@ bool middle_ram_t::ways_get(osmid_t id, osmium::memory::Buffer &buffer) const
         return false;
     }
 
-    auto const *ele = ways.get(id);
+    auto const pos = ways.get(id);
 
-    if (!ele) {
+    if (!pos) {
         return false;
     }
 
-    using namespace osmium::builder::attr;
-    osmium::builder::add_way(buffer, _id(id), _tags(ele->tags), _nodes(ele->ndids));
+    buffer.add_item(way_store.get<osmium::Way>(pos));
+    buffer.commit();
 
     return true;
 }
@@ -137,15 +198,14 @@ size_t middle_ram_t::rel_way_members_get(osmium::Relation const &rel,
 
 bool middle_ram_t::relations_get(osmid_t id, osmium::memory::Buffer &buffer) const
 {
-    auto const *ele = rels.get(id);
+    auto const pos = rels.get(id);
 
-    if (!ele) {
+    if (!pos) {
         return false;
     }
 
-    using namespace osmium::builder::attr;
-    osmium::builder::add_relation(buffer, _id(id), _members(ele->members.for_builder()),
-                                  _tags(ele->tags));
+    buffer.add_item(rel_store.get<osmium::Relation>(pos));
+    buffer.commit();
 
     return true;
 }
@@ -179,7 +239,9 @@ void middle_ram_t::commit(void) {
 }
 
 middle_ram_t::middle_ram_t():
-    ways(), rels(), cache(), simulate_ways_deleted(false)
+    ways(), rels(),
+    m_strip_buffer(4096, osmium::memory::Buffer::auto_grow::yes),
+    cache(), simulate_ways_deleted(false)
 {
 }
 
@@ -14,70 +14,138 @@
 #include "middle.hpp"
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <map>
+
+#include <osmium/memory/buffer.hpp>
 
 struct node_ram_cache;
 struct options_t;
 
-template <typename T, size_t N>
-class cache_block_t
-{
-    std::array<std::unique_ptr<T>, N> arr;
-public:
-    void set(size_t idx, T *ele) { arr[idx].reset(ele); }
-
-    T const *get(size_t idx) const { return arr[idx].get(); }
-};
-
+/**
+ * Sparse index from ids to values of type T, T{} means "not set".
+ *
+ * An id is split into three parts: the upper bits select a range in an
+ * ordered map, the next RANGE_SHIFT bits a block in that range and the
+ * lowest BLOCK_SHIFT bits the slot in the block. Ranges and blocks are
+ * only allocated once an id in them is set, so the full 64 bit id space
+ * (including negative ids) can be used without any upfront cost.
+ */
 template <typename T, size_t BLOCK_SHIFT>
 class elem_cache_t
 {
-    constexpr static size_t per_block() { return 1 << BLOCK_SHIFT; }
-    constexpr static size_t num_blocks() { return 1 << (32 - BLOCK_SHIFT); }
+    static constexpr size_t RANGE_SHIFT = 14;
+    static constexpr size_t PER_BLOCK = size_t(1) << BLOCK_SHIFT;
+    static constexpr size_t PER_RANGE = size_t(1) << RANGE_SHIFT;
 
-    constexpr static size_t id2block(osmid_t id)
+    typedef std::array<T, PER_BLOCK> block_t;
+    typedef std::array<std::unique_ptr<block_t>, PER_RANGE> range_t;
+
+    // The shift rounds towards minus infinity, so that the ranges are
+    // ordered like the ids they contain, negative ones first.
+    static osmid_t id2range(osmid_t id)
     {
-        /* + NUM_BLOCKS/2 allows for negative IDs */
-        return (id >> BLOCK_SHIFT) + num_blocks()/2;
+        return id >> (BLOCK_SHIFT + RANGE_SHIFT);
     }
 
-    constexpr static size_t id2offset(osmid_t id)
+    static size_t id2block(osmid_t id)
     {
-        return id & (per_block()-1);
+        return static_cast<size_t>(id >> BLOCK_SHIFT) & (PER_RANGE - 1);
     }
 
-    typedef cache_block_t<T, 1 << BLOCK_SHIFT> element_t;
-    std::vector<std::unique_ptr<element_t>> arr;
-public:
-    elem_cache_t() : arr(num_blocks()) {}
+    static size_t id2offset(osmid_t id)
+    {
+        return static_cast<size_t>(id) & (PER_BLOCK - 1);
+    }
 
-    void set(osmid_t id, T *ele)
+    std::map<osmid_t, std::unique_ptr<range_t>> m_ranges;
+
+public:
+    void set(osmid_t id, T ele)
     {
-        const size_t block = id2block(id);
+        auto &range = m_ranges[id2range(id)];
+        if (!range) {
+            range.reset(new range_t());
+        }
 
-        if (!arr[block]) {
-            arr[block].reset(new element_t());
+        auto &block = (*range)[id2block(id)];
+        if (!block) {
+            block.reset(new block_t());
         }
 
-        arr[block]->set(id2offset(id), ele);
+        (*block)[id2offset(id)] = ele;
     }
 
-    T const *get(osmid_t id) const
+    /// Returns a value-initialised T if nothing was set for the id.
+    T get(osmid_t id) const
     {
-        const size_t block = id2block(id);
+        auto const it = m_ranges.find(id2range(id));
+        if (it == m_ranges.end()) {
+            return T{};
+        }
 
-        if (!arr[block]) {
-            return 0;
+        auto const &block = (*it->second)[id2block(id)];
+        if (!block) {
+            return T{};
         }
 
-        return arr[block]->get(id2offset(id));
+        return (*block)[id2offset(id)];
     }
 
-    void clear()
+    /// Call func(id, value) for all ids which are set, in ascending order.
+    template <typename F>
+    void for_each(F &&func) const
     {
-        for (auto &ele : arr) {
-            ele.reset();
+        for (auto const &range : m_ranges) {
+            osmid_t const range_start =
+                range.first * (osmid_t(1) << (BLOCK_SHIFT + RANGE_SHIFT));
+            for (size_t b = 0; b < PER_RANGE; ++b) {
+                auto const &block = (*range.second)[b];
+                if (!block) {
+                    continue;
+                }
+                osmid_t const block_start =
+                    range_start + static_cast<osmid_t>(b << BLOCK_SHIFT);
+                for (size_t i = 0; i < PER_BLOCK; ++i) {
+                    if ((*block)[i] != T{}) {
+                        func(block_start + static_cast<osmid_t>(i),
+                             (*block)[i]);
+                    }
+                }
+            }
         }
     }
+
+    void clear() { m_ranges.clear(); }
+};
+
+/**
+ * Append-only storage for OSM objects. The objects are copied into large
+ * osmium buffers of fixed size which are never reallocated, so stored
+ * objects do not move. Replaced objects are not reclaimed.
+ */
+class object_store_t
+{
+public:
+    /// Position of an object in the store, 0 means "no object".
+    typedef uint64_t position_t;
+
+    /// Copy the item into the store.
+    position_t add(osmium::memory::Item const &item);
+
+    template <typename T>
+    T const &get(position_t pos) const
+    {
+        return m_segments[(pos >> 32) - 1].get<T>(pos & 0xffffffffu);
+    }
+
+    void clear() { m_segments.clear(); }
+
+    /// Memory allocated for the objects.
+    size_t used_memory() const;
+
+private:
+    std::vector<osmium::memory::Buffer> m_segments;
 };
 
 struct middle_ram_t : public middle_t {
@@ -123,32 +191,16 @@ private:
     void release_ways();
     void release_relations();
 
-    struct ramWay {
-        taglist_t tags;
-        idlist_t ndids;
-
-        ramWay(osmium::Way const &way, bool add_attributes)
-        : tags(way.tags()), ndids(way.nodes())
-        {
-            if (add_attributes)
-                tags.add_attributes(way);
-        }
-    };
-
-    struct ramRel {
-        taglist_t tags;
-        memberlist_t members;
-
-        ramRel(osmium::Relation const &rel, bool add_attributes)
-        : tags(rel.tags()), members(rel.members())
-        {
-            if (add_attributes)
-                tags.add_attributes(rel);
-        }
-    };
+    /// Copies an object without the metadata unless it is needed.
+    object_store_t::position_t store(object_store_t &store,
+                                     osmium::OSMObject const &obj);
 
-    elem_cache_t<ramWay, 10> ways;
-    elem_cache_t<ramRel, 10> rels;
+    object_store_t way_store;
+    object_store_t rel_store;
+    elem_cache_t<object_store_t::position_t, 10> ways;
+    elem_cache_t<object_store_t::position_t, 10> rels;
+    /// scratch space for stripping the metadata from objects
+    osmium::memory::Buffer m_strip_buffer;
 
     std::unique_ptr<node_ram_cache> cache;
 
@@ -1,12 +1,26 @@
 #include "middle.hpp"
+#include "middle-file.hpp"
 #include "middle-pgsql.hpp"
 #include "middle-ram.hpp"
+#include "options.hpp"
 
 #include <memory>
 
-std::shared_ptr<middle_t> middle_t::create_middle(const bool slim)
+size_t middle_query_t::nodes_get_ways(osmium::memory::Buffer *ways) const
 {
-     if(slim)
+    size_t count = 0;
+    for (auto &w : ways->select<osmium::Way>()) {
+        count += nodes_get_list(&(w.nodes()));
+    }
+
+    return count;
+}
+
+std::shared_ptr<middle_t> middle_t::create_middle(options_t const &options)
+{
+     if (options.middle_dir)
+         return std::make_shared<middle_file_t>();
+     else if (options.slim)
          return std::make_shared<middle_pgsql_t>();
      else
          return std::make_shared<middle_ram_t>();
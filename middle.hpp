@@ -32,6 +32,18 @@ struct middle_query_t {
      */
     virtual size_t nodes_get_list(osmium::WayNodeList *nodes) const = 0;
 
+    /**
+     * Retrieves node locations for all ways in the given buffer, usually
+     * the members of a relation.
+     *
+     * Backends which need a query per lookup should override this to
+     * fetch all missing nodes at once. The default looks up one way after
+     * the other.
+     *
+     * \return number of node references with a location
+     */
+    virtual size_t nodes_get_ways(osmium::memory::Buffer *ways) const;
+
     /**
      * Retrives a single way from the ways storage
      * and stores it in the given osmium buffer.
@@ -68,6 +80,19 @@ struct middle_query_t {
      */
     virtual bool relations_get(osmid_t id, osmium::memory::Buffer &buffer) const = 0;
 
+    /**
+     * Announce that the ways with the given ids and their node locations
+     * will be asked for next. Backends which need a query per lookup can
+     * fetch them all at once. The objects are kept until the next call,
+     * an empty list drops them.
+     *
+     * The default does nothing.
+     */
+    virtual void ways_prefetch(idlist_t const &) const {}
+
+    /// Same as ways_prefetch() for relations_get().
+    virtual void relations_prefetch(idlist_t const &) const {}
+
     /*
      * Retrieve a list of relations with a particular way as a member
      * \param way_id ID of the way to check
@@ -79,16 +104,32 @@ struct middle_query_t {
  * A specialized middle backend which is persistent, and supports updates
  */
 struct middle_t : public middle_query_t {
-    static std::shared_ptr<middle_t> create_middle(bool slim);
+    static std::shared_ptr<middle_t> create_middle(options_t const &options);
 
     virtual ~middle_t() {}
 
     virtual void start(const options_t *out_options_) = 0;
     virtual void stop(osmium::thread::Pool &pool) = 0;
+
+    /**
+     * Prepare for stop() when continuing an interrupted import. Unlike
+     * start() this leaves the existing data untouched.
+     */
+    virtual void resume(const options_t *out_options_)
+    {
+        out_options = out_options_;
+    }
+
     virtual void analyze(void) = 0;
     virtual void end(void) = 0;
     virtual void commit(void) = 0;
 
+    /**
+     * Start over after commit() for the next diff of the update daemon,
+     * keeping the connections open.
+     */
+    virtual void next_diff() {}
+
     virtual void nodes_set(osmium::Node const &node) = 0;
     virtual void ways_set(osmium::Way const &way) = 0;
     virtual void relations_set(osmium::Relation const &rel) = 0;
@@ -13,10 +13,53 @@
 
 #include <boost/format.hpp>
 
+#include "metrics.hpp"
 #include "node-ram-cache.hpp"
 #include "osmtypes.hpp"
 #include "util.hpp"
 
+namespace {
+
+/**
+ * Lookup statistics of one thread. They are added to the shared metrics in
+ * batches, so that the pending threads do not all update the same atomics
+ * on every node lookup.
+ */
+struct lookup_counts_t
+{
+    static constexpr int64_t batch_size = 4096;
+
+    ~lookup_counts_t() { publish(); }
+
+    void count(bool hit)
+    {
+        hits += hit ? 1 : 0;
+        if (++lookups >= batch_size) {
+            publish();
+        }
+    }
+
+    void publish()
+    {
+        if (lookups == 0) {
+            return;
+        }
+        metrics::counter("osm2pgsql_node_cache_hits_total")
+            .fetch_add(hits, std::memory_order_relaxed);
+        metrics::counter("osm2pgsql_node_cache_lookups_total")
+            .fetch_add(lookups, std::memory_order_relaxed);
+        hits = 0;
+        lookups = 0;
+    }
+
+    int64_t hits = 0;
+    int64_t lookups = 0;
+};
+
+thread_local lookup_counts_t lookup_counts;
+
+} // anonymous namespace
+
 /* Here we use a similar storage structure as middle-ram, except we allow
  * the array to be lossy so we can cap the total memory usage. Hence it is a
  * combination of a sparse array with a priority queue
@@ -388,6 +431,7 @@ node_ram_cache::node_ram_cache(int strategy, int cacheSizeMB)
 
 node_ram_cache::~node_ram_cache()
 {
+    lookup_counts.publish();
     fprintf(stderr, "node cache: stored: %" PRIdOSMID
                     "(%.2f%%), storage efficiency: %.2f%% (dense blocks: %i, "
                     "sparse nodes: %" PRId64 "), hit rate: %.2f%%\n",
@@ -460,6 +504,7 @@ osmium::Location node_ram_cache::get(osmid_t id)
         nodesCacheHits++;
     }
     nodesCacheLookups++;
+    lookup_counts.count(coord.valid());
 
     return coord;
 }
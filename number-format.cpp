@@ -0,0 +1,14 @@
+#include <cstdio>
+
+#include "number-format.hpp"
+
+namespace util {
+
+void append_double(std::string &out, double value)
+{
+    char buf[32];
+    int const len = snprintf(buf, sizeof(buf), "%g", value);
+    out.append(buf, static_cast<size_t>(len));
+}
+
+} // namespace util
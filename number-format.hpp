@@ -0,0 +1,53 @@
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+#include <string>
+#include <type_traits>
+
+/**
+ * Formatting of numbers for COPY data and query parameters.
+ *
+ * The functions append directly to the target string and never allocate
+ * beyond growing it, which makes them considerably cheaper than
+ * boost::format or std::to_string on the per-row paths.
+ */
+namespace util {
+
+/// Append the decimal representation of an integer to out.
+template <typename T>
+void append_int(std::string &out, T value)
+{
+    static_assert(std::is_integral<T>::value, "integer type required");
+
+    typedef typename std::make_unsigned<T>::type unsigned_t;
+
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+
+    // negate in unsigned arithmetic so that the minimum value works, too
+    bool const negative = value < 0;
+    unsigned_t u = negative ? unsigned_t(0) - static_cast<unsigned_t>(value)
+                            : static_cast<unsigned_t>(value);
+
+    do {
+        *--p = static_cast<char>('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+
+    if (negative) {
+        *--p = '-';
+    }
+
+    out.append(p, end);
+}
+
+/**
+ * Append value formatted like printf's %g, that is with 6 significant
+ * digits. Real columns and way_area have always been written this way.
+ */
+void append_double(std::string &out, double value);
+
+} // namespace util
+
+#endif
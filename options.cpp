@@ -77,6 +77,15 @@ namespace
         {"flat-nodes",1,0, 'F'},
         {"tag-transform-script",1,0,212},
         {"reproject-area",0,0,213},
+        {"metrics-port", 1, 0, 215},
+        {"resume", 0, 0, 216},
+        {"copy-buffer-size", 1, 0, 217},
+        {"relation-prescan", 0, 0, 218},
+        {"update-daemon", 0, 0, 219},
+        {"squash-diffs", 0, 0, 220},
+        {"locations-on-ways", 0, 0, 221},
+        {"middle-dir", 1, 0, 222},
+        {"checkpoints", 0, 0, 223},
         {0, 0, 0, 0}
     };
 
@@ -220,6 +229,46 @@ namespace
                         By default natural=coastline tagged data will be discarded\n\
                         because renderers usually have shape files for them.\n\
           --reproject-area   compute area column using spherical mercator coordinates.\n\
+          --metrics-port    Serve live import statistics in Prometheus text\n\
+                        format on http://127.0.0.1:<port>/metrics.\n\
+          --checkpoints  Record the finished phases of an import in the\n\
+                        table <prefix>_osm2pgsql_state, so that it can be\n\
+                        continued with --resume if it fails late. This\n\
+                        needs one more database connection.\n\
+          --resume      Continue an import that was interrupted after the\n\
+                        input was processed, e.g. during index creation.\n\
+                        The import must have been run with --checkpoints,\n\
+                        the input files, style and options must not have\n\
+                        changed since.\n\
+          --copy-buffer-size  Size in MB of the buffers in which rows are\n\
+                        collected before they are sent to the database\n\
+                        (default: 1). Up to three such buffers are used\n\
+                        per table and connection.\n\
+          --relation-prescan  Read the relations of the input files first.\n\
+                        Polygon ways which are not members of an area\n\
+                        relation are then written right away instead of\n\
+                        being processed again at the end of the import.\n\
+                        With --tag-transform-script the members of all\n\
+                        relations are left for the end.\n\
+          --update-daemon  Keep running and apply the change files whose\n\
+                        names are read from stdin, one per line, after\n\
+                        those on the command line. A name may be followed\n\
+                        by a tab and the file to write the tiles expired\n\
+                        by this diff to. \"done <name>\" is printed to\n\
+                        stdout when a diff is committed. Needs --append.\n\
+          --squash-diffs  Merge all change files given on the command line\n\
+                        and apply only the newest version of each object.\n\
+                        The files are read into memory. Needs --append.\n\
+          --locations-on-ways  The input files carry the node locations\n\
+                        in the ways (see osmium add-locations-to-ways).\n\
+                        Untagged nodes are not stored, so only a small\n\
+                        cache is needed. Not possible with --slim.\n\
+          --middle-dir  Keep the slim mode data in files in this existing\n\
+                        directory instead of the database. Needs --slim\n\
+                        and --flat-nodes. Use the same directory with\n\
+                        --append. At the end of an update the objects are\n\
+                        copied into new files once half of the space is\n\
+                        taken by replaced ones.\n\
        -h|--help        Help information.\n\
        -v|--verbose     Verbose output.\n");
         }
@@ -507,6 +556,33 @@ options_t::options_t(int argc, char *argv[]): options_t()
         case 213:
             reproject_area = true;
             break;
+        case 215:
+            metrics_port = atoi(optarg);
+            break;
+        case 216:
+            resume = true;
+            break;
+        case 217:
+            copy_buffer_size = atoi(optarg);
+            break;
+        case 218:
+            relation_prescan = true;
+            break;
+        case 219:
+            update_daemon = true;
+            break;
+        case 220:
+            squash_diffs = true;
+            break;
+        case 221:
+            locations_on_ways = true;
+            break;
+        case 222:
+            middle_dir = std::string(optarg);
+            break;
+        case 223:
+            checkpoints = true;
+            break;
         case 'V':
             fprintf(stderr, "Compiled using the following library versions:\n");
             fprintf(stderr, "Libosmium %s\n", LIBOSMIUM_VERSION_STRING);
@@ -534,8 +610,8 @@ options_t::options_t(int argc, char *argv[]): options_t()
         return;
     }
 
-    //we require some input files!
-    if (argc == optind) {
+    //we require some input files, unless they come from stdin
+    if (argc == optind && !update_daemon) {
         short_usage(argv[0]);
     }
 
@@ -567,6 +643,38 @@ void options_t::check_options()
         throw std::runtime_error("--append can only be used with slim mode!\n");
     }
 
+    if (resume && append) {
+        throw std::runtime_error("--resume can only be used with imports, not with --append.\n");
+    }
+
+    if (checkpoints && append) {
+        throw std::runtime_error("--checkpoints can only be used with imports, not with --append.\n");
+    }
+
+    if (update_daemon && !append) {
+        throw std::runtime_error("--update-daemon can only be used with --append.\n");
+    }
+
+    if (squash_diffs && !append) {
+        throw std::runtime_error("--squash-diffs can only be used with --append.\n");
+    }
+
+    if (squash_diffs && update_daemon) {
+        throw std::runtime_error("--squash-diffs can not be used with --update-daemon.\n");
+    }
+
+    if (locations_on_ways && slim) {
+        throw std::runtime_error("--locations-on-ways can not be used with --slim.\n");
+    }
+
+    if (middle_dir && !(slim && flat_node_cache_enabled)) {
+        throw std::runtime_error("--middle-dir can only be used with --slim and --flat-nodes.\n");
+    }
+
+    if (relation_prescan && append) {
+        throw std::runtime_error("--relation-prescan can only be used with imports, not with --append.\n");
+    }
+
     if (droptemp && !slim) {
         throw std::runtime_error("--drop only makes sense with --slim.\n");
     }
@@ -595,6 +703,14 @@ void options_t::check_options()
         fprintf(stderr, "WARNING: ram cache is disabled. This will likely slow down processing a lot.\n\n");
     }
 
+    if (metrics_port < 0 || metrics_port > 65535) {
+        throw std::runtime_error("--metrics-port must be between 0 and 65535 (0 = off).\n");
+    }
+
+    if (copy_buffer_size < 1 || copy_buffer_size > 1024) {
+        throw std::runtime_error("--copy-buffer-size must be between 1 and 1024.\n");
+    }
+
     if (num_procs < 1) {
         num_procs = 1;
         fprintf(stderr, "WARNING: Must use at least 1 process.\n\n");
@@ -9,6 +9,9 @@
 #include <memory>
 #include <boost/optional.hpp>
 
+class checkpoint_t;
+struct id_tracker;
+
 /* Variants for generation of hstore column */
 /* No hstore column */
 #define HSTORE_NONE 0
@@ -96,6 +99,22 @@ public:
     boost::optional<std::string> bbox;
     bool extra_attributes;
     bool verbose;
+    int metrics_port = 0; ///< serve live metrics on this local port (0 = off)
+    bool checkpoints = false; ///< record the finished phases of an import
+    bool resume = false; ///< continue an interrupted import at the last checkpoint
+    int copy_buffer_size = 1; ///< size of the COPY send buffers in MB
+    bool relation_prescan = false; ///< read the relations before the import
+    bool update_daemon = false; ///< apply diffs named on stdin until EOF
+    bool squash_diffs = false; ///< apply all change files as one diff
+    bool locations_on_ways = false; ///< use the node locations stored in ways
+    /// keep the slim mode middle in files in this directory
+    boost::optional<std::string> middle_dir;
+
+    /// ways which are members of relations, only set by the relation pre-scan
+    std::shared_ptr<id_tracker> relation_member_ways;
+
+    /// import phase markers, only set with --checkpoints or --resume
+    std::shared_ptr<checkpoint_t> checkpoint;
 
     std::vector<std::string> input_files;
 private:
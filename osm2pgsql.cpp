@@ -24,6 +24,9 @@
 */
 
 #include "config.h"
+#include "checkpoint.hpp"
+#include "id-tracker.hpp"
+#include "metrics.hpp"
 #include "osmtypes.hpp"
 #include "reprojection.hpp"
 #include "options.hpp"
@@ -34,15 +37,63 @@
 #include "util.hpp"
 
 #include <time.h>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
+#include <iostream>
 
 #include <libpq-fe.h>
 #include <boost/format.hpp>
 
+namespace {
+
+/**
+ * Apply the change files given on the command line and then those named
+ * on stdin one by one, committing after each. Runs until stdin is closed.
+ */
+void run_update_daemon(options_t const &options, osmdata_t *osmdata)
+{
+    auto apply = [&](std::string const &filename,
+                     std::string const &expire_file) {
+        fprintf(stderr, "\nApplying diff: %s\n", filename.c_str());
+        time_t const start = time(nullptr);
+
+        parse_osmium_t parser(options.bbox, true, osmdata);
+        parser.stream_file(filename, options.input_reader);
+        osmdata->commit_diff(expire_file);
+
+        fprintf(stderr, "  diff applied in %ds\n",
+                (int)(time(nullptr) - start));
+
+        // tell whoever feeds us that the diff is in the database
+        printf("done %s\n", filename.c_str());
+        fflush(stdout);
+    };
+
+    for (auto const &filename : options.input_files) {
+        apply(filename, options.expire_tiles_filename);
+    }
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        auto const tab = line.find('\t');
+        if (tab == std::string::npos) {
+            apply(line, options.expire_tiles_filename);
+        } else {
+            apply(line.substr(0, tab), line.substr(tab + 1));
+        }
+    }
+}
+
+} // anonymous namespace
+
 int main(int argc, char *argv[])
 {
     fprintf(stderr, "osm2pgsql version %s (%zu bit id space)\n\n", VERSION, 8 * sizeof(osmid_t));
@@ -53,8 +104,61 @@ int main(int argc, char *argv[])
         if(options.long_usage_bool)
             return 0;
 
+        std::unique_ptr<metrics::server_t> metrics_server;
+        if (options.metrics_port > 0) {
+            metrics_server.reset(new metrics::server_t(options.metrics_port));
+        }
+
+        // Imports can keep track of their progress, so that they can be
+        // resumed if they fail late. The null output without slim mode has
+        // no database to keep the state in.
+        if (options.checkpoints || options.resume) {
+            if (!options.slim && options.output_backend == "null") {
+                throw std::runtime_error(
+                    "--checkpoints and --resume need a database output.");
+            }
+            options.checkpoint = std::make_shared<checkpoint_t>(
+                options.database_options, options.prefix);
+        }
+
+        if (options.locations_on_ways) {
+            for (auto const &filename : options.input_files) {
+                if (lacks_locations_on_ways(filename, options.input_reader)) {
+                    throw std::runtime_error(
+                        (boost::format("Input file '%1%' has no locations on "
+                                       "ways, --locations-on-ways can not be "
+                                       "used.") %
+                         filename)
+                            .str());
+                }
+            }
+        }
+
+        // Find the ways of the relations which may turn into areas. The
+        // outputs can write all other polygon ways without delay.
+        if (options.relation_prescan && !options.resume) {
+            // A tag transform script may build areas from any relation,
+            // then the ways of all of them are left for later.
+            std::vector<std::string> types;
+            if (!options.tag_transform_script) {
+                types = {"multipolygon", "boundary"};
+            }
+
+            time_t const start = time(nullptr);
+            options.relation_member_ways = std::make_shared<id_tracker>();
+            for (auto const &filename : options.input_files) {
+                fprintf(stderr, "Scanning relations in file: %s\n",
+                        filename.c_str());
+                scan_relation_members(filename, options.input_reader, types,
+                                      options.relation_member_ways.get());
+            }
+            fprintf(stderr, "  found %zu member ways in %ds\n",
+                    options.relation_member_ways->size(),
+                    (int)(time(nullptr) - start));
+        }
+
         //setup the middle
-        std::shared_ptr<middle_t> middle = middle_t::create_middle(options.slim);
+        std::shared_ptr<middle_t> middle = middle_t::create_middle(options);
 
         //setup the backend (output)
         std::vector<std::shared_ptr<output_t> > outputs = output_t::create_outputs(middle.get(), options);
@@ -66,28 +170,76 @@ int main(int argc, char *argv[])
                 options.projection->target_srs(),
                 options.projection->target_desc());
 
-        //start it up
         time_t overall_start = time(nullptr);
+
+        if (options.resume) {
+            osmdata.resume();
+
+            fprintf(stderr, "\nOsm2pgsql took %ds overall\n", (int)(time(nullptr) - overall_start));
+
+            return 0;
+        }
+
+        if (options.checkpoint) {
+            options.checkpoint->reset(import_fingerprint(options));
+        }
+
+        //start it up
         osmdata.start();
 
+        if (options.update_daemon) {
+            run_update_daemon(options, &osmdata);
+            osmdata.stop();
+
+            fprintf(stderr, "\nOsm2pgsql took %ds overall\n", (int)(time(nullptr) - overall_start));
+
+            return 0;
+        }
+
         /* Processing
          * In this phase the input file(s) are read and parsed, populating some of the
          * tables. Not all ways can be handled before relations are processed, so they're
          * set as pending, to be handled in the next stage.
          */
         parse_stats_t stats;
-        //read in the input files one by one
-        for (auto const filename : options.input_files) {
-            //read the actual input
-            fprintf(stderr, "\nReading in file: %s\n", filename.c_str());
+        if (options.squash_diffs) {
+            //apply all change files in one go
+            fprintf(stderr, "\nSquashing %zu change files\n",
+                    options.input_files.size());
+            time_t start = time(nullptr);
+
+            parse_osmium_t parser(options.bbox, options.append, &osmdata);
+            parser.stream_squashed(options.input_files, options.input_reader);
+
+            stats.update(parser.stats());
+
+            fprintf(stderr, "  parse time: %ds\n", (int)(time(nullptr) - start));
+        } else if (!options.append && options.input_files.size() > 1) {
+            //merge the input files into one ordered stream
+            fprintf(stderr, "\nMerging %zu input files\n",
+                    options.input_files.size());
             time_t start = time(nullptr);
 
             parse_osmium_t parser(options.bbox, options.append, &osmdata);
-            parser.stream_file(filename, options.input_reader);
+            parser.stream_merged(options.input_files, options.input_reader);
 
             stats.update(parser.stats());
 
             fprintf(stderr, "  parse time: %ds\n", (int)(time(nullptr) - start));
+        } else {
+            //read in the input files one by one
+            for (auto const filename : options.input_files) {
+                //read the actual input
+                fprintf(stderr, "\nReading in file: %s\n", filename.c_str());
+                time_t start = time(nullptr);
+
+                parse_osmium_t parser(options.bbox, options.append, &osmdata);
+                parser.stream_file(filename, options.input_reader);
+
+                stats.update(parser.stats());
+
+                fprintf(stderr, "  parse time: %ds\n", (int)(time(nullptr) - start));
+            }
         }
 
         //show stats
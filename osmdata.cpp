@@ -1,13 +1,20 @@
+#include <algorithm>
 #include <cstdio>
 #include <functional>
 #include <future>
 #include <mutex>
+#include <unordered_map>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
 #include <osmium/thread/pool.hpp>
 
+#include "checkpoint.hpp"
+#include "metrics.hpp"
 #include "middle.hpp"
 #include "node-ram-cache.hpp"
 #include "osmdata.hpp"
@@ -20,6 +27,8 @@ osmdata_t::osmdata_t(std::shared_ptr<middle_t> mid_,
 {
     outs.push_back(out_);
     with_extra = outs[0]->get_options()->extra_attributes;
+    locations_on_ways = outs[0]->get_options()->locations_on_ways;
+    checked_locations = false;
 }
 
 osmdata_t::osmdata_t(std::shared_ptr<middle_t> mid_,
@@ -33,6 +42,8 @@ osmdata_t::osmdata_t(std::shared_ptr<middle_t> mid_,
     }
 
     with_extra = outs[0]->get_options()->extra_attributes;
+    locations_on_ways = outs[0]->get_options()->locations_on_ways;
+    checked_locations = false;
 }
 
 osmdata_t::~osmdata_t()
@@ -41,7 +52,10 @@ osmdata_t::~osmdata_t()
 
 int osmdata_t::node_add(osmium::Node const &node)
 {
-    mid->nodes_set(node);
+    // Ways bring their own locations, untagged nodes are of no further use.
+    if (!locations_on_ways || !node.tags().empty()) {
+        mid->nodes_set(node);
+    }
 
     int status = 0;
 
@@ -56,6 +70,21 @@ int osmdata_t::node_add(osmium::Node const &node)
 
 int osmdata_t::way_add(osmium::Way *way)
 {
+    // Only PBF files announce the locations in their header, for the
+    // other formats the first way has to tell.
+    if (locations_on_ways && !checked_locations && !way->nodes().empty()) {
+        auto const &nodes = way->nodes();
+        if (std::none_of(nodes.cbegin(), nodes.cend(),
+                         [](osmium::NodeRef const &n) {
+                             return n.location().valid();
+                         })) {
+            throw std::runtime_error("The ways in the input have no node "
+                                     "locations, --locations-on-ways can not "
+                                     "be used.");
+        }
+        checked_locations = true;
+    }
+
     mid->ways_set(*way);
 
     int status = 0;
@@ -180,8 +209,6 @@ void osmdata_t::start() {
     mid->start(outs[0]->get_options());
 }
 
-namespace {
-
 //TODO: have the main thread using the main middle to query the middle for batches of ways (configurable number)
 //and stuffing those into the work queue, so we have a single producer multi consumer threaded queue
 //since the fetching from middle should be faster than the processing in each backend.
@@ -190,41 +217,84 @@ struct pending_threaded_processor : public middle_t::pending_processor {
     typedef std::vector<std::shared_ptr<output_t>> output_vec_t;
     typedef std::pair<std::shared_ptr<middle_query_t>, output_vec_t> clone_t;
 
-    static void do_jobs(output_vec_t const& outputs, pending_queue_t& queue, size_t& ids_done, std::mutex& mutex, int append, bool ways) {
+    //number of jobs a thread takes off the queue at once
+    static constexpr size_t batch_size = 64;
+
+    //relations with at least this many members are handed out one by one
+    //before all others, the largest first, so that their multipolygon
+    //assembly starts right away instead of being the tail of the pass
+    static constexpr size_t large_relation_members = 1000;
+
+    //jobs of large relations, the largest at the back
+    typedef std::vector<pending_job_t> large_jobs_t;
+
+    static void do_jobs(clone_t const& clone, pending_queue_t& queue, large_jobs_t& large, size_t& ids_done, std::mutex& mutex, int append, bool ways) {
+        auto const &outputs = clone.second;
+        std::vector<pending_job_t> jobs;
+        idlist_t ids;
         while (true) {
-            //get the job off the queue synchronously
-            pending_job_t job;
+            //get a batch of jobs off the queue synchronously
+            jobs.clear();
             mutex.lock();
-            if(queue.empty()) {
-                mutex.unlock();
-                break;
-            }
-            else {
-                job = queue.top();
-                queue.pop();
+            if (!large.empty()) {
+                jobs.push_back(large.back());
+                large.pop_back();
+            } else {
+                while (!queue.empty() && jobs.size() < batch_size) {
+                    jobs.push_back(queue.top());
+                    queue.pop();
+                }
             }
             mutex.unlock();
 
-            //process it
-            if(ways)
-                outputs.at(job.output_id)->pending_way(job.osm_id, append);
+            if (jobs.empty()) {
+                break;
+            }
+
+            //the middle may fetch the objects of the whole batch at once
+            ids.clear();
+            for (auto const &job : jobs) {
+                ids.push_back(job.osm_id);
+            }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            if (ways)
+                clone.first->ways_prefetch(ids);
             else
-                outputs.at(job.output_id)->pending_relation(job.osm_id, append);
+                clone.first->relations_prefetch(ids);
 
-            mutex.lock();
-            ++ids_done;
-            mutex.unlock();
+            //process them
+            for (auto const &job : jobs) {
+                if(ways)
+                    outputs.at(job.output_id)->pending_way(job.osm_id, append);
+                else
+                    outputs.at(job.output_id)->pending_relation(job.osm_id, append);
+
+                mutex.lock();
+                ++ids_done;
+                mutex.unlock();
+            }
         }
+
+        //drop the objects of the last batch
+        if (ways)
+            clone.first->ways_prefetch(idlist_t());
+        else
+            clone.first->relations_prefetch(idlist_t());
     }
 
-    static void print_stats(pending_queue_t &queue, std::mutex &mutex)
+    static void print_stats(pending_queue_t &queue, large_jobs_t &large,
+                            std::mutex &mutex)
     {
+        auto &queue_length = metrics::gauge("osm2pgsql_pending_queue_length");
         size_t queue_size;
         do {
             mutex.lock();
-            queue_size = queue.size();
+            queue_size = queue.size() + large.size();
             mutex.unlock();
 
+            queue_length = static_cast<int64_t>(queue_size);
+
             fprintf(stderr, "\rLeft to process: %zu...", queue_size);
 
             std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -238,14 +308,37 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         //note that we cant hint to the stack how large it should be ahead of time
         //we could use a different datastructure like a deque or vector but then
         //the outputs the enqueue jobs would need the version check for the push(_back) method
-        : outs(outs),
+        : mid(mid),
+          thread_count(thread_count),
+          outs(outs),
           ids_queued(0),
+          clones_committed(false),
           append(append),
           queue(),
           ids_done(0)
     {
+    }
+
+    ~pending_threaded_processor() {}
+
+    //clone all the things we need, unless that has already happened.
+    //Every clone opens its own database connections, so this is only
+    //done once there is actual work in the queue.
+    void make_clones()
+    {
+        if (!clones.empty()) {
+            //they were committed at the end of the last pass
+            if (clones_committed) {
+                for (auto const &clone : clones) {
+                    for (auto const &out : clone.second) {
+                        out->begin();
+                    }
+                }
+                clones_committed = false;
+            }
+            return;
+        }
 
-        //clone all the things we need
         clones.reserve(thread_count);
         for (size_t i = 0; i < thread_count; ++i) {
             //clone the middle
@@ -262,8 +355,6 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         }
     }
 
-    ~pending_threaded_processor() {}
-
     void enqueue_ways(osmid_t id) {
         for(size_t i = 0; i < outs.size(); ++i) {
             outs[i]->enqueue_ways(queue, id, i, ids_queued);
@@ -272,6 +363,13 @@ struct pending_threaded_processor : public middle_t::pending_processor {
 
     //waits for the completion of all outstanding jobs
     void process_ways() {
+        if (queue.empty()) {
+            fprintf(stderr, "\nNo pending ways.\n");
+            return;
+        }
+
+        make_clones();
+
         //reset the number we've done
         ids_done = 0;
 
@@ -285,12 +383,14 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         std::vector<std::future<void>> workers;
         for (size_t i = 0; i < clones.size(); ++i) {
             workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
+                                         do_jobs, std::cref(clones[i]),
+                                         std::ref(queue), std::ref(large_jobs),
+                                         std::ref(ids_done),
                                          std::ref(mutex), append, true));
         }
         workers.push_back(std::async(std::launch::async, print_stats,
-                                     std::ref(queue), std::ref(mutex)));
+                                     std::ref(queue), std::ref(large_jobs),
+                                     std::ref(mutex)));
 
         for (auto& w: workers) {
             try {
@@ -301,6 +401,7 @@ struct pending_threaded_processor : public middle_t::pending_processor {
                 while (!queue.empty()) {
                     queue.pop();
                 }
+                large_jobs.clear();
                 mutex.unlock();
                 throw;
             }
@@ -324,8 +425,11 @@ struct pending_threaded_processor : public middle_t::pending_processor {
                 clone_output->get()->commit();
                 //merge the pending from this threads copy of output back
                 original_output->get()->merge_pending_relations(clone_output->get());
+                //the expire tree, too, there may be no relations to follow
+                original_output->get()->merge_expire_trees(clone_output->get());
             }
         }
+        clones_committed = true;
     }
 
     void enqueue_relations(osmid_t id) {
@@ -334,12 +438,85 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         }
     }
 
+    //move the jobs of large relations from the queue to large_jobs,
+    //ordered by their number of members
+    void sort_out_large_relations() {
+        //with a single thread the order makes no difference
+        if (clones.size() < 2) {
+            return;
+        }
+
+        std::vector<pending_job_t> jobs;
+        jobs.reserve(queue.size());
+        while (!queue.empty()) {
+            jobs.push_back(queue.top());
+            queue.pop();
+        }
+
+        idlist_t ids;
+        ids.reserve(jobs.size());
+        for (auto const &job : jobs) {
+            ids.push_back(job.osm_id);
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        //number of members of the large relations
+        std::unordered_map<osmid_t, size_t> members;
+        auto const &query = *clones.front().first;
+        osmium::memory::Buffer buffer(4096,
+                                      osmium::memory::Buffer::auto_grow::yes);
+        idlist_t chunk;
+        for (size_t i = 0; i < ids.size(); i += 16 * batch_size) {
+            auto const end = std::min(ids.size(), i + 16 * batch_size);
+            chunk.assign(ids.begin() + i, ids.begin() + end);
+            query.relations_prefetch(chunk);
+            for (size_t j = i; j < end; ++j) {
+                buffer.clear();
+                if (query.relations_get(ids[j], buffer)) {
+                    auto const &rel = buffer.get<osmium::Relation>(0);
+                    if (rel.members().size() >= large_relation_members) {
+                        members.emplace(ids[j], rel.members().size());
+                    }
+                }
+            }
+        }
+        query.relations_prefetch(idlist_t());
+
+        //put the others back in their previous order
+        for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+            auto const m = members.find(it->osm_id);
+            if (m == members.end()) {
+                queue.push(*it);
+            } else {
+                large_jobs.push_back(*it);
+            }
+        }
+        std::stable_sort(large_jobs.begin(), large_jobs.end(),
+                         [&members](pending_job_t const &a,
+                                    pending_job_t const &b) {
+                             return members[a.osm_id] < members[b.osm_id];
+                         });
+    }
+
     void process_relations() {
+        if (queue.empty()) {
+            fprintf(stderr, "\nNo pending relations.\n");
+            return;
+        }
+
+        make_clones();
+        sort_out_large_relations();
+
         //reset the number we've done
         ids_done = 0;
 
         fprintf(stderr, "\nGoing over pending relations...\n");
         fprintf(stderr, "\t%zu relations are pending\n", ids_queued);
+        if (!large_jobs.empty()) {
+            fprintf(stderr, "\t%zu of them are large, those go first\n",
+                    large_jobs.size());
+        }
         fprintf(stderr, "\nUsing %zu helper-processes\n", clones.size());
         time_t start = time(nullptr);
 
@@ -347,12 +524,14 @@ struct pending_threaded_processor : public middle_t::pending_processor {
         std::vector<std::future<void>> workers;
         for (size_t i = 0; i < clones.size(); ++i) {
             workers.push_back(std::async(std::launch::async,
-                                         do_jobs, std::cref(clones[i].second),
-                                         std::ref(queue), std::ref(ids_done),
+                                         do_jobs, std::cref(clones[i]),
+                                         std::ref(queue), std::ref(large_jobs),
+                                         std::ref(ids_done),
                                          std::ref(mutex), append, false));
         }
         workers.push_back(std::async(std::launch::async, print_stats,
-                                     std::ref(queue), std::ref(mutex)));
+                                     std::ref(queue), std::ref(large_jobs),
+                                     std::ref(mutex)));
 
         for (auto& w: workers) {
             try {
@@ -363,6 +542,7 @@ struct pending_threaded_processor : public middle_t::pending_processor {
                 while (!queue.empty()) {
                     queue.pop();
                 }
+                large_jobs.clear();
                 mutex.unlock();
                 throw;
             }
@@ -387,18 +567,27 @@ struct pending_threaded_processor : public middle_t::pending_processor {
                 original_output->get()->merge_expire_trees(clone_output->get());
             }
         }
+        clones_committed = true;
     }
 
 private:
+    //the original middle, only needed for making clones
+    std::shared_ptr<middle_t> mid;
+    size_t thread_count;
     //middle and output copies
     std::vector<clone_t> clones;
     output_vec_t outs; //would like to move ownership of outs to osmdata_t and middle passed to output_t instead of owned by it
-    //how many jobs do we have in the queue to start with
+    //how many jobs do we have in the queue to start with, only for the
+    //statistics as not all outputs count every job they queue
     size_t ids_queued;
+    //the clones have no open transaction
+    bool clones_committed;
     //appending to output that is already there (diff processing)
     bool append;
     //job queue
     pending_queue_t queue;
+    //jobs of large relations, handed out before the queue
+    large_jobs_t large_jobs;
 
     //how many ids within the job have been processed
     size_t ids_done;
@@ -406,8 +595,6 @@ private:
     std::mutex mutex;
 };
 
-} // anonymous namespace
-
 void osmdata_t::stop() {
     /* Commit the transactions, so that multiple processes can
      * access the data simultanious to process the rest in parallel
@@ -420,31 +607,97 @@ void osmdata_t::stop() {
     }
 
     // should be the same for all outputs
-    const bool append = outs[0]->get_options()->append;
+    auto *opts = outs[0]->get_options();
 
-    {
-        //threaded pending processing
-        pending_threaded_processor ptp(
-            mid, outs, outs[0]->get_options()->num_procs, append);
-
-        if (!outs.empty()) {
-            //This stage takes ways which were processed earlier, but might be
-            //involved in a multipolygon relation. They could also be ways that
-            //were modified in diff processing.
-            mid->iterate_ways(ptp);
-
-            //This is like pending ways, except there aren't pending relations
-            //on import, only on update.
-            //TODO: Can we skip this on import?
-            mid->iterate_relations(ptp);
+    if (opts->checkpoint) {
+        std::string files;
+        for (auto const &filename : opts->input_files) {
+            if (!files.empty()) {
+                files += ' ';
+            }
+            files += filename;
         }
+        opts->checkpoint->mark_done("parse", files);
+    }
+
+    process_pending();
+
+    if (opts->checkpoint) {
+        opts->checkpoint->mark_done("pending");
+    }
+
+    finish();
+}
+
+void osmdata_t::process_pending()
+{
+    auto *opts = outs[0]->get_options();
+
+    //threaded pending processing, the clones are kept for the next diff
+    if (!pending) {
+        pending.reset(new pending_threaded_processor(mid, outs, opts->num_procs,
+                                                     opts->append));
+    }
+
+    if (!outs.empty()) {
+        //This stage takes ways which were processed earlier, but might be
+        //involved in a multipolygon relation. They could also be ways that
+        //were modified in diff processing.
+        mid->iterate_ways(*pending);
+
+        //This is like pending ways, except there aren't pending relations
+        //on import, only on update. When nothing is queued the
+        //processor returns without setting up any threads or clones.
+        mid->iterate_relations(*pending);
+    }
+}
+
+void osmdata_t::commit_diff(std::string const &expire_file)
+{
+    mid->commit();
+    for (auto &out : outs) {
+        out->commit();
+    }
+
+    process_pending();
+
+    for (auto &out : outs) {
+        out->next_diff(expire_file);
     }
+    mid->next_diff();
+}
 
+void osmdata_t::resume()
+{
+    auto *opts = outs[0]->get_options();
+    auto &checkpoint = opts->checkpoint;
+
+    checkpoint->check_fingerprint(import_fingerprint(*opts));
+
+    if (!checkpoint->done("pending")) {
+        throw std::runtime_error(
+            "The import was interrupted before the pending ways and "
+            "relations were processed. It can not be resumed, run it "
+            "again without --resume.");
+    }
+
+    fprintf(stderr, "Resuming import of: %s\n",
+            checkpoint->info("parse").get_value_or("").c_str());
+
+    mid->resume(opts);
+    finish();
+}
+
+void osmdata_t::finish()
+{
+    auto *opts = outs[0]->get_options();
+
+    // close the connections of the pending processing clones
+    pending.reset();
 
     // Clustering, index creation, and cleanup.
     // All the intensive parts of this are long-running PostgreSQL commands
     {
-        auto *opts = outs[0]->get_options();
         osmium::thread::Pool pool(opts->parallel_indexing ? opts->num_procs : 1,
                                   512);
 
@@ -470,4 +723,9 @@ void osmdata_t::stop() {
         // XXX If one of them has an error, all other will finish first,
         //     which may take a long time.
     }
+
+    // all phases are done, there is nothing left to resume
+    if (opts->checkpoint) {
+        opts->checkpoint->drop();
+    }
 }
@@ -7,10 +7,12 @@
 
 #include <vector>
 #include <memory>
+#include <string>
 
 #include "osmtypes.hpp"
 
 class output_t;
+struct pending_threaded_processor;
 struct middle_t;
 class reprojection;
 
@@ -27,6 +29,20 @@ public:
     void start();
     void stop();
 
+    /**
+     * Finish the diff read since start() or the last call: commit it,
+     * process the pending ways and relations, and write the tiles it
+     * expired to expire_file. All connections stay open, so that the
+     * next diff can be applied right away.
+     */
+    void commit_diff(std::string const &expire_file);
+
+    /**
+     * Finish an import that was interrupted after the pending
+     * processing, using the markers of options_t::checkpoint.
+     */
+    void resume();
+
     int node_add(osmium::Node const &node);
     int way_add(osmium::Way *way);
     int relation_add(osmium::Relation const &rel);
@@ -40,10 +56,16 @@ public:
     int relation_delete(osmid_t id);
 
 private:
+    void process_pending();
+    void finish();
+
     std::shared_ptr<middle_t> mid;
     std::vector<std::shared_ptr<output_t> > outs;
     std::shared_ptr<reprojection> projection;
     bool with_extra;
+    bool locations_on_ways;
+    bool checked_locations;
+    std::unique_ptr<pending_threaded_processor> pending;
 };
 
 #endif
@@ -5,6 +5,7 @@
 
 #include <osmium/area/geom_assembler.hpp>
 
+#include "expire-tiles.hpp"
 #include "osmium-builder.hpp"
 
 namespace {
@@ -47,10 +48,54 @@ inline void add_nodes_to_builder(osmium::builder::WayNodeListBuilder &builder,
 
 namespace geom {
 
+void way_cache_t::use(std::shared_ptr<reprojection> const &proj, osmid_t id,
+                      uint64_t generation)
+{
+    if (proj == m_proj && id == m_id && generation == m_way_generation) {
+        return;
+    }
+
+    m_proj = proj;
+    m_id = id;
+    m_way_generation = generation;
+    clear();
+}
+
+void way_cache_t::clear()
+{
+    has_coords = false;
+    coords.clear();
+    has_area = false;
+    area.clear();
+    ring_coords.clear();
+}
+
+way_cache_t &osmium_builder_t::way_cache()
+{
+    if (m_way_cache && m_way_id != 0) {
+        m_way_cache->use(m_proj, m_way_id, m_way_generation);
+        return *m_way_cache;
+    }
+
+    m_scratch.clear();
+    return m_scratch;
+}
+
+void osmium_builder_t::set_expire(expire_tiles *expire, osmid_t id)
+{
+    m_expire = (expire && expire->enabled()) ? expire : nullptr;
+    m_expire_id = id;
+}
+
 osmium_builder_t::wkb_t
 osmium_builder_t::get_wkb_node(osmium::Location const &loc) const
 {
-    return m_writer.make_point(m_proj->reproject(loc));
+    auto const pt = m_proj->reproject(loc);
+    if (m_expire) {
+        m_expire->from_point(pt);
+    }
+
+    return m_writer.make_point(pt);
 }
 
 osmium_builder_t::wkbs_t
@@ -62,14 +107,18 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes, double split_at
 
     double dist = 0;
     osmium::geom::Coordinates prev_pt;
+    // last point written to the current segment
+    osmium::geom::Coordinates last_pt;
     m_writer.linestring_start();
     size_t curlen = 0;
 
-    for (auto const &node : nodes) {
-        if (!node.location().valid())
-            continue;
+    auto &cache = way_cache();
+    if (!cache.has_coords) {
+        m_proj->reproject(nodes, &cache.coords);
+        cache.has_coords = true;
+    }
 
-        auto const this_pt = m_proj->reproject(node.location());
+    for (auto const &this_pt : cache.coords) {
         if (prev_pt.valid()) {
             if (prev_pt == this_pt) {
                 continue;
@@ -92,12 +141,16 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes, double split_at
                         double const frac =
                             ((double)(j + 1) * split_at - dist) / delta;
                         ipoint = interpolate(this_pt, prev_pt, frac);
+                        if (m_expire && curlen > 0) {
+                            m_expire->from_segment(last_pt, ipoint);
+                        }
                         m_writer.add_location(ipoint);
                         ret.push_back(m_writer.linestring_finish(curlen + 1));
                         // start a new segment
                         m_writer.linestring_start();
                         m_writer.add_location(ipoint);
                         curlen = 1;
+                        last_pt = ipoint;
                     }
                     // reset the distance based on the final splitting point for
                     // the next iteration.
@@ -115,8 +168,12 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes, double split_at
             }
         }
 
+        if (m_expire && curlen > 0) {
+            m_expire->from_segment(last_pt, this_pt);
+        }
         m_writer.add_location(this_pt);
         ++curlen;
+        last_pt = this_pt;
 
         prev_pt = this_pt;
     }
@@ -132,16 +189,26 @@ osmium_builder_t::get_wkb_line(osmium::WayNodeList const &nodes, double split_at
 osmium_builder_t::wkb_t
 osmium_builder_t::get_wkb_polygon(osmium::Way const &way)
 {
-    osmium::area::AssemblerConfig area_config;
-    area_config.ignore_invalid_locations = true;
-    osmium::area::GeomAssembler assembler{area_config};
+    auto &cache = way_cache();
+    if (!cache.has_area) {
+        osmium::area::AssemblerConfig area_config;
+        area_config.ignore_invalid_locations = true;
+        osmium::area::GeomAssembler assembler{area_config};
+
+        if (assembler(way, cache.area)) {
+            project_rings(cache.area.get<osmium::Area>(0), &cache.ring_coords);
+        } else {
+            cache.area.clear();
+        }
+        cache.has_area = true;
+    }
 
-    m_buffer.clear();
-    if (!assembler(way, m_buffer)) {
+    if (cache.area.committed() == 0) {
         return wkb_t();
     }
 
-    auto wkbs = create_polygons(m_buffer.get<osmium::Area>(0));
+    auto wkbs =
+        create_polygons(cache.area.get<osmium::Area>(0), cache.ring_coords);
 
     return wkbs.empty() ? wkb_t() : wkbs[0];
 }
@@ -157,10 +224,13 @@ osmium_builder_t::get_wkb_multipolygon(osmium::Relation const &rel,
 
     m_buffer.clear();
     if (assembler(rel, ways, m_buffer)) {
+        auto const &area = m_buffer.get<osmium::Area>(0);
+        m_coords.clear();
+        project_rings(area, &m_coords);
         if (m_build_multigeoms) {
-            ret.push_back(create_multipolygon(m_buffer.get<osmium::Area>(0)));
+            ret.push_back(create_multipolygon(area, m_coords));
         } else {
-            ret = create_polygons(m_buffer.get<osmium::Area>(0));
+            ret = create_polygons(area, m_coords);
         }
     }
 
@@ -326,28 +396,59 @@ osmium_builder_t::get_wkb_multiline(osmium::memory::Buffer const &ways,
     return ret;
 }
 
-size_t osmium_builder_t::add_mp_points(const osmium::NodeRefList &nodes)
+void osmium_builder_t::project_rings(osmium::Area const &area,
+                                     coords_t *out) const
+{
+    for (auto const &item : area) {
+        if (item.type() == osmium::item_type::outer_ring ||
+            item.type() == osmium::item_type::inner_ring) {
+            m_proj->reproject(static_cast<osmium::NodeRefList const &>(item),
+                              out);
+        }
+    }
+}
+
+size_t osmium_builder_t::add_mp_points(const osmium::NodeRefList &nodes,
+                                       coords_t::const_iterator *coords)
 {
+    // there is one coordinate for each node with a valid location
     size_t num_points = 0;
+    auto &coord = *coords;
     osmium::Location last_location;
     for (const osmium::NodeRef &node_ref : nodes) {
-        if (node_ref.location().valid() &&
-            last_location != node_ref.location()) {
+        if (!node_ref.location().valid()) {
+            continue;
+        }
+        if (last_location != node_ref.location()) {
             last_location = node_ref.location();
-            m_writer.add_location(m_proj->reproject(last_location));
+            m_writer.add_location(*coord);
+            if (m_expire) {
+                m_expire_points.push_back(*coord);
+            }
             ++num_points;
         }
+        ++coord;
     }
 
     return num_points;
 }
 
+void osmium_builder_t::expire_polygon()
+{
+    if (m_expire) {
+        m_expire->from_polygon(m_expire_points, m_expire_rings, m_expire_id);
+    }
+    m_expire_points.clear();
+    m_expire_rings.clear();
+}
+
 osmium_builder_t::wkb_t
-osmium_builder_t::create_multipolygon(osmium::Area const &area)
+osmium_builder_t::create_multipolygon(osmium::Area const &area,
+                                      coords_t const &coords)
 {
     wkb_t ret;
 
-    auto polys = create_polygons(area);
+    auto polys = create_polygons(area, coords);
 
     switch (polys.size()) {
     case 0:
@@ -368,9 +469,14 @@ osmium_builder_t::create_multipolygon(osmium::Area const &area)
 }
 
 osmium_builder_t::wkbs_t
-osmium_builder_t::create_polygons(osmium::Area const &area)
+osmium_builder_t::create_polygons(osmium::Area const &area,
+                                  coords_t const &coords)
 {
     wkbs_t ret;
+    auto coord = coords.cbegin();
+
+    m_expire_points.clear();
+    m_expire_rings.clear();
 
     try {
         size_t num_rings = 0;
@@ -380,18 +486,21 @@ osmium_builder_t::create_polygons(osmium::Area const &area)
                 auto &ring = static_cast<const osmium::OuterRing &>(*it);
                 if (num_rings > 0) {
                     ret.push_back(m_writer.polygon_finish(num_rings));
+                    expire_polygon();
                     num_rings = 0;
                 }
                 m_writer.polygon_start();
                 m_writer.polygon_ring_start();
-                auto num_points = add_mp_points(ring);
+                auto num_points = add_mp_points(ring, &coord);
                 m_writer.polygon_ring_finish(num_points);
+                m_expire_rings.push_back(num_points);
                 ++num_rings;
             } else if (it->type() == osmium::item_type::inner_ring) {
                 auto &ring = static_cast<const osmium::InnerRing &>(*it);
                 m_writer.polygon_ring_start();
-                auto num_points = add_mp_points(ring);
+                auto num_points = add_mp_points(ring, &coord);
                 m_writer.polygon_ring_finish(num_points);
+                m_expire_rings.push_back(num_points);
                 ++num_rings;
             }
         }
@@ -399,6 +508,7 @@ osmium_builder_t::create_polygons(osmium::Area const &area)
         auto wkb = m_writer.polygon_finish(num_rings);
         if (num_rings > 0) {
             ret.push_back(wkb);
+            expire_polygon();
         }
 
     } catch (const osmium::geometry_error &) { /* ignored */
@@ -1,6 +1,7 @@
 #ifndef OSMIUM_BUILDER_H
 #define OSMIUM_BUILDER_H
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -8,24 +9,101 @@
 #include <osmium/memory/buffer.hpp>
 #include <osmium/osm.hpp>
 
+#include "osmtypes.hpp"
 #include "reprojection.hpp"
 #include "wkb.hpp"
 
+struct expire_tiles;
+
 namespace geom {
 
+/**
+ * Projected nodes and assembled area of one way.
+ *
+ * With multi-table styles the same way is handed to several outputs, each
+ * with its own builder, one after the other. Builders sharing a cache
+ * project and assemble it only once. Which way is in the cache is decided
+ * by the outputs through osmium_builder_t::set_way(), with the counter
+ * here for the generation of the data. A cache must only be used by one
+ * thread.
+ */
+class way_cache_t
+{
+public:
+    way_cache_t() : area(1024, osmium::memory::Buffer::auto_grow::yes) {}
+
+    /// Make sure the cache is for the given projection, way and generation.
+    void use(std::shared_ptr<reprojection> const &proj, osmid_t id,
+             uint64_t generation);
+
+    /// Forget the cached way.
+    void clear();
+
+    /// Current generation of the data for set_way().
+    uint64_t generation() const { return m_generation; }
+
+    /// The nodes of ways or their locations may have changed.
+    void next_generation() { ++m_generation; }
+
+    /// projected valid locations of the nodes
+    bool has_coords = false;
+    std::vector<osmium::geom::Coordinates> coords;
+
+    /// assembled area (empty buffer if assembly failed)
+    bool has_area = false;
+    osmium::memory::Buffer area;
+    /// projected points of all rings of the area
+    std::vector<osmium::geom::Coordinates> ring_coords;
+
+private:
+    std::shared_ptr<reprojection> m_proj;
+    osmid_t m_id = 0;
+    uint64_t m_way_generation = 0;
+    uint64_t m_generation = 1;
+};
+
 class osmium_builder_t
 {
 public:
     typedef std::string wkb_t;
     typedef std::vector<std::string> wkbs_t;
+    typedef std::vector<osmium::geom::Coordinates> coords_t;
 
-    explicit osmium_builder_t(std::shared_ptr<reprojection> const &proj,
-                              bool build_multigeoms)
+    /**
+     * \param way_cache Cache for the way geometries, shared with the
+     *                  builders of other outputs. Nothing is cached without
+     *                  one.
+     */
+    explicit osmium_builder_t(
+        std::shared_ptr<reprojection> const &proj, bool build_multigeoms,
+        std::shared_ptr<way_cache_t> const &way_cache = nullptr)
     : m_proj(proj), m_buffer(1024, osmium::memory::Buffer::auto_grow::yes),
-      m_writer(m_proj->target_srs()), m_build_multigeoms(build_multigeoms)
+      m_writer(m_proj->target_srs()), m_build_multigeoms(build_multigeoms),
+      m_way_cache(way_cache)
+    {
+    }
+
+    /**
+     * The ways built from now on are the way with the given id as it is
+     * in the given generation, so their geometries may be taken from the
+     * way cache. An id of 0 turns the cache off.
+     */
+    void set_way(osmid_t id, uint64_t generation)
     {
+        m_way_id = id;
+        m_way_generation = generation;
     }
 
+    /**
+     * Report the tiles touched by all geometries built from now on to
+     * `expire`, or stop reporting when it is nullptr. `id` is only used
+     * in diagnostic messages.
+     *
+     * Expiry is computed from the projected coordinates while the WKB is
+     * written, which saves parsing the result again.
+     */
+    void set_expire(expire_tiles *expire, osmid_t id);
+
     wkb_t get_wkb_node(osmium::Location const &loc) const;
     wkbs_t get_wkb_line(osmium::WayNodeList const &way, double split_at);
     wkb_t get_wkb_polygon(osmium::Way const &way);
@@ -35,15 +113,38 @@ public:
     wkbs_t get_wkb_multiline(osmium::memory::Buffer const &ways, double split_at);
 
 private:
-    wkb_t create_multipolygon(osmium::Area const &area);
-    wkbs_t create_polygons(osmium::Area const &area);
-    size_t add_mp_points(const osmium::NodeRefList &nodes);
+    /// Project the points of all rings of an area in ring order.
+    void project_rings(osmium::Area const &area, coords_t *out) const;
+
+    // `coords` are the projected rings as returned by project_rings()
+    wkb_t create_multipolygon(osmium::Area const &area, coords_t const &coords);
+    wkbs_t create_polygons(osmium::Area const &area, coords_t const &coords);
+    size_t add_mp_points(const osmium::NodeRefList &nodes,
+                         coords_t::const_iterator *coords);
+    void expire_polygon();
+
+    /// The way cache for the current way or an emptied scratch one.
+    way_cache_t &way_cache();
 
     std::shared_ptr<reprojection> m_proj;
-    // internal buffer for creating areas
+    // internal buffer for creating multipolygons and multilines
     osmium::memory::Buffer m_buffer;
     ewkb::writer_t m_writer;
+    // scratch space for projected multipolygon rings
+    coords_t m_coords;
+
+    expire_tiles *m_expire = nullptr;
+    osmid_t m_expire_id = 0;
+    // points and ring sizes of the polygon being built, for m_expire
+    std::vector<osmium::geom::Coordinates> m_expire_points;
+    std::vector<size_t> m_expire_rings;
     bool m_build_multigeoms;
+
+    std::shared_ptr<way_cache_t> m_way_cache;
+    osmid_t m_way_id = 0;
+    uint64_t m_way_generation = 0;
+    // used instead of m_way_cache when there is no current way
+    way_cache_t m_scratch;
 };
 
 } // namespace
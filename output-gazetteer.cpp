@@ -3,6 +3,7 @@
 #include <boost/format.hpp>
 
 #include "middle.hpp"
+#include "number-format.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
 #include "output-gazetteer.hpp"
@@ -49,6 +50,265 @@ struct UnnamedPredicate
     }
 };
 
+namespace {
+
+/// What process_tags() does with a tag, decided by its key alone.
+enum class key_class : char
+{
+    other,
+    ignore,
+    extratag,
+    ref,
+    name,
+    housename,
+    emergency,
+    place_unless_yes_no, // tourism, historic, military
+    natural,
+    landuse,
+    highway,
+    railway,
+    man_made,
+    aerialway,
+    boundary,
+    place_unless_no, // amenity, shop, ...
+    waterway,
+    place,
+    junction,
+    postcode,
+    country,
+    address,
+    is_in,
+    is_in_exact,
+    admin_level,
+    building
+};
+
+struct key_rule_t
+{
+    char const *key;
+    key_class cls;
+};
+
+/**
+ * Keys with a fixed meaning, sorted by key for binary search. This and
+ * the prefix list below used to be one long if-else chain; the order of
+ * the checks in process_tags() keeps the result identical.
+ */
+constexpr key_rule_t exact_keys[] = {
+    {"ISO3166-1", key_class::country},
+    {"access", key_class::extratag},
+    {"addr:country", key_class::country},
+    {"addr:country_code", key_class::country},
+    {"addr:housename", key_class::housename},
+    {"addr:postcode", key_class::postcode},
+    {"admin_level", key_class::admin_level},
+    {"aerialway", key_class::aerialway},
+    {"aeroway", key_class::place_unless_no},
+    {"alt_name", key_class::name},
+    {"amenity", key_class::place_unless_no},
+    {"attribution", key_class::extratag},
+    {"bicyle", key_class::extratag},
+    {"boundary", key_class::boundary},
+    {"brand", key_class::name},
+    {"brewery", key_class::extratag},
+    {"bridge", key_class::place_unless_no},
+    {"building", key_class::building},
+    {"camera", key_class::extratag},
+    {"capital", key_class::extratag},
+    {"charge", key_class::extratag},
+    {"club", key_class::place_unless_no},
+    {"collection_times", key_class::extratag},
+    {"country_code", key_class::country},
+    {"craft", key_class::place_unless_no},
+    {"cuisine", key_class::extratag},
+    {"date_off", key_class::extratag},
+    {"date_on", key_class::extratag},
+    {"day_off", key_class::extratag},
+    {"day_on", key_class::extratag},
+    {"denomination", key_class::extratag},
+    {"description", key_class::extratag},
+    {"dispensing", key_class::extratag},
+    {"disused", key_class::extratag},
+    {"drive_in", key_class::extratag},
+    {"drive_through", key_class::extratag},
+    {"email", key_class::extratag},
+    {"emergency", key_class::emergency},
+    {"est_width", key_class::extratag},
+    {"fax", key_class::extratag},
+    {"fee", key_class::extratag},
+    {"food", key_class::extratag},
+    {"foot", key_class::extratag},
+    {"goods", key_class::extratag},
+    {"hgv", key_class::extratag},
+    {"highway", key_class::highway},
+    {"historic", key_class::place_unless_yes_no},
+    {"hour_off", key_class::extratag},
+    {"hour_on", key_class::extratag},
+    {"iata", key_class::ref},
+    {"icao", key_class::ref},
+    {"image", key_class::extratag},
+    {"incline", key_class::extratag},
+    {"int_name", key_class::name},
+    {"int_ref", key_class::ref},
+    {"internet_access", key_class::extratag},
+    {"is_in", key_class::is_in_exact},
+    {"is_in:country", key_class::country},
+    {"is_in:country_code", key_class::country},
+    {"junction", key_class::junction},
+    {"landuse", key_class::landuse},
+    {"lanes", key_class::extratag},
+    {"leisure", key_class::place_unless_no},
+    {"loc_name", key_class::name},
+    {"loc_ref", key_class::ref},
+    {"locality", key_class::extratag},
+    {"man_made", key_class::man_made},
+    {"maxheight", key_class::extratag},
+    {"maxspeed", key_class::extratag},
+    {"maxweight", key_class::extratag},
+    {"military", key_class::place_unless_yes_no},
+    {"motor_car", key_class::extratag},
+    {"motor_vehicle", key_class::extratag},
+    {"mountain_pass", key_class::place_unless_no},
+    {"mtb:description", key_class::extratag},
+    {"mtb:scale", key_class::extratag},
+    {"name", key_class::name},
+    {"name:botanical", key_class::extratag},
+    {"name:prefix", key_class::extratag},
+    {"name:suffix", key_class::extratag},
+    {"nat_name", key_class::name},
+    {"nat_ref", key_class::ref},
+    {"natural", key_class::natural},
+    {"office", key_class::place_unless_no},
+    {"official_name", key_class::name},
+    {"old_name", key_class::name},
+    {"old_ref", key_class::ref},
+    {"oneway", key_class::extratag},
+    {"opening_hours", key_class::extratag},
+    {"operator", key_class::ref},
+    {"pcode", key_class::ref},
+    {"phone", key_class::extratag},
+    {"place", key_class::place},
+    {"place_name", key_class::name},
+    {"population", key_class::extratag},
+    {"postal_code", key_class::postcode},
+    {"postcode", key_class::postcode},
+    {"railway", key_class::railway},
+    {"real_ale", key_class::extratag},
+    {"ref", key_class::ref},
+    {"reg_name", key_class::name},
+    {"reg_ref", key_class::ref},
+    {"religion", key_class::extratag},
+    {"sac_scale", key_class::extratag},
+    {"service", key_class::extratag},
+    {"service_times", key_class::extratag},
+    {"shop", key_class::place_unless_no},
+    {"short_name", key_class::name},
+    {"smoking", key_class::extratag},
+    {"smoothness", key_class::extratag},
+    {"sport", key_class::extratag},
+    {"surface", key_class::extratag},
+    {"tiger:county", key_class::is_in_exact},
+    {"tiger:zip_left", key_class::postcode},
+    {"tiger:zip_right", key_class::postcode},
+    {"toll", key_class::extratag},
+    {"tourism", key_class::place_unless_yes_no},
+    {"tracktype", key_class::extratag},
+    {"traffic_calming", key_class::extratag},
+    {"trail_visibility", key_class::extratag},
+    {"tunnel", key_class::place_unless_no},
+    {"url", key_class::extratag},
+    {"vehicle", key_class::extratag},
+    {"waterway", key_class::waterway},
+    {"website", key_class::extratag},
+    {"wheelchair", key_class::extratag},
+    {"width", key_class::extratag},
+    {"wikipedia", key_class::extratag},
+    {"wood", key_class::extratag}};
+
+/// Compile-time strcmp(a, b) < 0.
+constexpr bool key_less(char const *a, char const *b)
+{
+    return *a != *b ? static_cast<unsigned char>(*a) <
+                          static_cast<unsigned char>(*b)
+                    : *a != '\0' && key_less(a + 1, b + 1);
+}
+
+constexpr bool keys_sorted(key_rule_t const *rules, size_t count)
+{
+    return count < 2 ||
+           (key_less(rules[0].key, rules[1].key) &&
+            keys_sorted(rules + 1, count - 1));
+}
+
+static_assert(keys_sorted(exact_keys,
+                          sizeof(exact_keys) / sizeof(exact_keys[0])),
+              "exact_keys must be sorted for the binary search");
+
+/// Key prefixes, checked in this order when there is no exact match.
+key_rule_t const prefix_keys[] = {
+    {"pcode:", key_class::ref},
+    {"name:", key_class::name},
+    {"int_name:", key_class::name},
+    {"nat_name:", key_class::name},
+    {"reg_name:", key_class::name},
+    {"loc_name:", key_class::name},
+    {"old_name:", key_class::name},
+    {"alt_name:", key_class::name},
+    {"alt_name_", key_class::name},
+    {"official_name:", key_class::name},
+    {"place_name:", key_class::name},
+    {"short_name:", key_class::name},
+    {"addr:", key_class::address},
+    {"is_in:", key_class::is_in},
+    {"access:", key_class::extratag},
+    {"contact:", key_class::extratag},
+    {"drink:", key_class::extratag},
+    {"toll:", key_class::extratag},
+    {"wikipedia:", key_class::extratag}};
+
+bool ends_with(char const *str, size_t len, char const *suffix,
+               size_t suffix_len)
+{
+    return len >= suffix_len &&
+           memcmp(str + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+key_class classify_key(char const *k)
+{
+    size_t const len = strlen(k);
+
+    if (ends_with(k, len, "source", 6)) {
+        return key_class::ignore;
+    }
+    if (ends_with(k, len, "wikidata", 8)) {
+        return key_class::extratag;
+    }
+
+    auto const *end = exact_keys + sizeof(exact_keys) / sizeof(exact_keys[0]);
+    auto const *rule = std::lower_bound(
+        exact_keys, end, k, [](key_rule_t const &r, char const *key) {
+            return strcmp(r.key, key) < 0;
+        });
+    if (rule != end && strcmp(rule->key, k) == 0) {
+        return rule->cls;
+    }
+
+    for (auto const &prefix : prefix_keys) {
+        if (strncmp(k, prefix.key, strlen(prefix.key)) == 0) {
+            return prefix.cls;
+        }
+    }
+
+    return key_class::other;
+}
+
+bool is_yes_or_no(char const *v)
+{
+    return strcmp(v, "no") == 0 || strcmp(v, "yes") == 0;
+}
+
+} // anonymous namespace
+
 void place_tag_processor::process_tags(osmium::OSMObject const &o)
 {
     bool placeadmin = false;
@@ -65,73 +325,43 @@ void place_tag_processor::process_tags(osmium::OSMObject const &o)
     for (const auto &item: o.tags()) {
         char const *k = item.key();
         char const *v = item.value();
-        if (boost::ends_with(k, "source")) {
-            // ignore
-        } else if (strcmp(k, "name:prefix") == 0 ||
-                   strcmp(k, "name:suffix") == 0 ||
-                   strcmp(k, "name:botanical") == 0 ||
-                   boost::ends_with(k, "wikidata")) {
+        switch (classify_key(k)) {
+        case key_class::other:
+        case key_class::ignore:
+            break;
+        case key_class::extratag:
             extratags.push_back(&item);
-        } else if (strcmp(k, "ref") == 0 ||
-                   strcmp(k, "int_ref") == 0 ||
-                   strcmp(k, "nat_ref") == 0 ||
-                   strcmp(k, "reg_ref") == 0 ||
-                   strcmp(k, "loc_ref") == 0 ||
-                   strcmp(k, "old_ref") == 0 ||
-                   strcmp(k, "iata") == 0 ||
-                   strcmp(k, "icao") == 0 ||
-                   strcmp(k, "operator") == 0 ||
-                   strcmp(k, "pcode") == 0 ||
-                   boost::starts_with(k, "pcode:")) {
+            break;
+        case key_class::ref:
             names.push_back(&item);
-        } else if (strcmp(k, "name") == 0 ||
-                   boost::starts_with(k, "name:") ||
-                   strcmp(k, "int_name") == 0 ||
-                   boost::starts_with(k, "int_name:") ||
-                   strcmp(k, "nat_name") == 0 ||
-                   boost::starts_with(k, "nat_name:") ||
-                   strcmp(k, "reg_name") == 0 ||
-                   boost::starts_with(k, "reg_name:") ||
-                   strcmp(k, "loc_name") == 0 ||
-                   boost::starts_with(k, "loc_name:") ||
-                   strcmp(k, "old_name") == 0 ||
-                   boost::starts_with(k, "old_name:") ||
-                   strcmp(k, "alt_name") == 0 ||
-                   boost::starts_with(k, "alt_name:") ||
-                   boost::starts_with(k, "alt_name_") ||
-                   strcmp(k, "official_name") == 0 ||
-                   boost::starts_with(k, "official_name:") ||
-                   strcmp(k, "place_name") == 0 ||
-                   boost::starts_with(k, "place_name:") ||
-                   strcmp(k, "short_name") == 0 ||
-                   boost::starts_with(k, "short_name:") ||
-                   strcmp(k, "brand") == 0) {
+            break;
+        case key_class::name:
             names.push_back(&item);
             isnamed = true;
-        } else if (strcmp(k, "addr:housename") == 0) {
+            break;
+        case key_class::housename:
             names.push_back(&item);
             placehouse = true;
-        } else if (strcmp(k, "emergency") == 0) {
-            if (strcmp(v, "fire_hydrant") != 0 &&
-                strcmp(v, "yes") != 0 &&
-                strcmp(v, "no") != 0)
+            break;
+        case key_class::emergency:
+            if (strcmp(v, "fire_hydrant") != 0 && !is_yes_or_no(v))
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "tourism") == 0 ||
-                   strcmp(k, "historic") == 0 ||
-                   strcmp(k, "military") == 0) {
-            if (strcmp(v, "no") != 0 && strcmp(v, "yes") != 0)
+            break;
+        case key_class::place_unless_yes_no:
+            if (!is_yes_or_no(v))
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "natural") == 0) {
-            if (strcmp(v, "no") != 0 &&
-                strcmp(v, "yes") != 0 &&
-                strcmp(v, "coastline") != 0)
+            break;
+        case key_class::natural:
+            if (!is_yes_or_no(v) && strcmp(v, "coastline") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "landuse") == 0) {
+            break;
+        case key_class::landuse:
             if (strcmp(v, "cemetry") == 0)
                 places.emplace_back(k, v);
             else
                 landuse = &item;
-        } else if (strcmp(k, "highway") == 0) {
+            break;
+        case key_class::highway:
             if (strcmp(v, "footway") == 0) {
                 auto *footway = o.tags()["footway"];
                 if (footway == nullptr || strcmp(footway, "sidewalk") != 0)
@@ -142,62 +372,52 @@ void place_tag_processor::process_tags(osmium::OSMObject const &o)
                 strcmp(v, "noexit") != 0 &&
                 strcmp(v, "crossing") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "railway") == 0) {
+            break;
+        case key_class::railway:
             if (strcmp(v, "level_crossing") != 0 &&
                 strcmp(v, "no") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "man_made") == 0) {
+            break;
+        case key_class::man_made:
             if (strcmp(v, "survey_point") != 0 &&
                 strcmp(v, "cutline") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "aerialway") == 0) {
+            break;
+        case key_class::aerialway:
             if (strcmp(v, "pylon") != 0 &&
                 strcmp(v, "no") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "boundary") == 0) {
+            break;
+        case key_class::boundary:
             if (strcmp(v, "administrative") == 0)
                 placeadmin = true;
             places.emplace_back(k, v);
-        } else if (strcmp(k, "aeroway") == 0 ||
-                   strcmp(k, "amenity") == 0 ||
-                   strcmp(k, "club") == 0 ||
-                   strcmp(k, "boundary") == 0 ||
-                   strcmp(k, "bridge") == 0 ||
-                   strcmp(k, "craft") == 0 ||
-                   strcmp(k, "leisure") == 0 ||
-                   strcmp(k, "office") == 0 ||
-                   strcmp(k, "shop") == 0 ||
-                   strcmp(k, "tunnel") == 0 ||
-                   strcmp(k, "mountain_pass") == 0) {
+            break;
+        case key_class::place_unless_no:
             if (strcmp(v, "no") != 0)
-            {
                 places.emplace_back(k, v);
-            }
-        } else if (strcmp(k, "waterway") == 0) {
+            break;
+        case key_class::waterway:
             if (strcmp(v, "riverbank") != 0)
                 places.emplace_back(k, v);
-        } else if (strcmp(k, "place") == 0) {
+            break;
+        case key_class::place:
             place = &item;
-        } else if (strcmp(k, "junction") == 0) {
+            break;
+        case key_class::junction:
             junction = &item;
-        } else if (strcmp(k, "postal_code") == 0 ||
-                   strcmp(k, "postcode") == 0 ||
-                   strcmp(k, "addr:postcode") == 0 ||
-                   strcmp(k, "tiger:zip_left") == 0 ||
-                   strcmp(k, "tiger:zip_right") == 0) {
+            break;
+        case key_class::postcode:
             if (address.find("postcode") == address.end()) {
                 address.emplace("postcode", v);
             }
-        } else if (strcmp(k, "country_code") == 0 ||
-                   strcmp(k, "ISO3166-1") == 0 ||
-                   strcmp(k, "is_in:country_code") == 0 ||
-                   strcmp(k, "is_in:country") == 0 ||
-                   strcmp(k, "addr:country") == 0 ||
-                   strcmp(k, "addr:country_code") == 0) {
+            break;
+        case key_class::country:
             if (strlen(v) == 2 && address.find("country") == address.end()) {
                 address.emplace("country", v);
             }
-        } else if (boost::starts_with(k, "addr:")) {
+            break;
+        case key_class::address:
             if (strcmp(k, "addr:interpolation") == 0) {
                 isinterpolation = true;
             }
@@ -207,90 +427,23 @@ void place_tag_processor::process_tags(osmium::OSMObject const &o)
                 placehouse = true;
             }
             address.emplace(k + 5, v);
-        } else if (boost::starts_with(k, "is_in:")) {
+            break;
+        case key_class::is_in:
             if (address.find(k + 6) == address.end()) {
                 address.emplace(k + 6, v);
             }
-        } else if (strcmp(k, "is_in") == 0 ||
-                   strcmp(k, "tiger:county") == 0) {
+            break;
+        case key_class::is_in_exact:
             address.emplace(k, v);
-        } else if (strcmp(k, "admin_level") == 0) {
+            break;
+        case key_class::admin_level:
             admin_level = atoi(v);
             if (admin_level <= 0 || admin_level > MAX_ADMINLEVEL)
                 admin_level = MAX_ADMINLEVEL;
-        } else if (strcmp(k, "tracktype") == 0 ||
-                   strcmp(k, "traffic_calming") == 0 ||
-                   strcmp(k, "service") == 0 ||
-                   strcmp(k, "cuisine") == 0 ||
-                   strcmp(k, "capital") == 0 ||
-                   strcmp(k, "dispensing") == 0 ||
-                   strcmp(k, "religion") == 0 ||
-                   strcmp(k, "denomination") == 0 ||
-                   strcmp(k, "sport") == 0 ||
-                   strcmp(k, "internet_access") == 0 ||
-                   strcmp(k, "lanes") == 0 ||
-                   strcmp(k, "surface") == 0 ||
-                   strcmp(k, "smoothness") == 0 ||
-                   strcmp(k, "width") == 0 ||
-                   strcmp(k, "est_width") == 0 ||
-                   strcmp(k, "incline") == 0 ||
-                   strcmp(k, "opening_hours") == 0 ||
-                   strcmp(k, "collection_times") == 0 ||
-                   strcmp(k, "service_times") == 0 ||
-                   strcmp(k, "disused") == 0 ||
-                   strcmp(k, "wheelchair") == 0 ||
-                   strcmp(k, "sac_scale") == 0 ||
-                   strcmp(k, "trail_visibility") == 0 ||
-                   strcmp(k, "mtb:scale") == 0 ||
-                   strcmp(k, "mtb:description") == 0 ||
-                   strcmp(k, "wood") == 0 ||
-                   strcmp(k, "drive_through") == 0 ||
-                   strcmp(k, "drive_in") == 0 ||
-                   strcmp(k, "access") == 0 ||
-                   strcmp(k, "vehicle") == 0 ||
-                   strcmp(k, "bicyle") == 0 ||
-                   strcmp(k, "foot") == 0 ||
-                   strcmp(k, "goods") == 0 ||
-                   strcmp(k, "hgv") == 0 ||
-                   strcmp(k, "motor_vehicle") == 0 ||
-                   strcmp(k, "motor_car") == 0 ||
-                   boost::starts_with(k, "access:") ||
-                   boost::starts_with(k, "contact:") ||
-                   boost::starts_with(k, "drink:") ||
-                   strcmp(k, "oneway") == 0 ||
-                   strcmp(k, "date_on") == 0 ||
-                   strcmp(k, "date_off") == 0 ||
-                   strcmp(k, "day_on") == 0 ||
-                   strcmp(k, "day_off") == 0 ||
-                   strcmp(k, "hour_on") == 0 ||
-                   strcmp(k, "hour_off") == 0 ||
-                   strcmp(k, "maxweight") == 0 ||
-                   strcmp(k, "maxheight") == 0 ||
-                   strcmp(k, "maxspeed") == 0 ||
-                   strcmp(k, "fee") == 0 ||
-                   strcmp(k, "toll") == 0 ||
-                   boost::starts_with(k, "toll:") ||
-                   strcmp(k, "charge") == 0 ||
-                   strcmp(k, "population") == 0 ||
-                   strcmp(k, "description") == 0 ||
-                   strcmp(k, "image") == 0 ||
-                   strcmp(k, "attribution") == 0 ||
-                   strcmp(k, "fax") == 0 ||
-                   strcmp(k, "email") == 0 ||
-                   strcmp(k, "url") == 0 ||
-                   strcmp(k, "website") == 0 ||
-                   strcmp(k, "phone") == 0 ||
-                   strcmp(k, "real_ale") == 0 ||
-                   strcmp(k, "smoking") == 0 ||
-                   strcmp(k, "food") == 0 ||
-                   strcmp(k, "camera") == 0 ||
-                   strcmp(k, "brewery") == 0 ||
-                   strcmp(k, "locality") == 0 ||
-                   strcmp(k, "wikipedia") == 0 ||
-                   boost::starts_with(k, "wikipedia:")) {
-            extratags.push_back(&item);
-        } else if (strcmp(k, "building") == 0) {
+            break;
+        case key_class::building:
             placebuilding = true;
+            break;
         }
     }
 
@@ -350,7 +503,8 @@ void place_tag_processor::copy_out(osmium::OSMObject const &o,
         buffer += (char) toupper(osmium::item_type_to_char(o.type()));
         buffer += '\t';
         // osm_id
-        buffer += (single_fmt % o.id()).str();
+        util::append_int(buffer, o.id());
+        buffer += '\t';
         // class
         escape(place.key, buffer);
         buffer += '\t';
@@ -389,7 +543,8 @@ void place_tag_processor::copy_out(osmium::OSMObject const &o,
         } else
             buffer += "\\N\t";
         // admin_level
-        buffer += (single_fmt % admin_level).str();
+        util::append_int(buffer, admin_level);
+        buffer += '\t';
         // address
         if (address.empty()) {
             buffer += "\\N\t";
@@ -441,9 +596,10 @@ void output_gazetteer_t::stop_copy(void)
 
     if (buffer.length() > 0)
     {
-        pgsql_CopyData("place", Connection, buffer);
+        m_copy->buffer() += buffer;
         buffer.clear();
     }
+    m_copy->finish(Connection);
 
     /* Terminate the copy */
     if (PQputCopyEnd(Connection, nullptr) != 1)
@@ -465,45 +621,136 @@ void output_gazetteer_t::stop_copy(void)
 
 
 
-void output_gazetteer_t::delete_unused_classes(char osm_type, osmid_t osm_id) {
-    char tmp2[2];
-    tmp2[0] = osm_type; tmp2[1] = '\0';
-    char const *paramValues[2];
-    paramValues[0] = tmp2;
-    paramValues[1] = (single_fmt % osm_id).str().c_str();
-    auto res = pgsql_execPrepared(ConnectionDelete, "get_classes", 2,
-                                  paramValues, PGRES_TUPLES_OK);
-
-    int sz = PQntuples(res.get());
-    if (sz > 0 && !places.has_data()) {
-        /* unconditional delete of all places */
-        delete_place(osm_type, osm_id);
-    } else {
-        std::string clslist;
-        for (int i = 0; i < sz; i++) {
-            std::string cls(PQgetvalue(res.get(), i, 0));
-            if (!places.has_place(cls)) {
-                clslist.reserve(clslist.length() + cls.length() + 3);
-                if (!clslist.empty())
-                    clslist += ',';
-                clslist += '\'';
-                clslist += cls;
-                clslist += '\'';
+void output_gazetteer_t::delete_unused_classes(char osm_type, osmid_t osm_id)
+{
+    // The deletes of an object must not overtake a newer version of it.
+    if (!m_pending_objects.insert(std::make_pair(osm_type, osm_id)).second) {
+        flush_unused_classes();
+        m_pending_objects.insert(std::make_pair(osm_type, osm_id));
+    }
+
+    m_pending_classes.push_back(
+        pending_classes_t{osm_type, osm_id, places.has_data(), places.classes()});
+
+    if (m_pending_classes.size() >= PENDING_CLASSES_SIZE) {
+        flush_unused_classes();
+    }
+}
+
+/**
+ * Look up the classes in the database for all collected objects and
+ * delete those that the objects do not have anymore. This needs one
+ * query per object type plus at most three deletes for the whole batch,
+ * and the COPY is only interrupted once.
+ */
+void output_gazetteer_t::flush_unused_classes()
+{
+    if (m_pending_classes.empty()) {
+        return;
+    }
+
+    char const types[3] = {'N', 'W', 'R'};
+
+    std::map<std::pair<char, osmid_t>, std::vector<std::string>> db_classes;
+    for (char const osm_type : types) {
+        std::string ids("{");
+        for (auto const &p : m_pending_classes) {
+            if (p.osm_type == osm_type) {
+                util::append_int(ids, p.osm_id);
+                ids += ',';
+            }
+        }
+        if (ids.size() == 1) {
+            continue;
+        }
+        ids[ids.size() - 1] = '}';
+
+        char const type[2] = {osm_type, '\0'};
+        char const *paramValues[2] = {type, ids.c_str()};
+        auto res = pgsql_execPrepared(ConnectionDelete, "get_class_list", 2,
+                                      paramValues, PGRES_TUPLES_OK);
+        int const sz = PQntuples(res.get());
+        for (int i = 0; i < sz; ++i) {
+            db_classes[std::make_pair(
+                           osm_type,
+                           strtoosmid(PQgetvalue(res.get(), i, 0), nullptr, 10))]
+                .emplace_back(PQgetvalue(res.get(), i, 1));
+        }
+    }
+
+    // objects where all places are deleted, per type
+    std::string delete_all[3];
+    // (osm_type, osm_id, class) of single classes to delete
+    std::string delete_classes;
+
+    for (auto const &p : m_pending_classes) {
+        auto const cls = db_classes.find(std::make_pair(p.osm_type, p.osm_id));
+        if (cls == db_classes.end()) {
+            continue;
+        }
+
+        if (!p.has_data) {
+            auto &ids = delete_all[std::find(types, types + 3, p.osm_type) - types];
+            ids += ids.empty() ? "" : ",";
+            util::append_int(ids, p.osm_id);
+            continue;
+        }
+
+        for (auto const &c : cls->second) {
+            if (std::find(p.classes.begin(), p.classes.end(), c) !=
+                p.classes.end()) {
+                continue;
             }
+
+            // the place connection may be busy with COPY data
+            char *literal =
+                PQescapeLiteral(ConnectionDelete, c.c_str(), c.size());
+            if (!literal) {
+                std::cerr << "Escaping class failed: "
+                          << PQerrorMessage(ConnectionDelete) << "\n";
+                util::exit_nicely();
+            }
+            delete_classes += delete_classes.empty() ? "" : ",";
+            delete_classes += (boost::format("('%1%',%2%::%3%,%4%)") %
+                               p.osm_type % p.osm_id % POSTGRES_OSMID_TYPE %
+                               literal)
+                                  .str();
+            PQfreemem(literal);
         }
+    }
 
+    m_pending_classes.clear();
+    m_pending_objects.clear();
 
-        if (!clslist.empty()) {
-           /* Stop any active copy */
-           stop_copy();
+    bool const have_deletes = !delete_classes.empty() ||
+                              !delete_all[0].empty() ||
+                              !delete_all[1].empty() || !delete_all[2].empty();
+    if (!have_deletes) {
+        return;
+    }
 
-           /* Delete all places for this object */
-           pgsql_exec(Connection, PGRES_COMMAND_OK,
-                      "DELETE FROM place WHERE osm_type = '%c' AND osm_id = %"
-                       PRIdOSMID " and class = any(ARRAY[%s])",
-                      osm_type, osm_id, clslist.c_str());
+    /* Stop any active copy */
+    stop_copy();
+
+    for (int i = 0; i < 3; ++i) {
+        if (!delete_all[i].empty()) {
+            pgsql_exec_simple(
+                Connection, PGRES_COMMAND_OK,
+                (boost::format("DELETE FROM place WHERE osm_type = '%1%' AND "
+                               "osm_id = ANY('{%2%}'::%3%[])") %
+                 types[i] % delete_all[i] % POSTGRES_OSMID_TYPE)
+                    .str());
         }
     }
+
+    if (!delete_classes.empty()) {
+        pgsql_exec_simple(Connection, PGRES_COMMAND_OK,
+                          "DELETE FROM place p USING (VALUES " +
+                              delete_classes +
+                              ") AS d(osm_type, osm_id, class) "
+                              "WHERE p.osm_type = d.osm_type AND "
+                              "p.osm_id = d.osm_id AND p.class = d.class");
+    }
 }
 
 
@@ -527,6 +774,8 @@ int output_gazetteer_t::connect() {
        std::cerr << "Connection to database failed: " << PQerrorMessage(Connection) << "\n";
        return 1;
     }
+    m_copy.reset(new copy_writer_t("place",
+                                   m_options.copy_buffer_size * 1024 * 1024));
 
     if (m_options.append) {
         ConnectionDelete = PQconnectdb(m_options.database_options.conninfo().c_str());
@@ -536,7 +785,7 @@ int output_gazetteer_t::connect() {
             return 1;
         }
 
-        pgsql_exec(ConnectionDelete, PGRES_COMMAND_OK, "PREPARE get_classes (CHAR(1), " POSTGRES_OSMID_TYPE ") AS SELECT class FROM place WHERE osm_type = $1 and osm_id = $2");
+        pgsql_exec(ConnectionDelete, PGRES_COMMAND_OK, "PREPARE get_class_list (CHAR(1), " POSTGRES_OSMID_TYPE "[]) AS SELECT osm_id, class FROM place WHERE osm_type = $1 and osm_id = ANY($2)");
     }
     return 0;
 }
@@ -591,6 +840,13 @@ int output_gazetteer_t::start()
 
 void output_gazetteer_t::stop(osmium::thread::Pool *)
 {
+   /* Nothing left to do when resuming an interrupted import */
+   if (!Connection)
+       return;
+
+   /* Delete outdated classes of the last updated objects */
+   flush_unused_classes();
+
    /* Stop any active copy */
    stop_copy();
 
@@ -598,6 +854,7 @@ void output_gazetteer_t::stop(osmium::thread::Pool *)
    pgsql_exec(Connection, PGRES_COMMAND_OK, "COMMIT");
 
 
+   m_copy.reset();
    PQfinish(Connection);
    if (ConnectionDelete)
        PQfinish(ConnectionDelete);
@@ -607,6 +864,15 @@ void output_gazetteer_t::stop(osmium::thread::Pool *)
    return;
 }
 
+void output_gazetteer_t::next_diff(std::string const &)
+{
+    flush_unused_classes();
+    stop_copy();
+
+    pgsql_exec(Connection, PGRES_COMMAND_OK, "COMMIT");
+    pgsql_exec(Connection, PGRES_COMMAND_OK, "BEGIN");
+}
+
 int output_gazetteer_t::process_node(osmium::Node const &node)
 {
     places.process_tags(node);
@@ -695,9 +961,7 @@ int output_gazetteer_t::process_relation(osmium::Relation const &rel)
         return 0;
     }
 
-    for (auto &w : osmium_buffer.select<osmium::Way>()) {
-        m_mid->nodes_get_list(&(w.nodes()));
-    }
+    m_mid->nodes_get_ways(&osmium_buffer);
 
     auto geoms = is_waterway
                      ? m_builder.get_wkb_multiline(osmium_buffer, 0.0)
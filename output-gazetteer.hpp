@@ -1,15 +1,19 @@
 #ifndef OUTPUT_GAZETTEER_H
 #define OUTPUT_GAZETTEER_H
 
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/format.hpp>
 #include <osmium/memory/buffer.hpp>
 
+#include "copy-writer.hpp"
 #include "osmium-builder.hpp"
 #include "osmtypes.hpp"
 #include "output.hpp"
@@ -23,7 +27,6 @@ class place_tag_processor
 {
 public:
     place_tag_processor()
-        : single_fmt("%1%\t")
     {
         places.reserve(4);
         extratags.reserve(15);
@@ -46,6 +49,16 @@ public:
         return false;
     }
 
+    std::vector<std::string> classes() const
+    {
+        std::vector<std::string> ret;
+        for (const auto& item: places) {
+            ret.push_back(item.key);
+        }
+
+        return ret;
+    }
+
     void copy_out(osmium::OSMObject const &o, const std::string &geom,
                   std::string &buffer);
 
@@ -118,8 +131,6 @@ private:
     std::vector<osmium::Tag const *> extratags;
     std::unordered_map<std::string, char const *> address;
     int admin_level;
-
-    boost::format single_fmt;
 };
 
 
@@ -128,7 +139,7 @@ public:
     output_gazetteer_t(const middle_query_t *mid_, const options_t &options_)
     : output_t(mid_, options_), Connection(NULL), ConnectionDelete(NULL),
       ConnectionError(NULL), copy_active(false),
-      m_builder(options_.projection, true), single_fmt("%1%"),
+      m_builder(options_.projection, true),
       osmium_buffer(PLACE_BUFFER_SIZE, osmium::memory::Buffer::auto_grow::yes)
     {
         buffer.reserve(PLACE_BUFFER_SIZE);
@@ -137,7 +148,7 @@ public:
     output_gazetteer_t(const output_gazetteer_t &other)
     : output_t(other.m_mid, other.m_options), Connection(NULL),
       ConnectionDelete(NULL), ConnectionError(NULL), copy_active(false),
-      m_builder(other.m_options.projection, true), single_fmt(other.single_fmt),
+      m_builder(other.m_options.projection, true),
       osmium_buffer(PLACE_BUFFER_SIZE, osmium::memory::Buffer::auto_grow::yes)
     {
         buffer.reserve(PLACE_BUFFER_SIZE);
@@ -156,6 +167,7 @@ public:
     int start() override;
     void stop(osmium::thread::Pool *pool) override;
     void commit() override {}
+    void next_diff(std::string const &expire_file) override;
 
     void enqueue_ways(pending_queue_t &, osmid_t, size_t, size_t&) override {}
     int pending_way(osmid_t, int) override { return 0; }
@@ -213,9 +225,21 @@ public:
 
 private:
     enum { PLACE_BUFFER_SIZE = 4096 };
+    /// number of objects collected before checking their old classes
+    enum { PENDING_CLASSES_SIZE = 1000 };
+
+    /// Object whose outdated classes still need to be deleted.
+    struct pending_classes_t
+    {
+        char osm_type;
+        osmid_t osm_id;
+        bool has_data;
+        std::vector<std::string> classes;
+    };
 
     void stop_copy(void);
     void delete_unused_classes(char osm_type, osmid_t osm_id);
+    void flush_unused_classes();
     void delete_place(char osm_type, osmid_t osm_id);
     int process_node(osmium::Node const &node);
     int process_way(osmium::Way *way);
@@ -232,8 +256,9 @@ private:
             copy_active = true;
         }
 
-        pgsql_CopyData("place", Connection, buffer);
+        m_copy->buffer() += buffer;
         buffer.clear();
+        m_copy->row_done(Connection);
     }
 
     void delete_unused_full(char osm_type, osmid_t osm_id)
@@ -249,16 +274,17 @@ private:
     struct pg_conn *ConnectionError;
 
     bool copy_active;
+    std::unique_ptr<copy_writer_t> m_copy;
 
     std::string buffer;
     place_tag_processor places;
 
     geom::osmium_builder_t m_builder;
 
-    // string formatters
-    // Need to be part of the class, so we have one per thread.
-    boost::format single_fmt;
     osmium::memory::Buffer osmium_buffer;
+
+    std::vector<pending_classes_t> m_pending_classes;
+    std::set<std::pair<char, osmid_t>> m_pending_objects;
 };
 
 #endif
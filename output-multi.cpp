@@ -2,6 +2,7 @@
 #include "expire-tiles.hpp"
 #include "id-tracker.hpp"
 #include "middle.hpp"
+#include "number-format.hpp"
 #include "options.hpp"
 #include "table.hpp"
 #include "taginfo_impl.hpp"
@@ -15,7 +16,8 @@ output_multi_t::output_multi_t(const std::string &name,
                                std::shared_ptr<geometry_processor> processor_,
                                const struct export_list &export_list_,
                                const middle_query_t *mid_,
-                               const options_t &options_)
+                               const options_t &options_,
+                               std::shared_ptr<geom::way_cache_t> const &way_cache)
 : output_t(mid_, options_),
   m_tagtransform(tagtransform_t::make_tagtransform(&m_options)),
   m_export_list(new export_list(export_list_)), m_processor(processor_),
@@ -30,12 +32,14 @@ output_multi_t::output_multi_t(const std::string &name,
       m_export_list->normal_columns(m_osm_type), m_options.hstore_columns,
       m_processor->srid(), m_options.append, m_options.slim, m_options.droptemp,
       m_options.hstore_mode, m_options.enable_hstore_index,
-      m_options.tblsmain_data, m_options.tblsmain_index)),
+      m_options.tblsmain_data, m_options.tblsmain_index,
+      m_options.checkpoint, m_options.copy_buffer_size * 1024 * 1024)),
   ways_done_tracker(new id_tracker()),
   m_expire(m_options.expire_tiles_zoom, m_options.expire_tiles_max_bbox,
            m_options.projection),
   buffer(1024, osmium::memory::Buffer::auto_grow::yes),
-  m_builder(m_options.projection, m_options.enable_multi),
+  m_way_cache(way_cache ? way_cache : std::make_shared<geom::way_cache_t>()),
+  m_builder(m_options.projection, m_options.enable_multi, m_way_cache),
   m_way_area(m_export_list->has_column(m_osm_type, "way_area"))
 {
 }
@@ -53,7 +57,8 @@ output_multi_t::output_multi_t(const output_multi_t &other)
   m_expire(m_options.expire_tiles_zoom, m_options.expire_tiles_max_bbox,
            m_options.projection),
   buffer(1024, osmium::memory::Buffer::auto_grow::yes),
-  m_builder(m_options.projection, m_options.enable_multi),
+  m_way_cache(std::make_shared<geom::way_cache_t>()),
+  m_builder(m_options.projection, m_options.enable_multi, m_way_cache),
   m_way_area(other.m_way_area)
 {
 }
@@ -81,6 +86,7 @@ void output_multi_t::enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t
     if (id_tracker::is_valid(prev) && prev >= id) {
         if (prev > id) {
             job_queue.push(pending_job_t(id, output_id));
+            added++;
         }
         // already done the job
         return;
@@ -133,6 +139,7 @@ void output_multi_t::enqueue_relations(pending_queue_t &job_queue, osmid_t id, s
     if (id_tracker::is_valid(prev) && prev >= id) {
         if (prev > id) {
             job_queue.push(pending_job_t(id, output_id));
+            added++;
         }
         // already done the job
         return;
@@ -189,10 +196,28 @@ void output_multi_t::stop(osmium::thread::Pool *pool)
 
 void output_multi_t::commit() {
     m_table->commit();
+    m_way_cache->next_generation();
+}
+
+void output_multi_t::next_diff(std::string const &expire_file)
+{
+    if (m_options.expire_tiles_zoom_min > 0) {
+        m_expire.output_and_destroy(expire_file.c_str(),
+                                    m_options.expire_tiles_zoom_min);
+    }
+
+    begin();
+}
+
+void output_multi_t::begin()
+{
+    m_table->begin();
+    m_way_cache->next_generation();
 }
 
 int output_multi_t::node_add(osmium::Node const &node)
 {
+    m_way_cache->next_generation();
     if (m_processor->interests(geometry_processor::interest_node)) {
         return process_node(node);
     }
@@ -217,6 +242,7 @@ int output_multi_t::relation_add(osmium::Relation const &rel) {
 
 int output_multi_t::node_modify(osmium::Node const &node)
 {
+    m_way_cache->next_generation();
     if (m_processor->interests(geometry_processor::interest_node)) {
         // TODO - need to know it's a node?
         delete_from_output(node.id());
@@ -230,6 +256,7 @@ int output_multi_t::node_modify(osmium::Node const &node)
 }
 
 int output_multi_t::way_modify(osmium::Way *way) {
+    m_way_cache->next_generation();
     if (m_processor->interests(geometry_processor::interest_way)) {
         // TODO - need to know it's a way?
         delete_from_output(way->id());
@@ -257,6 +284,7 @@ int output_multi_t::relation_modify(osmium::Relation const &rel) {
 }
 
 int output_multi_t::node_delete(osmid_t id) {
+    m_way_cache->next_generation();
     if (m_processor->interests(geometry_processor::interest_node)) {
         // TODO - need to know it's a node?
         delete_from_output(id);
@@ -265,6 +293,7 @@ int output_multi_t::node_delete(osmid_t id) {
 }
 
 int output_multi_t::way_delete(osmid_t id) {
+    m_way_cache->next_generation();
     if (m_processor->interests(geometry_processor::interest_way)) {
         // TODO - need to know it's a way?
         delete_from_output(id);
@@ -288,9 +317,9 @@ int output_multi_t::process_node(osmium::Node const &node)
                                               outtags, true);
     if (!filter) {
         // grab its geom
+        m_builder.set_expire(&m_expire, node.id());
         auto geom = m_processor->process_node(node.location(), &m_builder);
         if (!geom.empty()) {
-            m_expire.from_wkb(geom.c_str(), node.id());
             copy_node_to_table(node.id(), geom, outtags);
         }
     }
@@ -316,6 +345,8 @@ int output_multi_t::reprocess_way(osmium::Way *way, bool exists)
         *way, 0, 0, *m_export_list.get(), outtags, true);
     if (!filter) {
         m_mid->nodes_get_list(&(way->nodes()));
+        m_builder.set_expire(&m_expire, way->id());
+        m_builder.set_way(way->id(), m_way_cache->generation());
         auto geom = m_processor->process_way(*way, &m_builder);
         if (!geom.empty()) {
             copy_to_table(way->id(), geom, outtags);
@@ -332,13 +363,19 @@ int output_multi_t::process_way(osmium::Way *way) {
         //get the geom from the middle
         if (m_mid->nodes_get_list(&(way->nodes())) < 1)
             return 0;
-        //grab its geom
+        //grab its geom, ways which may end up in a relation are only
+        //written (and therefore expired) when the pending ways are done
+        bool const pending =
+            m_processor->interests(geometry_processor::interest_relation) &&
+            may_be_relation_member(way->id());
+        m_builder.set_expire(pending ? nullptr : &m_expire, way->id());
+        m_builder.set_way(way->id(), m_way_cache->generation());
         auto geom = m_processor->process_way(*way, &m_builder);
 
         if (!geom.empty()) {
             //if we are also interested in relations we need to mark
             //this way pending just in case it shows up in one
-            if (m_processor->interests(geometry_processor::interest_relation)) {
+            if (pending) {
                 ways_pending_tracker.mark(way->id());
             } else {
                 // We wouldn't be interested in this as a relation, so no need to mark it pending.
@@ -384,6 +421,7 @@ int output_multi_t::process_relation(osmium::Relation const &rel,
         if (!filter)
         {
             m_relation_helper.add_way_locations((middle_t *)m_mid);
+            m_builder.set_expire(&m_expire, -rel.id());
             auto geoms = m_processor->process_relation(
                 rel, m_relation_helper.data, &m_builder);
             for (const auto geom : geoms) {
@@ -433,15 +471,14 @@ void output_multi_t::copy_to_table(const osmid_t id,
     // XXX really should depend on expected output type
     if (m_way_area) {
         // It's a polygon table (implied by it turning into a poly),
-        // and it got formed into a polygon, so expire as a polygon and write the geom
+        // and it got formed into a polygon, so add the area
         auto area =
             ewkb::parser_t(geom).get_area<osmium::geom::IdentityProjection>();
-        char tmp[32];
-        snprintf(tmp, sizeof(tmp), "%g", area);
-        tags.push_override(tag_t("way_area", tmp));
+        std::string value;
+        util::append_double(value, area);
+        tags.push_override(tag_t("way_area", value));
     }
 
-    m_expire.from_wkb(geom.c_str(), id);
     m_table->write_row(id, tags, geom);
 }
 
@@ -455,10 +492,7 @@ void output_multi_t::merge_pending_relations(output_t *other)
     auto *omulti = dynamic_cast<output_multi_t *>(other);
 
     if (omulti) {
-        osmid_t id;
-        while (id_tracker::is_valid((id = omulti->rels_pending_tracker.pop_mark()))) {
-            rels_pending_tracker.mark(id);
-        }
+        rels_pending_tracker.merge(omulti->rels_pending_tracker);
     }
 }
 
@@ -28,7 +28,8 @@ public:
     output_multi_t(const std::string &name,
                    std::shared_ptr<geometry_processor> processor_,
                    const export_list &export_list_,
-                   const middle_query_t* mid_, const options_t &options_);
+                   const middle_query_t* mid_, const options_t &options_,
+                   std::shared_ptr<geom::way_cache_t> const &way_cache = nullptr);
     output_multi_t(const output_multi_t& other);
     virtual ~output_multi_t();
 
@@ -37,6 +38,8 @@ public:
     int start() override;
     void stop(osmium::thread::Pool *pool) override;
     void commit() override;
+    void begin() override;
+    void next_diff(std::string const &expire_file) override;
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) override;
     int pending_way(osmid_t id, int exists) override;
@@ -83,6 +86,8 @@ protected:
     expire_tiles m_expire;
     relation_helper m_relation_helper;
     osmium::memory::Buffer buffer;
+    // shared with the other outputs of the style, clones have their own
+    std::shared_ptr<geom::way_cache_t> m_way_cache;
     geom::osmium_builder_t m_builder;
     bool m_way_area;
 };
@@ -29,6 +29,7 @@
 #include "expire-tiles.hpp"
 #include "middle.hpp"
 #include "node-ram-cache.hpp"
+#include "number-format.hpp"
 #include "options.hpp"
 #include "osmtypes.hpp"
 #include "output-pgsql.hpp"
@@ -74,27 +75,27 @@ E4C1421D5BF24D06053E7DF4940
 void output_pgsql_t::pgsql_out_way(osmium::Way const &way, taglist_t *tags,
                                    bool polygon, bool roads)
 {
+    m_builder.set_expire(&expire, way.id());
+
     if (polygon && way.is_closed()) {
         auto wkb = m_builder.get_wkb_polygon(way);
         if (!wkb.empty()) {
-            expire.from_wkb(wkb.c_str(), way.id());
             if (m_enable_way_area) {
-                char tmp[32];
                 auto const area =
                     m_options.reproject_area
                         ? ewkb::parser_t(wkb).get_area<reprojection>(
                               m_options.projection.get())
                         : ewkb::parser_t(wkb)
                               .get_area<osmium::geom::IdentityProjection>();
-                snprintf(tmp, sizeof(tmp), "%g", area);
-                tags->push_override(tag_t("way_area", tmp));
+                std::string value;
+                util::append_double(value, area);
+                tags->push_override(tag_t("way_area", value));
             }
             m_tables[t_poly]->write_row(way.id(), *tags, wkb);
         }
     } else {
         double const split_at = m_options.projection->target_latlon() ? 1 : 100 * 1000;
         for (auto const &wkb : m_builder.get_wkb_line(way.nodes(), split_at)) {
-            expire.from_wkb(wkb.c_str(), way.id());
             m_tables[t_line]->write_row(way.id(), *tags, wkb);
             if (roads) {
                 m_tables[t_roads]->write_row(way.id(), *tags, wkb);
@@ -109,6 +110,7 @@ void output_pgsql_t::enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t
     if (id_tracker::is_valid(prev) && prev >= id) {
         if (prev > id) {
             job_queue.push(pending_job_t(id, output_id));
+            added++;
         }
         // already done the job
         return;
@@ -181,6 +183,7 @@ void output_pgsql_t::enqueue_relations(pending_queue_t &job_queue, osmid_t id, s
     if (id_tracker::is_valid(prev) && prev >= id) {
         if (prev > id) {
             job_queue.push(pending_job_t(id, output_id));
+            added++;
         }
         // already done the job
         return;
@@ -239,6 +242,24 @@ void output_pgsql_t::commit()
     }
 }
 
+void output_pgsql_t::next_diff(std::string const &expire_file)
+{
+    if (m_options.expire_tiles_zoom_min > 0) {
+        expire.output_and_destroy(expire_file.c_str(),
+                                  m_options.expire_tiles_zoom_min);
+    }
+
+    // the tables were committed before the pending processing
+    begin();
+}
+
+void output_pgsql_t::begin()
+{
+    for (auto &t : m_tables) {
+        t->begin();
+    }
+}
+
 void output_pgsql_t::stop(osmium::thread::Pool *pool)
 {
     // attempt to stop tables in parallel
@@ -259,8 +280,8 @@ int output_pgsql_t::node_add(osmium::Node const &node)
                                     *m_export_list.get(), outtags))
         return 1;
 
+    m_builder.set_expire(&expire, node.id());
     auto wkb = m_builder.get_wkb_node(node.location());
-    expire.from_wkb(wkb.c_str(), node.id());
     m_tables[t_point]->write_row(node.id(), outtags, wkb);
 
     return 0;
@@ -276,12 +297,16 @@ int output_pgsql_t::way_add(osmium::Way *way)
     auto filter = m_tagtransform->filter_tags(*way, &polygon, &roads,
                                               *m_export_list.get(), outtags);
 
-    /* If this isn't a polygon then it can not be part of a multipolygon
-       Hence only polygons are "pending" */
-    if (!filter && polygon) { ways_pending_tracker.mark(way->id()); }
+    if (filter) {
+        return 0;
+    }
 
-    if( !polygon && !filter )
-    {
+    /* If this isn't a polygon then it can not be part of a multipolygon
+       Hence only polygons are "pending", and after the relation pre-scan
+       only those which are members of a relation */
+    if (polygon && may_be_relation_member(way->id())) {
+        ways_pending_tracker.mark(way->id());
+    } else {
         /* Get actual node data and generate output */
         auto nnodes = m_mid->nodes_get_list(&(way->nodes()));
         if (nnodes > 1) {
@@ -332,9 +357,9 @@ int output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel,
       return 0;
   }
 
-  for (auto &w : buffer.select<osmium::Way>()) {
-      m_mid->nodes_get_list(&(w.nodes()));
-  }
+  m_mid->nodes_get_ways(&buffer);
+
+  m_builder.set_expire(&expire, -rel.id());
 
   // linear features and boundaries
   // Needs to be done before the polygon treatment below because
@@ -343,7 +368,6 @@ int output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel,
       double const split_at = m_options.projection->target_latlon() ? 1 : 100 * 1000;
       auto wkbs = m_builder.get_wkb_multiline(buffer, split_at);
       for (auto const &wkb : wkbs) {
-          expire.from_wkb(wkb.c_str(), -rel.id());
           m_tables[t_line]->write_row(-rel.id(), outtags, wkb);
           if (roads)
               m_tables[t_roads]->write_row(-rel.id(), outtags, wkb);
@@ -354,9 +378,8 @@ int output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel,
   if (make_boundary || make_polygon) {
       auto wkbs = m_builder.get_wkb_multipolygon(rel, buffer);
 
-      char tmp[32];
+      std::string value;
       for (auto const &wkb : wkbs) {
-          expire.from_wkb(wkb.c_str(), -rel.id());
           if (m_enable_way_area) {
               auto const area =
                   m_options.reproject_area
@@ -364,8 +387,9 @@ int output_pgsql_t::pgsql_process_relation(osmium::Relation const &rel,
                             m_options.projection.get())
                       : ewkb::parser_t(wkb)
                             .get_area<osmium::geom::IdentityProjection>();
-              snprintf(tmp, sizeof(tmp), "%g", area);
-              outtags.push_override(tag_t("way_area", tmp));
+              value.clear();
+              util::append_double(value, area);
+              outtags.push_override(tag_t("way_area", value));
           }
           m_tables[t_poly]->write_row(-rel.id(), outtags, wkb);
       }
@@ -597,7 +621,8 @@ output_pgsql_t::output_pgsql_t(const middle_query_t *mid, const options_t &o)
             m_options.hstore_columns, m_options.projection->target_srs(),
             m_options.append, m_options.slim, m_options.droptemp,
             m_options.hstore_mode, m_options.enable_hstore_index,
-            m_options.tblsmain_data, m_options.tblsmain_index)));
+            m_options.tblsmain_data, m_options.tblsmain_index,
+            m_options.checkpoint, m_options.copy_buffer_size * 1024 * 1024)));
     }
 }
 
@@ -632,10 +657,7 @@ void output_pgsql_t::merge_pending_relations(output_t *other)
 {
     auto opgsql = dynamic_cast<output_pgsql_t *>(other);
     if (opgsql) {
-        osmid_t id;
-        while (id_tracker::is_valid((id = opgsql->rels_pending_tracker.pop_mark()))) {
-            rels_pending_tracker.mark(id);
-        }
+        rels_pending_tracker.merge(opgsql->rels_pending_tracker);
     }
 }
 void output_pgsql_t::merge_expire_trees(output_t *other)
@@ -31,6 +31,8 @@ public:
     int start() override;
     void stop(osmium::thread::Pool *pool) override;
     void commit() override;
+    void begin() override;
+    void next_diff(std::string const &expire_file) override;
 
     void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) override;
     int pending_way(osmid_t id, int exists) override;
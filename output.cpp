@@ -1,3 +1,4 @@
+#include "id-tracker.hpp"
 #include "output.hpp"
 #include "output-pgsql.hpp"
 #include "output-gazetteer.hpp"
@@ -27,7 +28,8 @@ void override_if(T &t, const std::string &key, const pt::ptree &conf) {
 
 std::shared_ptr<output_t> parse_multi_single(const pt::ptree &conf,
                              const middle_query_t *mid,
-                             const options_t &options) {
+                             const options_t &options,
+                             std::shared_ptr<geom::way_cache_t> const &way_cache) {
     options_t new_opts = options;
 
     std::string name = conf.get<std::string>("name");
@@ -78,7 +80,8 @@ std::shared_ptr<output_t> parse_multi_single(const pt::ptree &conf,
         columns.add(osm_type, info);
     }
 
-    return std::make_shared<output_multi_t>(name, processor, columns, mid, new_opts);
+    return std::make_shared<output_multi_t>(name, processor, columns, mid,
+                                            new_opts, way_cache);
 }
 
 std::vector<std::shared_ptr<output_t> > parse_multi_config(const middle_query_t *mid, const options_t &options) {
@@ -91,8 +94,11 @@ std::vector<std::shared_ptr<output_t> > parse_multi_config(const middle_query_t
             pt::ptree conf;
             pt::read_json(file_name, conf);
 
+            // the tables get the same ways one after the other
+            auto way_cache = std::make_shared<geom::way_cache_t>();
             for (const pt::ptree::value_type &val: conf) {
-                outputs.push_back(parse_multi_single(val.second, mid, options));
+                outputs.push_back(parse_multi_single(val.second, mid, options,
+                                                     way_cache));
             }
 
         } catch (const std::exception &e) {
@@ -146,6 +152,16 @@ const options_t *output_t::get_options() const
     return &m_options;
 }
 
+bool output_t::may_be_relation_member(osmid_t way_id) const
+{
+    return !m_options.relation_member_ways ||
+           m_options.relation_member_ways->is_marked(way_id);
+}
+
+void output_t::begin() {}
+
+void output_t::next_diff(std::string const &) {}
+
 void output_t::merge_pending_relations(output_t*) {}
 
 void output_t::merge_expire_trees(output_t*) {}
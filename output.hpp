@@ -44,6 +44,19 @@ public:
     virtual void stop(osmium::thread::Pool *pool) = 0;
     virtual void commit() = 0;
 
+    /**
+     * Start new transactions after commit(), keeping the connections
+     * open. Used for the clones of the pending processing.
+     */
+    virtual void begin();
+
+    /**
+     * Called by the update daemon once a diff has been committed and its
+     * pending objects are processed. Writes the tiles expired by the diff
+     * to expire_file and starts over for the next diff.
+     */
+    virtual void next_diff(std::string const &expire_file);
+
     virtual void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t& added) = 0;
     virtual int pending_way(osmid_t id, int exists) = 0;
 
@@ -70,6 +83,11 @@ public:
     virtual void merge_expire_trees(output_t *other);
 
 protected:
+    /**
+     * May the way become part of a relation? Without the relation
+     * pre-scan this is unknown and every way may.
+     */
+    bool may_be_relation_member(osmid_t way_id) const;
 
     const middle_query_t* m_mid;
     const options_t m_options;
@@ -22,14 +22,22 @@
 
 #include <boost/format.hpp>
 
+#include "id-tracker.hpp"
 #include "parse-osmium.hpp"
 #include "reprojection.hpp"
 #include "osmdata.hpp"
 
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <tuple>
+
 #include <osmium/io/any_input.hpp>
+#include <osmium/io/input_iterator.hpp>
 #include <osmium/handler.hpp>
 #include <osmium/visitor.hpp>
 #include <osmium/osm.hpp>
+#include <osmium/osm/object_comparisons.hpp>
 
 void parse_stats_t::update(const parse_stats_t &other)
 {
@@ -89,9 +97,16 @@ parse_osmium_t::parse_osmium_t(const boost::optional<std::string> &bbox,
 {
     if (bbox) {
         m_bbox = parse_bbox(bbox);
+        if (!m_append) {
+            m_bbox_nodes.reset(new id_tracker());
+            m_bbox_ways.reset(new id_tracker());
+            m_bbox_relations.reset(new id_tracker());
+        }
     }
 }
 
+parse_osmium_t::~parse_osmium_t() = default;
+
 osmium::Box parse_osmium_t::parse_bbox(const boost::optional<std::string> &bbox)
 {
     double minx, maxx, miny, maxy;
@@ -111,7 +126,9 @@ osmium::Box parse_osmium_t::parse_bbox(const boost::optional<std::string> &bbox)
     return osmium::Box(minx, miny, maxx, maxy);
 }
 
-void parse_osmium_t::stream_file(const std::string &filename, const std::string &fmt)
+namespace {
+
+osmium::io::File open_input(const std::string &filename, const std::string &fmt)
 {
     const char* osmium_format = fmt == "auto" ? "" : fmt.c_str();
     osmium::io::File infile(filename, osmium_format);
@@ -122,11 +139,211 @@ void parse_osmium_t::stream_file(const std::string &filename, const std::string
                                    : ((boost::format("Unknown file format '%1%'.")
                                                     % fmt).str()));
 
+    return infile;
+}
+
+/// The part of the object order of libosmium which sorted files follow.
+typedef std::tuple<osmium::item_type, bool, osmium::unsigned_object_id_type>
+    type_id_key_t;
+
+type_id_key_t type_id_key(osmium::OSMObject const &object)
+{
+    return std::make_tuple(object.type(), object.id() > 0,
+                           object.positive_id());
+}
+
+} // anonymous namespace
+
+void scan_relation_members(const std::string &filename, const std::string &fmt,
+                           const std::vector<std::string> &types,
+                           id_tracker *ways)
+{
+    osmium::io::Reader reader(open_input(filename, fmt),
+                              osmium::osm_entity_bits::relation,
+                              osmium::io::read_meta::no);
+
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (auto const &rel : buffer.select<osmium::Relation>()) {
+            if (!types.empty()) {
+                char const *type = rel.tags()["type"];
+                if (!type || std::find(types.begin(), types.end(), type) ==
+                                 types.end()) {
+                    continue;
+                }
+            }
+
+            for (auto const &m : rel.members()) {
+                if (m.type() == osmium::item_type::way) {
+                    ways->mark(m.ref());
+                }
+            }
+        }
+    }
+
+    reader.close();
+}
+
+bool lacks_locations_on_ways(const std::string &filename,
+                             const std::string &fmt)
+{
+    osmium::io::File const infile = open_input(filename, fmt);
+
+    // The other formats have no such flag, their first way is checked
+    // while the file is parsed.
+    if (infile.format() != osmium::io::file_format::pbf) {
+        return false;
+    }
+
+    osmium::io::Reader reader(infile, osmium::osm_entity_bits::nothing);
+    osmium::io::Header const header = reader.header();
+    reader.close();
+
+    // PBF lists the feature in the optional features of its header
+    for (int i = 0;; ++i) {
+        auto const feature =
+            header.get("pbf_optional_feature_" + std::to_string(i));
+        if (feature.empty()) {
+            return true;
+        }
+        if (feature == "LocationsOnWays") {
+            return false;
+        }
+    }
+}
+
+void parse_osmium_t::stream_file(const std::string &filename, const std::string &fmt)
+{
+    osmium::io::File infile = open_input(filename, fmt);
+
     fprintf(stderr, "Using %s parser.\n", osmium::io::as_string(infile.format()));
 
     osmium::io::Reader reader(infile);
     osmium::apply(reader, *this);
     reader.close();
+
+    m_stats.publish();
+}
+
+void parse_osmium_t::stream_merged(const std::vector<std::string> &filenames,
+                                   const std::string &fmt)
+{
+    typedef osmium::io::InputIterator<osmium::io::Reader, osmium::OSMObject>
+        iterator_t;
+
+    struct source_t
+    {
+        std::unique_ptr<osmium::io::Reader> reader;
+        iterator_t it;
+    };
+
+    // All readers decode in the background from the start, so the files
+    // are effectively read in parallel.
+    std::vector<source_t> sources;
+    for (auto const &filename : filenames) {
+        fprintf(stderr, "Opening input file: %s\n", filename.c_str());
+        source_t source;
+        source.reader.reset(new osmium::io::Reader(open_input(filename, fmt)));
+        source.it = iterator_t(*source.reader);
+        sources.push_back(std::move(source));
+    }
+
+    // min-heap of the sources by their current object, newest version first
+    osmium::object_order_type_id_reverse_version const order;
+    auto const later = [&](size_t a, size_t b) {
+        return order(*sources[b].it, *sources[a].it);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(
+        later);
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].it != iterator_t()) {
+            queue.push(i);
+        }
+    }
+
+    bool first = true;
+    type_id_key_t last;
+    size_t duplicates = 0;
+
+    while (!queue.empty()) {
+        size_t const i = queue.top();
+        queue.pop();
+        auto &source = sources[i];
+
+        auto const key = type_id_key(*source.it);
+        if (first || key != last) {
+            osmium::apply_item(*source.it, *this);
+            last = key;
+            first = false;
+        } else {
+            ++duplicates;
+        }
+
+        ++source.it;
+        if (source.it != iterator_t()) {
+            if (type_id_key(*source.it) < key) {
+                throw std::runtime_error(
+                    (boost::format("Input file '%1%' is not sorted by type "
+                                   "and id, it can not be merged.") %
+                     filenames[i])
+                        .str());
+            }
+            queue.push(i);
+        }
+    }
+
+    for (auto &source : sources) {
+        source.reader->close();
+    }
+
+    m_stats.publish();
+
+    fprintf(stderr, "  skipped %zu objects contained in several files\n",
+            duplicates);
+}
+
+void parse_osmium_t::stream_squashed(const std::vector<std::string> &filenames,
+                                     const std::string &fmt)
+{
+    std::vector<osmium::memory::Buffer> buffers;
+    std::vector<osmium::OSMObject *> objects;
+
+    for (auto const &filename : filenames) {
+        fprintf(stderr, "Reading change file: %s\n", filename.c_str());
+        osmium::io::Reader reader(open_input(filename, fmt),
+                                  osmium::osm_entity_bits::nwr);
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            for (auto &object : buffer.select<osmium::OSMObject>()) {
+                objects.push_back(&object);
+            }
+            buffers.push_back(std::move(buffer));
+        }
+        reader.close();
+    }
+
+    // Newest version of each object first. When the versions are equal
+    // the object from the later file wins, the stable sort keeps the
+    // reversed file order for those.
+    std::reverse(objects.begin(), objects.end());
+    std::stable_sort(objects.begin(), objects.end(),
+                     osmium::object_order_type_id_reverse_version());
+
+    size_t applied = 0;
+    osmium::OSMObject const *prev = nullptr;
+    for (auto *object : objects) {
+        if (prev && prev->type() == object->type() &&
+            prev->id() == object->id()) {
+            continue;
+        }
+        prev = object;
+        osmium::apply_item(*object, *this);
+        ++applied;
+    }
+
+    m_stats.publish();
+
+    fprintf(stderr, "  applied %zu of %zu object versions\n", applied,
+            objects.size());
 }
 
 void parse_osmium_t::node(osmium::Node const &node)
@@ -147,6 +364,9 @@ void parse_osmium_t::node(osmium::Node const &node)
         }
 
         if (!m_bbox || m_bbox->contains(node.location())) {
+            if (m_bbox_nodes) {
+                m_bbox_nodes->mark(node.id());
+            }
             if (m_append) {
                 m_data->node_modify(node);
             } else {
@@ -162,6 +382,17 @@ void parse_osmium_t::way(osmium::Way& way)
     if (way.deleted()) {
         m_data->way_delete(way.id());
     } else {
+        if (m_bbox_ways) {
+            auto const &nodes = way.nodes();
+            if (std::none_of(nodes.begin(), nodes.end(),
+                             [this](osmium::NodeRef const &n) {
+                                 return m_bbox_nodes->is_marked(n.ref());
+                             })) {
+                return;
+            }
+            m_bbox_ways->mark(way.id());
+        }
+
         if (m_append) {
             m_data->way_modify(&way);
         } else {
@@ -179,6 +410,29 @@ void parse_osmium_t::relation(osmium::Relation const &rel)
         if (rel.members().size() > 32767) {
             return;
         }
+        if (m_bbox_relations) {
+            // Relations with higher ids have not been seen yet, like the
+            // routes of a route master, they may be kept.
+            auto const &members = rel.members();
+            if (std::none_of(members.begin(), members.end(),
+                             [this, &rel](osmium::RelationMember const &m) {
+                                 switch (m.type()) {
+                                 case osmium::item_type::node:
+                                     return m_bbox_nodes->is_marked(m.ref());
+                                 case osmium::item_type::way:
+                                     return m_bbox_ways->is_marked(m.ref());
+                                 case osmium::item_type::relation:
+                                     return m.ref() > rel.id() ||
+                                            m_bbox_relations->is_marked(
+                                                m.ref());
+                                 default:
+                                     return false;
+                                 }
+                             })) {
+                return;
+            }
+            m_bbox_relations->mark(rel.id());
+        }
         if (m_append) {
             m_data->relation_modify(rel);
         } else {
@@ -27,7 +27,11 @@
 
 #include <boost/optional.hpp>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "metrics.hpp"
 #include "osmtypes.hpp"
 
 #include <osmium/osm/box.hpp>
@@ -36,6 +40,25 @@
 
 
 class osmdata_t;
+struct id_tracker;
+
+/**
+ * Pre-scan of an input file: mark all ways which are members of a
+ * relation with one of the given types, or of any relation if types is
+ * empty. Only the relations of the file are decoded.
+ */
+void scan_relation_members(const std::string &filename, const std::string &fmt,
+                           const std::vector<std::string> &types,
+                           id_tracker *ways);
+
+/**
+ * Check whether a PBF input file is known to come without the node
+ * locations in its ways, only the header of the file is read. Other
+ * formats don't announce them, osmdata_t checks their first way during
+ * the import instead.
+ */
+bool lacks_locations_on_ways(const std::string &filename,
+                             const std::string &fmt);
 
 class parse_stats_t
 {
@@ -43,6 +66,9 @@ class parse_stats_t
         osmid_t count = 0;
         osmid_t max = 0;
         time_t start = 0;
+        metrics::value_t *live = nullptr;
+        /// objects counted but not yet added to the live metric
+        osmid_t unpublished = 0;
 
         bool add(osmid_t id, int frac)
         {
@@ -53,8 +79,22 @@ class parse_stats_t
                 time(&start);
             }
             count++;
+            unpublished++;
 
-            return (count % frac == 0);
+            if (count % frac == 0) {
+                publish();
+                return true;
+            }
+
+            return false;
+        }
+
+        void publish()
+        {
+            if (unpublished > 0) {
+                live->fetch_add(unpublished, std::memory_order_relaxed);
+                unpublished = 0;
+            }
         }
 
         Counter& operator+=(const Counter& rhs)
@@ -72,10 +112,30 @@ class parse_stats_t
     };
 
 public:
-    parse_stats_t() : print_time(time(nullptr)) {}
+    parse_stats_t() : print_time(time(nullptr))
+    {
+        node.live = &metrics::counter("osm2pgsql_objects_read_total",
+                                      "type=\"node\"");
+        way.live = &metrics::counter("osm2pgsql_objects_read_total",
+                                     "type=\"way\"");
+        rel.live = &metrics::counter("osm2pgsql_objects_read_total",
+                                     "type=\"relation\"");
+    }
 
     void update(const parse_stats_t &other);
     void print_summary() const;
+
+    /**
+     * Add the objects counted since the last status update to the live
+     * metrics. Called after each input was read, in between this happens
+     * together with the status updates.
+     */
+    void publish()
+    {
+        node.publish();
+        way.publish();
+        rel.publish();
+    }
     void print_status();
 
     inline void add_node(osmid_t id)
@@ -110,9 +170,26 @@ class parse_osmium_t: public osmium::handler::Handler
 public:
     parse_osmium_t(const boost::optional<std::string> &bbox,
                    bool do_append, osmdata_t *osmdata);
+    ~parse_osmium_t();
 
     void stream_file(const std::string &filename, const std::string &fmt);
 
+    /**
+     * Read several sorted input files at the same time and process their
+     * objects as one stream ordered by type and id. Objects contained in
+     * more than one file are only processed once, in their newest version.
+     */
+    void stream_merged(const std::vector<std::string> &filenames,
+                       const std::string &fmt);
+
+    /**
+     * Read a set of change files and apply them as if they were a single
+     * diff: only the newest version (or deletion) of each object is
+     * processed, in type and id order. The files are held in memory.
+     */
+    void stream_squashed(const std::vector<std::string> &filenames,
+                         const std::string &fmt);
+
     void node(osmium::Node const &node);
     void way(osmium::Way& way);
     void relation(osmium::Relation const &rel);
@@ -129,6 +206,17 @@ private:
     bool m_append;
     boost::optional<osmium::Box> m_bbox;
     parse_stats_t m_stats;
+
+    /**
+     * Objects kept by the bounding box filter of an import. Ways without
+     * any kept node and relations without any kept member are dropped,
+     * members which are relations with a higher id count as kept.
+     * Diffs are not filtered, their objects may refer to data which is
+     * only in the database.
+     */
+    std::unique_ptr<id_tracker> m_bbox_nodes;
+    std::unique_ptr<id_tracker> m_bbox_ways;
+    std::unique_ptr<id_tracker> m_bbox_relations;
 };
 
 #endif
@@ -1,12 +1,20 @@
 /* Helper functions for the postgresql connections */
 #include "pgsql.hpp"
 
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <cstring>
 #include <memory>
 #include <boost/format.hpp>
 
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
+
 void escape(const std::string &src, std::string &dst)
 {
     for (const char c: src) {
@@ -89,26 +97,6 @@ int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, .
     return 0;
 }
 
-void pgsql_CopyData(const char *context, PGconn *sql_conn, std::string const &sql)
-{
-#ifdef DEBUG_PGSQL
-    fprintf(stderr, "%s>>> %s\n", context, sql.c_str());
-#endif
-    int r = PQputCopyData(sql_conn, sql.c_str(), sql.size());
-    switch(r)
-    {
-        //need to wait for write ready
-        case 0:
-            throw std::runtime_error((boost::format("%1% - bad result during COPY, data %2%") % context % sql % PQerrorMessage(sql_conn)).str());
-            break;
-        //error occurred
-        case -1:
-            throw std::runtime_error((boost::format("%1%: %2% - bad result during COPY, data %3%") % PQerrorMessage(sql_conn) % context % sql).str());
-            break;
-        //other possibility is 1 which means success
-    }
-}
-
 pg_result_t pgsql_execPrepared(PGconn *sql_conn, const char *stmtName,
                                const int nParams,
                                const char *const *paramValues,
@@ -139,3 +127,284 @@ pg_result_t pgsql_execPrepared(PGconn *sql_conn, const char *stmtName,
 
     return res;
 }
+
+pg_pipeline_t::pg_pipeline_t(size_t max_queued)
+: m_conn(nullptr), m_max_queued(max_queued)
+{
+}
+
+void pg_pipeline_t::exec_prepared(PGconn *sql_conn, const char *stmtName,
+                                  int nParams, const char *const *paramValues,
+                                  ExecStatusType expect, handler_t handler)
+{
+#ifdef DEBUG_PGSQL
+    fprintf( stderr, "Queueing prepared: %s\n", stmtName );
+#endif
+    m_conn = sql_conn;
+
+    m_queue.emplace_back();
+    auto &query = m_queue.back();
+    query.name = stmtName;
+    query.expect = expect;
+    query.handler = std::move(handler);
+    for (int i = 0; i < nParams; ++i) {
+        query.null.push_back(paramValues[i] == nullptr);
+        query.values.emplace_back(paramValues[i] ? paramValues[i] : "");
+    }
+
+    if (m_queue.size() >= m_max_queued) {
+        sync();
+    }
+}
+
+void pg_pipeline_t::handle(query_t const &query, PGresult *res)
+{
+    // after an error the server skips the rest of the pipeline
+    if (!m_error.empty()) {
+        return;
+    }
+
+    if (PQresultStatus(res) != query.expect) {
+        m_error = (boost::format("%1% failed: %2%(%3%)\n") % query.name %
+                   PQerrorMessage(m_conn) % PQresultStatus(res))
+                      .str();
+        if (!query.values.empty()) {
+            m_error += "Arguments were: ";
+            for (size_t i = 0; i < query.values.size(); ++i) {
+                m_error += query.null[i] ? "<NULL>" : query.values[i];
+                m_error += ", ";
+            }
+        }
+        return;
+    }
+
+    if (query.handler) {
+        query.handler(res);
+    }
+}
+
+void pg_pipeline_t::sync()
+{
+    if (m_queue.empty()) {
+        return;
+    }
+
+    // The queue is empty afterwards whatever happens, so that a failed
+    // batch is never sent again.
+    std::vector<query_t> queue;
+    queue.swap(m_queue);
+    m_error.clear();
+
+    std::vector<const char *> params;
+    auto const set_params = [&params](query_t const &query) {
+        params.clear();
+        for (size_t i = 0; i < query.values.size(); ++i) {
+            params.push_back(query.null[i] ? nullptr
+                                           : query.values[i].c_str());
+        }
+    };
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // The server stops reading statements once it can not get rid of its
+    // results, so they have to be read while the statements are still
+    // being sent. Otherwise both sides would wait for each other.
+    if (PQsetnonblocking(m_conn, 1) != 0) {
+        throw std::runtime_error(
+            (boost::format("Setting connection non-blocking failed: %1%") %
+             PQerrorMessage(m_conn))
+                .str());
+    }
+
+    if (PQenterPipelineMode(m_conn) != 1) {
+        PQsetnonblocking(m_conn, 0);
+        throw std::runtime_error(
+            (boost::format("Entering pipeline mode failed: %1%") %
+             PQerrorMessage(m_conn))
+                .str());
+    }
+
+    bool synced = false;
+    try {
+        pipeline_reader_t reader(this, queue);
+
+        for (auto const &query : queue) {
+            set_params(query);
+            if (PQsendQueryPrepared(m_conn, query.name,
+                                    static_cast<int>(params.size()),
+                                    params.data(), nullptr, nullptr, 0) != 1) {
+                throw std::runtime_error(
+                    (boost::format("Sending %1% failed: %2%") % query.name %
+                     PQerrorMessage(m_conn))
+                        .str());
+            }
+            reader.flush();
+        }
+
+        if (PQpipelineSync(m_conn) != 1) {
+            throw std::runtime_error(
+                (boost::format("Pipeline sync failed: %1%") %
+                 PQerrorMessage(m_conn))
+                    .str());
+        }
+        synced = true;
+        reader.flush();
+
+        while (!reader.done()) {
+            reader.wait(false);
+        }
+    } catch (...) {
+        PQsetnonblocking(m_conn, 0);
+        abort_pipeline(synced);
+        throw;
+    }
+
+    PQsetnonblocking(m_conn, 0);
+
+    if (PQexitPipelineMode(m_conn) != 1) {
+        throw std::runtime_error(
+            (boost::format("Leaving pipeline mode failed: %1%") %
+             PQerrorMessage(m_conn))
+                .str());
+    }
+#else
+    for (auto const &query : queue) {
+        set_params(query);
+        pg_result_t res(PQexecPrepared(m_conn, query.name,
+                                       static_cast<int>(params.size()),
+                                       params.data(), nullptr, nullptr, 0));
+        handle(query, res.get());
+        if (!m_error.empty()) {
+            break;
+        }
+    }
+#endif
+
+    if (!m_error.empty()) {
+        std::string error;
+        error.swap(m_error);
+        throw std::runtime_error(error);
+    }
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+pg_pipeline_t::pipeline_reader_t::pipeline_reader_t(
+    pg_pipeline_t *pipeline, std::vector<query_t> const &queue)
+: m_pipeline(pipeline), m_queue(queue), m_next(0), m_want_null(false),
+  m_done(false)
+{
+}
+
+void pg_pipeline_t::pipeline_reader_t::flush()
+{
+    PGconn *conn = m_pipeline->m_conn;
+    int res;
+    while ((res = PQflush(conn)) == 1) {
+        wait(true);
+    }
+    if (res != 0) {
+        throw std::runtime_error(
+            (boost::format("Sending statements failed: %1%") %
+             PQerrorMessage(conn))
+                .str());
+    }
+
+    // libpq may have read results on its own while sending
+    read();
+}
+
+void pg_pipeline_t::pipeline_reader_t::wait(bool for_write)
+{
+    PGconn *conn = m_pipeline->m_conn;
+    int const sock = PQsocket(conn);
+    if (sock < 0) {
+        throw std::runtime_error("Lost the connection to the database.");
+    }
+
+    fd_set read_fds;
+    fd_set write_fds;
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_SET(sock, &read_fds);
+    if (for_write) {
+        FD_SET(sock, &write_fds);
+    }
+    if (select(sock + 1, &read_fds, &write_fds, nullptr, nullptr) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw std::runtime_error(
+            (boost::format("Waiting for the database failed: %1%") %
+             std::strerror(errno))
+                .str());
+    }
+
+    if (FD_ISSET(sock, &read_fds)) {
+        if (PQconsumeInput(conn) != 1) {
+            throw std::runtime_error(
+                (boost::format("Reading results failed: %1%") %
+                 PQerrorMessage(conn))
+                    .str());
+        }
+        read();
+    }
+}
+
+void pg_pipeline_t::pipeline_reader_t::read()
+{
+    PGconn *conn = m_pipeline->m_conn;
+    while (!m_done && !PQisBusy(conn)) {
+        pg_result_t res(PQgetResult(conn));
+        if (m_want_null) {
+            // the results of each statement are terminated by a null pointer
+            m_want_null = false;
+        } else if (!res) {
+            // all statements sent so far are done
+            break;
+        } else if (m_next < m_queue.size()) {
+            m_pipeline->handle(m_queue[m_next++], res.get());
+            m_want_null = true;
+        } else {
+            if (PQresultStatus(res.get()) != PGRES_PIPELINE_SYNC &&
+                m_pipeline->m_error.empty()) {
+                m_pipeline->m_error =
+                    (boost::format("Pipeline sync failed: %1%") %
+                     PQerrorMessage(conn))
+                        .str();
+            }
+            m_done = true;
+        }
+    }
+}
+
+void pg_pipeline_t::abort_pipeline(bool synced)
+{
+    m_error.clear();
+
+    // without the sync the server would wait for more statements
+    if (!synced && PQpipelineSync(m_conn) != 1) {
+        PQexitPipelineMode(m_conn);
+        return;
+    }
+
+    // Skip all results up to the end of the pipeline. Two null pointers
+    // in a row mean that there are no more results.
+    bool last_null = false;
+    while (PQstatus(m_conn) == CONNECTION_OK) {
+        pg_result_t res(PQgetResult(m_conn));
+        if (!res) {
+            if (last_null) {
+                break;
+            }
+            last_null = true;
+            continue;
+        }
+        last_null = false;
+        if (PQresultStatus(res.get()) == PGRES_PIPELINE_SYNC) {
+            break;
+        }
+    }
+
+    // the original error is more useful than a failure here
+    PQexitPipelineMode(m_conn);
+}
+#endif
@@ -9,7 +9,9 @@
 #include <string>
 #include <cstring>
 #include <libpq-fe.h>
+#include <functional>
 #include <memory>
+#include <vector>
 
 struct pg_result_deleter_t
 {
@@ -21,7 +23,6 @@ typedef std::unique_ptr<PGresult, pg_result_deleter_t> pg_result_t;
 pg_result_t pgsql_execPrepared(PGconn *sql_conn, const char *stmtName,
                                int nParams, const char *const *paramValues,
                                ExecStatusType expect);
-void pgsql_CopyData(const char *context, PGconn *sql_conn, std::string const &sql);
 
 pg_result_t pgsql_exec_simple(PGconn *sql_conn, ExecStatusType expect,
                               std::string const &sql);
@@ -34,5 +35,107 @@ int pgsql_exec(PGconn *sql_conn, const ExecStatusType expect, const char *fmt, .
 #endif
 ;
 
+/**
+ * Queue of prepared statements for one connection which are sent as a
+ * batch, so that a whole batch costs a single round trip to the server.
+ *
+ * With a libpq that has pipeline mode, the batch is sent as one pipeline
+ * over the connection in non-blocking mode, reading the results while the
+ * statements are still being sent. Older versions of libpq run the
+ * statements one after the other.
+ *
+ * Nothing else may be run on the connection while statements are queued,
+ * call sync() first.
+ */
+class pg_pipeline_t
+{
+public:
+    typedef std::function<void(PGresult *)> handler_t;
+
+    /**
+     * \param max_queued Number of statements after which the queue is sent
+     *                   on its own.
+     */
+    explicit pg_pipeline_t(size_t max_queued = 256);
+
+    pg_pipeline_t(pg_pipeline_t const &) = delete;
+    pg_pipeline_t &operator=(pg_pipeline_t const &) = delete;
+
+    /**
+     * Queue a prepared statement. The parameter values are copied, null
+     * pointers are sent as NULL. The handler, if any, is called with the
+     * result once it is in.
+     */
+    void exec_prepared(PGconn *sql_conn, const char *stmtName, int nParams,
+                       const char *const *paramValues, ExecStatusType expect,
+                       handler_t handler = nullptr);
+
+    /**
+     * Run all queued statements and hand their results to the handlers.
+     * Throws if any of them failed, the connection can be used again
+     * afterwards.
+     */
+    void sync();
+
+    bool empty() const { return m_queue.empty(); }
+
+private:
+    struct query_t
+    {
+        const char *name;
+        ExecStatusType expect;
+        handler_t handler;
+        std::vector<std::string> values;
+        std::vector<bool> null;
+    };
+
+    /// Check the result of a query, the first error is kept in m_error.
+    void handle(query_t const &query, PGresult *res);
+
+#ifdef LIBPQ_HAS_PIPELINING
+    /**
+     * Reads the results of a pipeline as they come in, in the order of
+     * the queue, followed by the result of the sync.
+     */
+    class pipeline_reader_t
+    {
+    public:
+        pipeline_reader_t(pg_pipeline_t *pipeline,
+                          std::vector<query_t> const &queue);
+
+        /// Send everything that libpq buffered, reading results meanwhile.
+        void flush();
+
+        /// Wait until the connection is readable (or writable) and read.
+        void wait(bool for_write);
+
+        bool done() const { return m_done; }
+
+    private:
+        /// Handle all results that are in without blocking.
+        void read();
+
+        pg_pipeline_t *m_pipeline;
+        std::vector<query_t> const &m_queue;
+        size_t m_next;
+        bool m_want_null;
+        bool m_done;
+    };
+
+    /**
+     * Get the connection out of pipeline mode after sync() failed half
+     * way, skipping all outstanding results.
+     *
+     * \param synced Has the end of the pipeline been sent already?
+     */
+    void abort_pipeline(bool synced);
+#endif
+
+    PGconn *m_conn;
+    size_t m_max_queued;
+    std::vector<query_t> m_queue;
+    std::string m_error;
+};
+
 void escape(const std::string &src, std::string& dst);
 #endif
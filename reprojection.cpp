@@ -7,6 +7,7 @@
 
 #include "config.h"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -20,6 +21,11 @@
 
 namespace {
 
+inline double clamp_merc_lat(double lat)
+{
+    return lat > 89.99 ? 89.99 : (lat < -89.99 ? -89.99 : lat);
+}
+
 void latlon2merc(double *lat, double *lon)
 {
     if (*lat > 89.99) {
@@ -43,6 +49,18 @@ public:
                                          loc.lat_without_check());
     }
 
+    void reproject(osmium::NodeRefList const &nodes,
+                   std::vector<osmium::geom::Coordinates> *out) const override
+    {
+        for (auto const &node : nodes) {
+            auto const loc = node.location();
+            if (loc.valid()) {
+                out->emplace_back(loc.lon_without_check(),
+                                  loc.lat_without_check());
+            }
+        }
+    }
+
     void target_to_tile(double *lat, double *lon) const override
     {
         latlon2merc(lat, lon);
@@ -65,6 +83,31 @@ public:
         return osmium::geom::Coordinates(lon, lat);
     }
 
+    void reproject(osmium::NodeRefList const &nodes,
+                   std::vector<osmium::geom::Coordinates> *out) const override
+    {
+        using namespace osmium::geom;
+
+        // Collect first, then project in a separate loop that is free of
+        // location checks and virtual calls. The per-point functions are
+        // the same as in reproject(loc), so the results are bit-identical.
+        auto const first = out->size();
+        for (auto const &node : nodes) {
+            auto const loc = node.location();
+            if (loc.valid()) {
+                out->emplace_back(loc.lon_without_check(),
+                                  loc.lat_without_check());
+            }
+        }
+
+        auto *c = out->data() + first;
+        auto *const end = out->data() + out->size();
+        for (; c != end; ++c) {
+            c->x = detail::lon_to_x(c->x);
+            c->y = detail::lat_to_y(clamp_merc_lat(c->y));
+        }
+    }
+
     void target_to_tile(double *, double *) const override
     { /* nothing */ }
 
@@ -88,6 +131,50 @@ public:
                                      deg_to_rad(loc.lat_without_check())));
     }
 
+    void reproject(osmium::NodeRefList const &nodes,
+                   std::vector<osmium::geom::Coordinates> *out) const override
+    {
+        using namespace osmium::geom;
+
+        auto const first = out->size();
+        for (auto const &node : nodes) {
+            auto const loc = node.location();
+            if (loc.valid()) {
+                out->emplace_back(deg_to_rad(loc.lon_without_check()),
+                                  deg_to_rad(loc.lat_without_check()));
+            }
+        }
+
+        auto const count = static_cast<long>(out->size() - first);
+        if (count == 0) {
+            return;
+        }
+
+        // Coordinates is a pair of doubles, so the buffer can be handed
+        // to proj as interleaved x/y arrays with a point offset of 2.
+        auto *c = out->data() + first;
+        int const result = pj_transform(pj_source.get(), pj_target.get(),
+                                        count, 2, &c->x, &c->y, nullptr);
+        if (result != 0) {
+            throw osmium::projection_error(
+                std::string("projection failed: ") + pj_strerrno(result));
+        }
+
+        // With more than one point proj only reports some errors, other
+        // failed points just come back as HUGE_VAL. Those are projected
+        // again on their own, which throws like reproject(loc) does.
+        auto const *const end = c + count;
+        auto node = nodes.cbegin();
+        for (; c != end; ++c, ++node) {
+            while (!node->location().valid()) {
+                ++node;
+            }
+            if (c->x == HUGE_VAL || c->y == HUGE_VAL) {
+                *c = reproject(node->location());
+            }
+        }
+    }
+
     void target_to_tile(double *lat, double *lon) const override
     {
         auto c = transform(pj_target, pj_tile, osmium::geom::Coordinates(*lon, *lat));
@@ -129,6 +216,16 @@ reprojection *reprojection::create_projection(int srs)
 }
 
 
+void reprojection::reproject(osmium::NodeRefList const &nodes,
+                             std::vector<osmium::geom::Coordinates> *out) const
+{
+    for (auto const &node : nodes) {
+        if (node.location().valid()) {
+            out->push_back(reproject(node.location()));
+        }
+    }
+}
+
 void reprojection::coords_to_tile(double *tilex, double *tiley,
                                   double lon, double lat, int map_width)
 {
@@ -8,10 +8,13 @@
 #ifndef REPROJECTION_H
 #define REPROJECTION_H
 
+#include <vector>
+
 #include <boost/noncopyable.hpp>
 
 #include <osmium/geom/projection.hpp>
 #include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref_list.hpp>
 
 enum Projection { PROJ_LATLONG = 4326, PROJ_SPHERE_MERC = 3857 };
 
@@ -26,6 +29,17 @@ public:
      */
     virtual osmium::geom::Coordinates reproject(osmium::Location loc) const = 0;
 
+    /**
+     * Reproject all nodes with a valid location in `nodes` and append the
+     * results to `out`, one entry per valid location in list order.
+     *
+     * The result is identical to calling reproject() for each location,
+     * but saves a virtual call per point and lets projections transform
+     * the whole list in one go.
+     */
+    virtual void reproject(osmium::NodeRefList const &nodes,
+                           std::vector<osmium::geom::Coordinates> *out) const;
+
     /**
      * Converts coordinates from target projection to tile projection (EPSG:3857)
      *
@@ -5,6 +5,9 @@
 #include <utility>
 #include <time.h>
 
+#include "checkpoint.hpp"
+#include "copy-writer.hpp"
+#include "number-format.hpp"
 #include "options.hpp"
 #include "table.hpp"
 #include "taginfo.hpp"
@@ -14,33 +17,30 @@
 using std::string;
 typedef boost::format fmt;
 
-#define BUFFER_SEND_SIZE 1024
-
 
 table_t::table_t(const string& conninfo, const string& name, const string& type, const columns_t& columns, const hstores_t& hstore_columns,
     const int srid, const bool append, const bool slim, const bool drop_temp, const int hstore_mode,
-    const bool enable_hstore_index, const boost::optional<string>& table_space, const boost::optional<string>& table_space_index) :
+    const bool enable_hstore_index, const boost::optional<string>& table_space, const boost::optional<string>& table_space_index,
+    std::shared_ptr<checkpoint_t> const &checkpoint, size_t copy_buffer_size) :
     conninfo(conninfo), name(name), type(type), sql_conn(nullptr), copyMode(false), srid((fmt("%1%") % srid).str()),
     append(append), slim(slim), drop_temp(drop_temp), hstore_mode(hstore_mode), enable_hstore_index(enable_hstore_index),
-    columns(columns), hstore_columns(hstore_columns), table_space(table_space), table_space_index(table_space_index)
+    columns(columns), hstore_columns(hstore_columns), table_space(table_space), table_space_index(table_space_index),
+    checkpoint(checkpoint), copy_buffer_size(copy_buffer_size), copy_bytes(metrics::counter("osm2pgsql_copy_bytes_total", "table=\"" + name + "\""))
 {
     //if we dont have any columns
     if(columns.size() == 0 && hstore_mode != HSTORE_ALL)
         throw std::runtime_error((fmt("No columns provided for table %1%") % name).str());
 
-    //nothing to copy to start with
-    buffer = "";
-
-    //we use these a lot, so instead of constantly allocating them we predefine these
-    single_fmt = fmt("%1%");
+    //we use this a lot, so instead of constantly allocating it we predefine it
     del_fmt = fmt("DELETE FROM %1% WHERE osm_id = %2%");
 }
 
 table_t::table_t(const table_t& other):
-    conninfo(other.conninfo), name(other.name), type(other.type), sql_conn(nullptr), copyMode(false), buffer(), srid(other.srid),
+    conninfo(other.conninfo), name(other.name), type(other.type), sql_conn(nullptr), copyMode(false), srid(other.srid),
     append(other.append), slim(other.slim), drop_temp(other.drop_temp), hstore_mode(other.hstore_mode), enable_hstore_index(other.enable_hstore_index),
     columns(other.columns), hstore_columns(other.hstore_columns), copystr(other.copystr), table_space(other.table_space),
-    table_space_index(other.table_space_index), single_fmt(other.single_fmt), del_fmt(other.del_fmt)
+    table_space_index(other.table_space_index), checkpoint(other.checkpoint), del_fmt(other.del_fmt),
+    copy_buffer_size(other.copy_buffer_size), copy_bytes(other.copy_bytes)
 {
     // if the other table has already started, then we want to execute
     // the same stuff to get into the same state. but if it hasn't, then
@@ -69,6 +69,8 @@ void table_t::teardown()
 {
     if(sql_conn != nullptr)
     {
+        // the writer must not use the connection any more
+        copy_writer.reset();
         PQfinish(sql_conn);
         sql_conn = nullptr;
     }
@@ -93,6 +95,7 @@ void table_t::connect()
     if (PQstatus(_conn) != CONNECTION_OK)
         throw std::runtime_error((fmt("Connection to database failed: %1%\n") % PQerrorMessage(_conn)).str());
     sql_conn = _conn;
+    copy_writer.reset(new copy_writer_t(name, copy_buffer_size, &copy_bytes));
     //let commits happen faster by delaying when they actually occur
     pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, "SET synchronous_commit TO off;");
 }
@@ -210,43 +213,68 @@ void table_t::start()
 
 void table_t::stop()
 {
+    // when resuming an import, the table has never been started
+    if (!sql_conn) {
+        connect();
+    }
+
     stop_copy();
     if (!append)
     {
+        if (checkpoint && checkpoint->done("index:" + name)) {
+            fprintf(stderr, "Indexes on %s already created\n", name.c_str());
+            teardown();
+            return;
+        }
+
         time_t start, end;
         time(&start);
 
         fprintf(stderr, "Sorting data and creating indexes for %s\n", name.c_str());
 
-        if (srid == "4326") {
-            /* libosmium assures validity of geometries in 4326, so the WHERE can be skipped.
-               Because we know the geom is already in 4326, no reprojection is needed for GeoHashing */
-            pgsql_exec_simple(
-                sql_conn, PGRES_COMMAND_OK,
-                (fmt("CREATE TABLE %1%_tmp %2% AS\n"
-                     "  SELECT * FROM %1%\n"
-                     "    ORDER BY ST_GeoHash(way,10)\n"
-                     "    COLLATE \"C\"") %
-                 name % (table_space ? "TABLESPACE " + table_space.get() : ""))
-                    .str());
+        if (checkpoint && checkpoint->done("cluster:" + name)) {
+            // A previous run was interrupted while indexing, start over
+            // with the indexes but keep the clustered data.
+            drop_indexes();
         } else {
-            /* osm2pgsql's transformation from 4326 to another projection could make a geometry invalid,
-               and these need to be filtered. Also, a transformation is needed for geohashing. */
-            pgsql_exec_simple(
-                sql_conn, PGRES_COMMAND_OK,
-                (fmt("CREATE TABLE %1%_tmp %2% AS\n"
-                     "  SELECT * FROM %1%\n"
-                     "    WHERE ST_IsValid(way)\n"
-                     // clang-format off
-                     "    ORDER BY ST_GeoHash(ST_Transform(ST_Envelope(way),4326),10)\n"
-                     // clang-format on
-                     "    COLLATE \"C\"") %
-                 name % (table_space ? "TABLESPACE " + table_space.get() : ""))
-                    .str());
+            // A previous run may have left an incomplete copy behind.
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("DROP TABLE IF EXISTS %1%_tmp") % name).str());
+
+            if (srid == "4326") {
+                /* libosmium assures validity of geometries in 4326, so the WHERE can be skipped.
+                   Because we know the geom is already in 4326, no reprojection is needed for GeoHashing */
+                pgsql_exec_simple(
+                    sql_conn, PGRES_COMMAND_OK,
+                    (fmt("CREATE TABLE %1%_tmp %2% AS\n"
+                         "  SELECT * FROM %1%\n"
+                         "    ORDER BY ST_GeoHash(way,10)\n"
+                         "    COLLATE \"C\"") %
+                     name % (table_space ? "TABLESPACE " + table_space.get() : ""))
+                        .str());
+            } else {
+                /* osm2pgsql's transformation from 4326 to another projection could make a geometry invalid,
+                   and these need to be filtered. Also, a transformation is needed for geohashing. */
+                pgsql_exec_simple(
+                    sql_conn, PGRES_COMMAND_OK,
+                    (fmt("CREATE TABLE %1%_tmp %2% AS\n"
+                         "  SELECT * FROM %1%\n"
+                         "    WHERE ST_IsValid(way)\n"
+                         // clang-format off
+                         "    ORDER BY ST_GeoHash(ST_Transform(ST_Envelope(way),4326),10)\n"
+                         // clang-format on
+                         "    COLLATE \"C\"") %
+                     name % (table_space ? "TABLESPACE " + table_space.get() : ""))
+                        .str());
+            }
+            begin();
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("DROP TABLE %1%") % name).str());
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ALTER TABLE %1%_tmp RENAME TO %1%") % name).str());
+            pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, "COMMIT");
+            fprintf(stderr, "Copying %s to cluster by geometry finished\n", name.c_str());
+            if (checkpoint) {
+                checkpoint->mark_done("cluster:" + name);
+            }
         }
-        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("DROP TABLE %1%") % name).str());
-        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ALTER TABLE %1%_tmp RENAME TO %1%") % name).str());
-        fprintf(stderr, "Copying %s to cluster by geometry finished\n", name.c_str());
         fprintf(stderr, "Creating geometry index on %s\n", name.c_str());
 
         // Use fillfactor 100 for un-updatable imports
@@ -299,6 +327,9 @@ void table_t::stop()
         }
         fprintf(stderr, "Creating indexes on %s finished\n", name.c_str());
         pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, (fmt("ANALYZE %1%") % name).str());
+        if (checkpoint) {
+            checkpoint->mark_done("index:" + name);
+        }
         time(&end);
         fprintf(stderr, "All indexes on %s created in %ds\n", name.c_str(), (int)(end - start));
     }
@@ -307,6 +338,49 @@ void table_t::stop()
     fprintf(stderr, "Completed %s\n", name.c_str());
 }
 
+void table_t::drop_indexes()
+{
+    auto quote = [this](char const *str, bool identifier) {
+        char *quoted =
+            identifier ? PQescapeIdentifier(sql_conn, str, std::strlen(str))
+                       : PQescapeLiteral(sql_conn, str, std::strlen(str));
+        if (!quoted) {
+            throw std::runtime_error(
+                (fmt("Escaping '%1%' failed: %2%") % str %
+                 PQerrorMessage(sql_conn))
+                    .str());
+        }
+        std::string result(quoted);
+        PQfreemem(quoted);
+        return result;
+    };
+
+    // Only the indexes of this very table, not those of a table with the
+    // same name in another schema.
+    auto res = pgsql_exec_simple(
+        sql_conn, PGRES_TUPLES_OK,
+        (fmt("SELECT n.nspname, c.relname FROM pg_index i"
+             " JOIN pg_class c ON c.oid = i.indexrelid"
+             " JOIN pg_namespace n ON n.oid = c.relnamespace"
+             " WHERE i.indrelid = %1%::regclass") %
+         quote(name.c_str(), false))
+            .str());
+    for (int i = 0; i < PQntuples(res.get()); ++i) {
+        pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                          (fmt("DROP INDEX %1%.%2%") %
+                           quote(PQgetvalue(res.get(), i, 0), true) %
+                           quote(PQgetvalue(res.get(), i, 1), true))
+                              .str());
+    }
+
+    pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, "SET client_min_messages = WARNING");
+    pgsql_exec_simple(
+        sql_conn, PGRES_COMMAND_OK,
+        (fmt("DROP TRIGGER IF EXISTS %1%_osm2pgsql_valid ON %1%") % name)
+            .str());
+    pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK, "RESET client_min_messages");
+}
+
 void table_t::stop_copy()
 {
     int stop;
@@ -314,12 +388,8 @@ void table_t::stop_copy()
     //we werent copying anyway
     if(!copyMode)
         return;
-    //if there is stuff left over in the copy buffer send it offand copy it before we stop
-    else if(buffer.length() != 0)
-    {
-        pgsql_CopyData(name.c_str(), sql_conn, buffer);
-        buffer.clear();
-    };
+    //send off whatever is left in the copy buffer and wait until it is through
+    copy_writer->finish(sql_conn);
 
     //stop the copy
     stop = PQputCopyEnd(sql_conn, nullptr);
@@ -342,8 +412,10 @@ void table_t::delete_row(const osmid_t id)
 
 void table_t::write_row(osmid_t id, taglist_t const &tags, std::string const &geom)
 {
+    std::string &buffer = copy_writer->buffer();
+
     //add the osm id
-    buffer.append((single_fmt % id).str());
+    util::append_int(buffer, id);
     buffer.push_back('\t');
 
     // used to remember which columns have been written out already.
@@ -374,11 +446,8 @@ void table_t::write_row(osmid_t id, taglist_t const &tags, std::string const &ge
         copyMode = true;
     }
 
-    //send all the data to postgres
-    if (buffer.length() > BUFFER_SEND_SIZE) {
-        pgsql_CopyData(name.c_str(), sql_conn, buffer);
-        buffer.clear();
-    }
+    //the data goes to postgres in the background once enough is collected
+    copy_writer->row_done(sql_conn);
 }
 
 void table_t::write_columns(const taglist_t &tags, string& values, std::vector<bool> *used)
@@ -503,9 +572,9 @@ void table_t::escape_type(const string &value, ColumnType type, string& dst) {
                 long from, to;
                 int items = sscanf(value.c_str(), "%ld-%ld", &from, &to);
                 if (items == 1) {
-                    dst.append((single_fmt % from).str());
+                    util::append_int(dst, from);
                 } else if (items == 2) {
-                    dst.append((single_fmt % ((from + to) / 2)).str());
+                    util::append_int(dst, (from + to) / 2);
                 } else {
                     dst.append("\\N");
                 }
@@ -529,14 +598,14 @@ void table_t::escape_type(const string &value, ColumnType type, string& dst) {
                     if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
                         from *= 0.3048;
                     }
-                    dst.append((single_fmt % from).str());
+                    util::append_double(dst, from);
                 }
                 else if (items == 2) {
                     if (escaped.size() > 1 && escaped.substr(escaped.size() - 2).compare("ft") == 0) {
                         from *= 0.3048;
                         to *= 0.3048;
                     }
-                    dst.append((single_fmt % ((from + to) / 2)).str());
+                    util::append_double(dst, (from + to) / 2);
                 }
                 else {
                     dst.append("\\N");
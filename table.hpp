@@ -1,6 +1,7 @@
 #ifndef TABLE_H
 #define TABLE_H
 
+#include "metrics.hpp"
 #include "pgsql.hpp"
 #include "osmtypes.hpp"
 #include "taginfo.hpp"
@@ -14,6 +15,9 @@
 #include <boost/optional.hpp>
 #include <boost/format.hpp>
 
+class checkpoint_t;
+class copy_writer_t;
+
 typedef std::vector<std::string> hstores_t;
 
 class table_t
@@ -21,7 +25,9 @@ class table_t
     public:
         table_t(const std::string& conninfo, const std::string& name, const std::string& type, const columns_t& columns, const hstores_t& hstore_columns, const int srid,
                 const bool append, const bool slim, const bool droptemp, const int hstore_mode, const bool enable_hstore_index,
-                const boost::optional<std::string>& table_space, const boost::optional<std::string>& table_space_index);
+                const boost::optional<std::string>& table_space, const boost::optional<std::string>& table_space_index,
+                std::shared_ptr<checkpoint_t> const &checkpoint,
+                size_t copy_buffer_size);
         table_t(const table_t& other);
         ~table_t();
 
@@ -72,6 +78,7 @@ class table_t
         void connect();
         void stop_copy();
         void teardown();
+        void drop_indexes();
 
         void write_columns(const taglist_t &tags, std::string& values, std::vector<bool> *used);
         void write_tags_column(const taglist_t &tags, std::string& values,
@@ -86,7 +93,6 @@ class table_t
         std::string type;
         pg_conn *sql_conn;
         bool copyMode;
-        std::string buffer;
         std::string srid;
         bool append;
         bool slim;
@@ -98,8 +104,16 @@ class table_t
         std::string copystr;
         boost::optional<std::string> table_space;
         boost::optional<std::string> table_space_index;
+        std::shared_ptr<checkpoint_t> checkpoint;
+
+        boost::format del_fmt;
+
+        /// size in bytes at which collected rows are sent to the database
+        size_t copy_buffer_size;
+        std::unique_ptr<copy_writer_t> copy_writer;
 
-        boost::format single_fmt, del_fmt;
+        /// live count of bytes sent through COPY, shared by all clones
+        metrics::value_t &copy_bytes;
 };
 
 #endif
@@ -80,6 +80,49 @@ inline double test_lat(osmid_t id) {
     return 1 + 1e-5 * id;
 }
 
+int test_nodes_get_ways(middle_t *mid)
+{
+    buffer.clear();
+
+    std::vector<size_t> nodes;
+    for (osmid_t id = 1; id <= 5; ++id) {
+        nodes.push_back(add_node(id, test_lat(id), 0.0));
+        mid->nodes_set(buffer.get<osmium::Node>(nodes.back()));
+    }
+
+    // the ways go into their own buffer like relation members do,
+    // they share end nodes and node 6 is unknown
+    osmium::memory::Buffer ways(1024, osmium::memory::Buffer::auto_grow::yes);
+    {
+        using namespace osmium::builder::attr;
+        osmium::builder::add_way(ways, _id(1), _nodes({1, 2, 3}));
+        osmium::builder::add_way(ways, _id(2), _nodes({3, 4, 6}));
+        osmium::builder::add_way(ways, _id(3), _nodes({5, 1}));
+    }
+
+    if (mid->nodes_get_ways(&ways) != 7) {
+        std::cerr << "ERROR: Unable to get nodes of ways.\n";
+        return 1;
+    }
+
+    for (auto const &w : ways.select<osmium::Way>()) {
+        for (auto const &n : w.nodes()) {
+            if (n.ref() == 6) {
+                if (n.location().valid()) {
+                    std::cerr << "ERROR: Got location for unknown node.\n";
+                    return 1;
+                }
+            } else if (!node_okay(n.location(),
+                                  buffer.get<osmium::Node>(
+                                      nodes[static_cast<size_t>(n.ref() - 1)]))) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 int test_nodes_comprehensive_set(middle_t *mid)
 {
     std::vector<size_t> expected_nodes;
@@ -9,6 +9,10 @@ int test_node_set(middle_t *mid);
 // tests various combinations of nodes being set and retrieved to trigger different cache strategies. returns 0 on success.
 int test_nodes_comprehensive_set(middle_t *mid);
 
+// tests that the nodes of several ways sharing nodes can be retrieved at
+// once. returns 0 on success.
+int test_nodes_get_ways(middle_t *mid);
+
 // tests that a single way and supporting nodes can be set and retrieved.
 // returns 0 on success.
 int test_way_set(middle_t *mid);
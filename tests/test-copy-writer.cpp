@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <boost/format.hpp>
+
+#include <libpq-fe.h>
+
+#include "copy-writer.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+// A connection which is never established, so every send fails.
+PGconn *broken_connection()
+{
+    return PQconnectdb("host=/nonexistent/osm2pgsql dbname=none");
+}
+
+void test_buffered_until_full()
+{
+    PGconn *conn = broken_connection();
+    metrics::value_t bytes(0);
+
+    {
+        copy_writer_t writer("test", 100, &bytes);
+        writer.buffer() += "1\tfoo\n";
+        writer.row_done(conn);
+
+        // nothing has been sent yet, so nothing could have failed
+        ASSERT_EQ(writer.buffer().size(), 6);
+        ASSERT_EQ(bytes.load(), 0);
+    }
+
+    PQfinish(conn);
+}
+
+void test_send_error_reported()
+{
+    PGconn *conn = broken_connection();
+    metrics::value_t bytes(0);
+    bool thrown = false;
+
+    {
+        copy_writer_t writer("test", 10, &bytes);
+        try {
+            for (int i = 0; i < 10; ++i) {
+                writer.buffer() += "1\tsome row\n";
+                writer.row_done(conn);
+                ASSERT_EQ(writer.buffer().size(), 0);
+            }
+            writer.finish(conn);
+        } catch (std::runtime_error const &e) {
+            thrown = std::string(e.what()).find("test") == 0;
+        }
+    }
+
+    ASSERT_EQ(thrown, true);
+    ASSERT_EQ(bytes.load() > 0, true);
+
+    PQfinish(conn);
+}
+
+void test_finish_empty()
+{
+    PGconn *conn = broken_connection();
+
+    copy_writer_t writer("test", 10);
+    writer.finish(conn);
+
+    PQfinish(conn);
+}
+
+} // anonymous namespace
+
+int main()
+{
+    RUN_TEST(test_buffered_until_full);
+    RUN_TEST(test_send_error_reported);
+    RUN_TEST(test_finish_empty);
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "expire-tiles.hpp"
 #include "options.hpp"
+#include "osmium-builder.hpp"
 
 #include <iterator>
 #include <stdio.h>
@@ -10,6 +11,8 @@
 #include <boost/format.hpp>
 #include <set>
 
+#include <osmium/builder/attr.hpp>
+
 #define EARTH_CIRCUMFERENCE (40075016.68)
 
 namespace {
@@ -148,6 +151,26 @@ void test_expire_simple_z1() {
     ++itr;
 }
 
+// the update daemon writes one list per diff from the same object
+void test_expire_output_twice() {
+    uint32_t minzoom = 3;
+    expire_tiles et(minzoom, 20000, defproj);
+
+    et.from_bbox(-10000, -10000, 10000, 10000);
+    tile_output_set set1(minzoom);
+    et.output_and_destroy<tile_output_set>(set1, minzoom);
+    ASSERT_EQ(set1.m_tiles.size(), 4);
+
+    tile_output_set set2(minzoom);
+    et.output_and_destroy<tile_output_set>(set2, minzoom);
+    ASSERT_EQ(set2.m_tiles.size(), 0);
+
+    et.from_bbox(-7500000, -7500000, -7490000, -7490000);
+    tile_output_set set3(minzoom);
+    et.output_and_destroy<tile_output_set>(set3, minzoom);
+    ASSERT_EQ(set3.m_tiles.size(), 1);
+}
+
 void test_expire_simple_z3() {
     uint32_t minzoom = 3;
     expire_tiles et(minzoom, 20000, defproj);
@@ -438,6 +461,62 @@ void test_expire_merge_complete() {
   }
 }
 
+/**
+ * Expiry reported by the geometry builder must match the expiry computed
+ * from the WKB it produces.
+ */
+void check_builder_expire(osmium::Way const &way, bool polygon)
+{
+    geom::osmium_builder_t builder(defproj, false);
+    expire_tiles et_builder(16, 20000, defproj);
+    expire_tiles et_wkb(16, 20000, defproj);
+
+    builder.set_expire(&et_builder, way.id());
+    if (polygon) {
+        auto const wkb = builder.get_wkb_polygon(way);
+        ASSERT_EQ(wkb.empty(), false);
+        et_wkb.from_wkb(wkb.c_str(), way.id());
+    } else {
+        // small split distance to exercise the segment splitting
+        auto const wkbs = builder.get_wkb_line(way.nodes(), 3000);
+        ASSERT_EQ(wkbs.size() > 1, true);
+        for (auto const &wkb : wkbs) {
+            et_wkb.from_wkb(wkb.c_str(), way.id());
+        }
+    }
+
+    tile_output_set set_builder(16);
+    tile_output_set set_wkb(16);
+    et_builder.output_and_destroy(set_builder, 16);
+    et_wkb.output_and_destroy(set_wkb, 16);
+
+    ASSERT_EQ(set_builder.m_tiles.size() > 0, true);
+    ASSERT_EQ(set_builder.m_tiles.size(), set_wkb.m_tiles.size());
+    ASSERT_EQ(set_builder.m_tiles == set_wkb.m_tiles, true);
+}
+
+void test_expire_from_builder()
+{
+    using namespace osmium::builder::attr;
+    osmium::memory::Buffer buffer(1024, osmium::memory::Buffer::auto_grow::yes);
+
+    osmium::builder::add_way(
+        buffer, _id(17),
+        _nodes({{1, {9.50, 47.10}},
+                {2, {9.52, 47.10}},
+                {2, {9.52, 47.10}},
+                {3, {9.55, 47.13}},
+                {4, {9.51, 47.14}},
+                {1, {9.50, 47.10}}}));
+    auto const &way = buffer.get<osmium::Way>(0);
+
+    check_builder_expire(way, false);
+    check_builder_expire(way, true);
+    // again, now with projection and area from the builder's way cache
+    check_builder_expire(way, false);
+    check_builder_expire(way, true);
+}
+
 } // anonymous namespace
 
 int main(int argc, char *argv[])
@@ -458,6 +537,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_expire_merge_same);
     RUN_TEST(test_expire_merge_overlap);
     RUN_TEST(test_expire_merge_complete);
+    RUN_TEST(test_expire_from_builder);
+    RUN_TEST(test_expire_output_twice);
 
     //passed
     return 0;
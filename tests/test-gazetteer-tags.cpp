@@ -0,0 +1,95 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include "output-gazetteer.hpp"
+
+using namespace osmium::builder::attr;
+
+// the place rows written for the first object in the buffer
+std::string place_rows(osmium::memory::Buffer const &buffer)
+{
+  place_tag_processor places;
+  std::string out;
+
+  auto const &obj = *buffer.begin<osmium::OSMObject>();
+  places.process_tags(obj);
+  places.copy_out(obj, std::string(), out);
+
+  return out;
+}
+
+void check(char const *test, osmium::memory::Buffer const &buffer,
+           std::string const &expected)
+{
+  std::string const rows = place_rows(buffer);
+  if (rows != expected) {
+    std::cerr << "Expected: " << expected << "Got: " << rows;
+    throw std::runtime_error(std::string(test) + ": wrong place rows.");
+  }
+}
+
+// keys which are matched exactly before a more general prefix or suffix
+void test_name_collisions()
+{
+  osmium::memory::Buffer buffer(1024, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_node(buffer, _id(1),
+                            _tag("name", "Foo"),
+                            _tag("name:prefix", "Bar"),
+                            _tag("name:wikidata", "Q1"),
+                            _tag("pcode:1", "123"),
+                            _tag("boundary", "no"));
+
+  // boundary is taken even with "no", name:* that are extra tags are not
+  // names, pcode:* is a name that does not make the object named
+  check("test_name_collisions", buffer,
+        "N\t1\tboundary\tno\t\"name\"=>\"Foo\",\"pcode:1\"=>\"123\"\t15\t"
+        "\\N\t\"name:prefix\"=>\"Bar\",\"name:wikidata\"=>\"Q1\"\t\n");
+}
+
+void test_address_collisions()
+{
+  osmium::memory::Buffer buffer(1024, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_way(buffer, _id(2),
+                           _tag("addr:housename", "Haus"),
+                           _tag("is_in:country", "DE"));
+
+  // the house name is a name, is_in:country is the country code
+  check("test_address_collisions", buffer,
+        "W\t2\tplace\thouse\t\"addr:housename\"=>\"Haus\"\t15\t"
+        "\"country\"=>\"DE\"\t\\N\t\n");
+}
+
+void test_wikidata()
+{
+  osmium::memory::Buffer buffer(1024, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_relation(buffer, _id(3),
+                                _tag("brand:wikidata", "Q2"),
+                                _tag("wikidata", "Q3"),
+                                _tag("boundary", "administrative"),
+                                _tag("admin_level", "4"),
+                                _tag("name", "X"));
+
+  check("test_wikidata", buffer,
+        "R\t3\tboundary\tadministrative\t\"name\"=>\"X\"\t4\t\\N\t"
+        "\"brand:wikidata\"=>\"Q2\",\"wikidata\"=>\"Q3\"\t\n");
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    test_name_collisions();
+    test_address_collisions();
+    test_wikidata();
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "UNKNOWN ERROR" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
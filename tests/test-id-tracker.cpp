@@ -0,0 +1,236 @@
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "id-tracker.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+std::vector<osmid_t> pop_all(id_tracker &tracker)
+{
+    std::vector<osmid_t> ids;
+    osmid_t id;
+    while (id_tracker::is_valid((id = tracker.pop_mark()))) {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+void test_mark_pop()
+{
+    id_tracker tracker;
+    tracker.mark(70000);
+    tracker.mark(3);
+    tracker.mark(1);
+    tracker.mark(3);
+
+    ASSERT_EQ(tracker.size(), 3);
+    ASSERT_EQ(tracker.is_marked(3), true);
+    ASSERT_EQ(tracker.is_marked(2), false);
+
+    auto const ids = pop_all(tracker);
+    ASSERT_EQ(ids.size(), 3);
+    ASSERT_EQ(ids[0], 1);
+    ASSERT_EQ(ids[1], 3);
+    ASSERT_EQ(ids[2], 70000);
+    ASSERT_EQ(tracker.size(), 0);
+}
+
+void test_word_boundaries()
+{
+    id_tracker tracker;
+    std::vector<osmid_t> const expected = {0, 31, 32, 63, 64, 65, 127, 65535, 65536};
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it) {
+        tracker.mark(*it);
+    }
+
+    auto const ids = pop_all(tracker);
+    ASSERT_EQ(ids.size(), expected.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i], expected[i]);
+    }
+}
+
+void test_iterate()
+{
+    id_tracker tracker;
+    tracker.mark(-3);
+    tracker.mark(10);
+    tracker.mark(64);
+    tracker.mark(200000);
+
+    ASSERT_EQ(tracker.next_marked(id_tracker::min()), -3);
+    ASSERT_EQ(tracker.next_marked(11), 64);
+    ASSERT_EQ(tracker.next_marked(65), 200000);
+    ASSERT_EQ(id_tracker::is_valid(tracker.next_marked(200001)), false);
+
+    std::vector<osmid_t> ids;
+    tracker.for_each([&ids](osmid_t id) { ids.push_back(id); }, 0, 200000);
+    ASSERT_EQ(ids.size(), 2);
+    ASSERT_EQ(ids[0], 10);
+    ASSERT_EQ(ids[1], 64);
+
+    // iteration doesn't consume anything
+    ASSERT_EQ(tracker.size(), 4);
+}
+
+void test_set_operations()
+{
+    id_tracker a, b;
+    a.mark(1);
+    a.mark(2);
+    a.mark(100000);
+    b.mark(2);
+    b.mark(3);
+
+    id_tracker u;
+    u.set_union(a);
+    u.set_union(b);
+    ASSERT_EQ(u.size(), 4);
+    ASSERT_EQ(b.size(), 2);
+
+    id_tracker d;
+    d.set_union(a);
+    d.set_difference(b);
+    ASSERT_EQ(d.size(), 2);
+    ASSERT_EQ(d.is_marked(1), true);
+    ASSERT_EQ(d.is_marked(2), false);
+    ASSERT_EQ(d.is_marked(100000), true);
+
+    id_tracker i;
+    i.set_union(a);
+    i.set_intersection(b);
+    ASSERT_EQ(i.size(), 1);
+    ASSERT_EQ(i.is_marked(2), true);
+    ASSERT_EQ(i.is_marked(100000), false);
+    ASSERT_EQ(i.pop_mark(), 2);
+    ASSERT_EQ(id_tracker::is_valid(i.pop_mark()), false);
+}
+
+void test_merge()
+{
+    id_tracker a, b;
+    a.mark(1);
+    a.mark(100);
+    b.mark(100);
+    b.mark(200);
+    b.mark(1 << 20);
+
+    a.merge(b);
+
+    ASSERT_EQ(a.size(), 4);
+    ASSERT_EQ(b.size(), 0);
+    ASSERT_EQ(b.is_marked(200), false);
+
+    auto const ids = pop_all(a);
+    ASSERT_EQ(ids.size(), 4);
+    ASSERT_EQ(ids[0], 1);
+    ASSERT_EQ(ids[1], 100);
+    ASSERT_EQ(ids[2], 200);
+    ASSERT_EQ(ids[3], 1 << 20);
+}
+
+void test_merge_after_pop()
+{
+    id_tracker a, b;
+    a.mark(10);
+    a.mark(20);
+    ASSERT_EQ(a.pop_mark(), 10);
+
+    b.mark(5);
+    a.merge(b);
+
+    ASSERT_EQ(a.size(), 2);
+    ASSERT_EQ(a.pop_mark(), 5);
+    ASSERT_EQ(a.pop_mark(), 20);
+}
+
+void test_save_load()
+{
+    std::string const filename = "test-id-tracker.tmp";
+
+    id_tracker out;
+    // a sparse block
+    out.mark(-5);
+    out.mark(42);
+    // a dense block
+    for (osmid_t id = 1 << 20; id < (1 << 20) + 50000; id += 3) {
+        out.mark(id);
+    }
+    size_t const count = out.size();
+    out.save(filename);
+
+    id_tracker in;
+    in.mark(43);
+    in.load(filename);
+    remove(filename.c_str());
+
+    ASSERT_EQ(in.size(), count + 1);
+    ASSERT_EQ(in.is_marked(-5), true);
+    ASSERT_EQ(in.is_marked(42), true);
+    ASSERT_EQ(in.is_marked(43), true);
+    ASSERT_EQ(in.is_marked((1 << 20) + 3), true);
+    ASSERT_EQ(in.is_marked((1 << 20) + 4), false);
+
+    auto const ids = pop_all(in);
+    ASSERT_EQ(ids.size(), count + 1);
+    ASSERT_EQ(ids[0], -5);
+}
+
+void test_load_invalid()
+{
+    std::string const filename = "test-id-tracker.tmp";
+    FILE *f = fopen(filename.c_str(), "wb");
+    fputs("not a tracker", f);
+    fclose(f);
+
+    id_tracker tracker;
+    bool failed = false;
+    try {
+        tracker.load(filename);
+    } catch (std::runtime_error const &) {
+        failed = true;
+    }
+    remove(filename.c_str());
+
+    ASSERT_EQ(failed, true);
+    ASSERT_EQ(tracker.size(), 0);
+}
+
+} // anonymous namespace
+
+int main(int, char *[])
+{
+    RUN_TEST(test_mark_pop);
+    RUN_TEST(test_word_boundaries);
+    RUN_TEST(test_iterate);
+    RUN_TEST(test_set_operations);
+    RUN_TEST(test_merge);
+    RUN_TEST(test_merge_after_pop);
+    RUN_TEST(test_save_load);
+    RUN_TEST(test_load_invalid);
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <boost/format.hpp>
+
+#include "metrics.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+#define ASSERT_CONTAINS(haystack, needle) { if ((haystack).find(needle) == std::string::npos) { throw std::runtime_error((boost::format("Expecting '%1%' in output:\n%2%") % (needle) % (haystack)).str()); } }
+
+void test_same_counter()
+{
+    auto &a = metrics::counter("test_metric_total", "table=\"a\"");
+    auto &b = metrics::counter("test_metric_total", "table=\"b\"");
+    auto &a2 = metrics::counter("test_metric_total", "table=\"a\"");
+
+    ASSERT_EQ(&a, &a2);
+    ASSERT_EQ(&a == &b, false);
+}
+
+void test_render()
+{
+    metrics::counter("test_render_total", "type=\"node\"") += 42;
+    metrics::counter("test_render_total", "type=\"way\"") += 7;
+    metrics::gauge("test_render_queue") = 3;
+
+    std::string const out = metrics::render();
+
+    ASSERT_CONTAINS(out, "# TYPE test_render_total counter\n");
+    ASSERT_CONTAINS(out, "test_render_total{type=\"node\"} 42\n");
+    ASSERT_CONTAINS(out, "test_render_total{type=\"way\"} 7\n");
+    ASSERT_CONTAINS(out, "# TYPE test_render_queue gauge\n");
+    ASSERT_CONTAINS(out, "test_render_queue 3\n");
+}
+
+#ifndef _WIN32
+// connect to the server, retrying while it is not listening yet
+int connect_to(int port)
+{
+    for (int tries = 0; tries < 100; ++tries) {
+        int const fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+
+    throw std::runtime_error("Cannot connect to the metrics server.");
+}
+
+// a client which connects but never sends a request must not keep the
+// server from serving others or from shutting down
+void test_silent_client()
+{
+    std::unique_ptr<metrics::server_t> server(new metrics::server_t(0));
+
+    int const fd = connect_to(server->port());
+
+    // the server gives up on the client and closes the connection
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    char buf[16];
+    if (poll(&pfd, 1, 5000) != 1 || recv(fd, buf, sizeof(buf), 0) != 0) {
+        close(fd);
+        throw std::runtime_error("Idle client not dropped by the server.");
+    }
+    close(fd);
+
+    // another idle client while the server is stopped
+    int const fd2 = connect_to(server->port());
+
+    auto const start = std::chrono::steady_clock::now();
+    server.reset();
+    auto const waited = std::chrono::steady_clock::now() - start;
+    close(fd2);
+
+    if (waited > std::chrono::seconds(3)) {
+        throw std::runtime_error("Server shutdown blocked by idle client.");
+    }
+}
+#endif
+
+} // anonymous namespace
+
+int main(int, char *[])
+{
+    RUN_TEST(test_same_counter);
+    RUN_TEST(test_render);
+#ifndef _WIN32
+    RUN_TEST(test_silent_client);
+#endif
+
+    return 0;
+}
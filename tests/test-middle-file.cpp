@@ -0,0 +1,550 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include "osmtypes.hpp"
+#include "output-null.hpp"
+#include "options.hpp"
+#include "middle-file.hpp"
+
+#include "tests/middle-tests.hpp"
+#include "tests/common-cleanup.hpp"
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#define FLAT_NODES_FILE_NAME "tests/test_middle_file.flat.nodes.bin"
+
+void run_tests(options_t options)
+{
+  // the flat node file is kept between the runs, this one needs node 6
+  // to be unknown so it has to go first
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+
+    mid.start(&options);
+
+    if (test_nodes_get_ways(&mid) != 0) { throw std::runtime_error("test_nodes_get_ways failed."); }
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+
+    mid.start(&options);
+
+    if (test_node_set(&mid) != 0) { throw std::runtime_error("test_node_set failed."); }
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+
+    mid.start(&options);
+
+    if (test_nodes_comprehensive_set(&mid) != 0) { throw std::runtime_error("test_nodes_comprehensive_set failed."); }
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+}
+
+struct counting_processor_t : public middle_t::pending_processor {
+  void enqueue_ways(osmid_t id) override
+  {
+    if (id_tracker::is_valid(id)) { ways.push_back(id); }
+  }
+  void process_ways() override {}
+  void enqueue_relations(osmid_t id) override
+  {
+    if (id_tracker::is_valid(id)) { rels.push_back(id); }
+  }
+  void process_relations() override {}
+
+  std::vector<osmid_t> ways, rels;
+};
+
+// the data is still there after reopening and changes mark their parents
+void test_append(options_t options)
+{
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    osmium::builder::add_way(buffer, _id(10), _nodes({1, 2, 3}),
+                             _tag("highway", "primary"));
+    osmium::builder::add_way(buffer, _id(11), _nodes({3, 4}));
+    osmium::builder::add_relation(buffer, _id(20),
+                                  _member(osmium::item_type::way, 10, "outer"),
+                                  _member(osmium::item_type::way, 11, "outer"),
+                                  _tag("type", "multipolygon"));
+    osmium::builder::add_relation(buffer, _id(21),
+                                  _member(osmium::item_type::relation, 20, ""));
+  }
+
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.start(&options);
+
+    for (auto const &way : buffer.select<osmium::Way>()) {
+      mid.ways_set(way);
+    }
+    for (auto const &rel : buffer.select<osmium::Relation>()) {
+      mid.relations_set(rel);
+    }
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+
+  options.append = true;
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid.ways_get(10, outbuf) || !mid.relations_get(20, outbuf) ||
+      mid.ways_get(12, outbuf)) {
+    throw std::runtime_error("test_append: stored objects not found.");
+  }
+  if (strcmp(outbuf.get<osmium::Way>(0).tags()["highway"], "primary") != 0) {
+    throw std::runtime_error("test_append: way not stored correctly.");
+  }
+
+  auto rels = mid.relations_using_way(11);
+  if (rels.size() != 1 || rels[0] != 20) {
+    throw std::runtime_error("test_append: relations_using_way failed.");
+  }
+
+  // node 3 moves: both ways and, through them, the relations are pending
+  mid.node_changed(3);
+  mid.way_changed(10);
+  mid.relation_changed(20);
+  mid.commit();
+
+  counting_processor_t proc;
+  mid.iterate_ways(proc);
+  mid.iterate_relations(proc);
+  if (proc.ways != std::vector<osmid_t>({10, 11}) || proc.rels != std::vector<osmid_t>({20, 21})) {
+    throw std::runtime_error("test_append: wrong pending objects.");
+  }
+
+  // way 11 goes away and with it its reverse index entries
+  mid.ways_delete(11);
+  mid.relations_delete(20);
+  mid.node_changed(4);
+  mid.commit();
+
+  counting_processor_t proc2;
+  mid.iterate_ways(proc2);
+  mid.iterate_relations(proc2);
+  // the members of the deleted relation have to be looked at again
+  if (proc2.ways != std::vector<osmid_t>({10, 11}) || !proc2.rels.empty() ||
+      !mid.relations_using_way(11).empty() || mid.ways_get(11, outbuf)) {
+    throw std::runtime_error("test_append: delete failed.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+}
+
+// an index entry written out before its data was is dropped from the log
+void test_lost_data(options_t options)
+{
+  options.append = true;
+  std::string const name = *options.middle_dir + "/ways.dat";
+
+  {
+    std::FILE *data = fopen(name.c_str(), "rb");
+    std::FILE *log = fopen((name + ".idx").c_str(), "ab");
+    if (!data || !log || fseek(data, 0, SEEK_END) != 0) {
+      throw std::runtime_error("test_lost_data: cannot open middle files.");
+    }
+    // points exactly where the next way is going to be written
+    std::pair<osmid_t, uint64_t> entry(12, static_cast<uint64_t>(ftell(data)) + 1);
+    fwrite(&entry, sizeof(entry), 1, log);
+    fclose(log);
+    fclose(data);
+  }
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_way(buffer, osmium::builder::attr::_id(13),
+                           osmium::builder::attr::_nodes({5, 6}));
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.start(&options);
+
+    if (mid.ways_get(12, outbuf)) {
+      throw std::runtime_error("test_lost_data: way without data found.");
+    }
+    mid.ways_set(buffer.get<osmium::Way>(0));
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+
+  if (mid.ways_get(12, outbuf) || !mid.ways_get(13, outbuf) ||
+      !mid.ways_get(10, outbuf)) {
+    throw std::runtime_error("test_lost_data: wrong ways after reopening.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+}
+
+// a half-written object and a half-written log record are dropped
+void test_torn_files(options_t options)
+{
+  options.append = true;
+  std::string const name = *options.middle_dir + "/ways.dat";
+
+  {
+    std::FILE *data = fopen(name.c_str(), "ab");
+    std::FILE *log = fopen((name + ".idx").c_str(), "ab");
+    if (!data || !log || fseek(data, 0, SEEK_END) != 0) {
+      throw std::runtime_error("test_torn_files: cannot open middle files.");
+    }
+    // the object claims to be longer than what made it to the disk
+    std::pair<osmid_t, uint64_t> entry(14, static_cast<uint64_t>(ftell(data)) + 1);
+    uint32_t const size = 64;
+    fwrite(&size, sizeof(size), 1, data);
+    fwrite(&size, sizeof(size), 1, data);
+    fwrite(&entry, sizeof(entry), 1, log);
+    fwrite(&entry, 7, 1, log);
+    fclose(log);
+    fclose(data);
+  }
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_way(buffer, osmium::builder::attr::_id(15),
+                           osmium::builder::attr::_nodes({5, 6}));
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.start(&options);
+
+    if (mid.ways_get(14, outbuf)) {
+      throw std::runtime_error("test_torn_files: incomplete way found.");
+    }
+    mid.ways_set(buffer.get<osmium::Way>(0));
+
+    osmium::thread::Pool pool(1);
+    mid.commit();
+    mid.stop(pool);
+  }
+
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+
+  outbuf.clear();
+  if (mid.ways_get(14, outbuf) || !mid.ways_get(15, outbuf) ||
+      outbuf.get<osmium::Way>(0).nodes().size() != 2 ||
+      !mid.ways_get(13, outbuf) || !mid.ways_get(10, outbuf)) {
+    throw std::runtime_error("test_torn_files: wrong ways after reopening.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+}
+
+bool file_exists(std::string const &name)
+{
+  if (std::FILE *f = fopen(name.c_str(), "rb")) {
+    fclose(f);
+    return true;
+  }
+  return false;
+}
+
+// an interrupted import is finished with only resume() and stop()
+void test_resume(options_t options)
+{
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.resume(&options);
+    osmium::thread::Pool pool(1);
+    mid.stop(pool);
+  }
+
+  options.append = true;
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid.ways_get(10, outbuf) || mid.relations_using_way(10).size() != 0) {
+    throw std::runtime_error("test_resume: data changed by resuming.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+}
+
+// query instances see what the middle wrote before the commit
+void test_query_instance(options_t options)
+{
+  options.append = true;
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_way(buffer, osmium::builder::attr::_id(30),
+                           osmium::builder::attr::_nodes({1, 2}));
+
+  auto mid = std::make_shared<middle_file_t>();
+  output_null_t out_test(mid.get(), options);
+  mid->start(&options);
+  mid->ways_set(buffer.get<osmium::Way>(0));
+
+  // the middle itself reads its own unflushed writes
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid->ways_get(30, outbuf)) {
+    throw std::runtime_error("test_query_instance: new way not found.");
+  }
+
+  mid->commit();
+  auto query = mid->get_query_instance(mid);
+  outbuf.clear();
+  if (!query->ways_get(30, outbuf) ||
+      outbuf.get<osmium::Way>(0).nodes().size() != 2) {
+    throw std::runtime_error("test_query_instance: way not found.");
+  }
+  query.reset();
+
+  osmium::thread::Pool pool(1);
+  mid->stop(pool);
+}
+
+long file_size(std::string const &name)
+{
+  std::FILE *f = fopen(name.c_str(), "rb");
+  if (!f || fseek(f, 0, SEEK_END) != 0) {
+    throw std::runtime_error("cannot open " + name);
+  }
+  long const size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+// the log is folded into the index file and replaced objects are dropped
+// from the data file when the middle is closed
+void test_checkpoint(options_t options)
+{
+  options.append = true;
+  std::string const name = *options.middle_dir + "/ways.dat";
+
+  // left behind by a copy of the data which did not finish
+  std::fclose(fopen((name + ".new").c_str(), "wb"));
+
+  long size = 0;
+  {
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.start(&options);
+
+    for (int i = 0; i < 20; ++i) {
+      osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+      osmium::builder::add_way(buffer, osmium::builder::attr::_id(10),
+                               osmium::builder::attr::_nodes({1, 2, 3}),
+                               osmium::builder::attr::_tag("v", std::to_string(i)));
+      mid.ways_delete(10);
+      mid.ways_set(buffer.get<osmium::Way>(0));
+    }
+    mid.ways_delete(13);
+    mid.commit();
+    size = file_size(name);
+
+    osmium::thread::Pool pool(1);
+    mid.stop(pool);
+  }
+
+  if (file_exists(name + ".new") || file_size(name + ".idx") != 0 ||
+      !file_exists(name + ".ids") || file_size(name) * 2 > size) {
+    throw std::runtime_error("test_checkpoint: middle files not compacted.");
+  }
+
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid.ways_get(10, outbuf) ||
+      strcmp(outbuf.get<osmium::Way>(0).tags()["v"], "19") != 0 ||
+      mid.ways_get(13, outbuf) || !mid.ways_get(15, outbuf)) {
+    throw std::runtime_error("test_checkpoint: wrong ways after compaction.");
+  }
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+}
+
+// the reverse indexes are not needed when the middle is dropped
+void test_drop_on_import(options_t options)
+{
+  options.droptemp = true;
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  osmium::builder::add_way(buffer, osmium::builder::attr::_id(10),
+                           osmium::builder::attr::_nodes({1, 2}));
+
+  middle_file_t mid;
+  output_null_t out_test(&mid, options);
+  mid.start(&options);
+  mid.ways_set(buffer.get<osmium::Way>(0));
+  mid.commit();
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid.ways_get(10, outbuf)) {
+    throw std::runtime_error("test_drop_on_import: way not stored.");
+  }
+  for (auto const &name : {"tests/node-ways.idx", "tests/node-ways.idx.log",
+                           "tests/node-ways.idx.0"}) {
+    if (file_exists(name)) {
+      throw std::runtime_error("test_drop_on_import: reverse index written.");
+    }
+  }
+
+  osmium::thread::Pool pool(1);
+  mid.stop(pool);
+
+  if (file_exists("tests/ways.dat")) {
+    throw std::runtime_error("test_drop_on_import: middle files not removed.");
+  }
+}
+
+std::vector<osmid_t> parents(reverse_index_t const &idx, osmid_t member)
+{
+  std::vector<osmid_t> result;
+  idx.for_each_parent(member, [&](osmid_t p) { result.push_back(p); });
+  return result;
+}
+
+// a tiny change buffer so that runs are written and merged all the time
+void test_reverse_index()
+{
+  std::string const name = "tests/test_middle_file.rev.idx";
+  {
+    reverse_index_t idx(name, false, 4);
+    for (osmid_t p = 1; p <= 50; ++p) {
+      idx.add(p % 5, p);
+    }
+    if (!parents(idx, 1).empty()) {
+      throw std::runtime_error("test_reverse_index: changes visible before merge.");
+    }
+    idx.merge();
+    if (parents(idx, 1) != std::vector<osmid_t>({1, 6, 11, 16, 21, 26, 31, 36, 41, 46})) {
+      throw std::runtime_error("test_reverse_index: add failed.");
+    }
+
+    for (osmid_t p = 1; p <= 50; p += 2) {
+      idx.remove(p % 5, p);
+    }
+    idx.add(7, 100);
+    idx.remove(7, 100);
+    idx.add(7, 101);
+    idx.add(8, -3);
+    idx.add(8, -4);
+    idx.remove(8, -4);
+    idx.merge();
+    if (parents(idx, 1) != std::vector<osmid_t>({6, 16, 26, 36, 46}) ||
+        parents(idx, 7) != std::vector<osmid_t>({101}) ||
+        parents(idx, 8) != std::vector<osmid_t>({-3})) {
+      throw std::runtime_error("test_reverse_index: remove failed.");
+    }
+
+    // there is only a log when updating
+    if (file_exists(name + ".log")) {
+      throw std::runtime_error("test_reverse_index: log written on import.");
+    }
+  }
+  {
+    // stays in the log only
+    reverse_index_t idx(name, true, 4);
+    idx.add(1, 200);
+    idx.flush();
+  }
+  {
+    reverse_index_t idx(name, true, 4);
+    if (parents(idx, 1) != std::vector<osmid_t>({6, 16, 26, 36, 46, 200}) ||
+        parents(idx, 2) != std::vector<osmid_t>({2, 12, 22, 32, 42}) ||
+        parents(idx, 7) != std::vector<osmid_t>({101})) {
+      throw std::runtime_error("test_reverse_index: reopening failed.");
+    }
+    idx.remove_files();
+  }
+
+  for (auto const &suffix : {"", ".log", ".0", ".1", ".2", ".10", ".20"}) {
+    if (file_exists(name + suffix)) {
+      throw std::runtime_error("test_reverse_index: files not removed.");
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    options_t options;
+    options.slim = true;
+    options.cache = 1;
+    options.flat_node_cache_enabled = true;
+    options.flat_node_file = boost::optional<std::string>(FLAT_NODES_FILE_NAME);
+    options.middle_dir = std::string("tests");
+
+    cleanup::file flat_nodes_file(FLAT_NODES_FILE_NAME);
+
+    test_reverse_index();
+    run_tests(options);
+    test_append(options);
+    test_lost_data(options);
+    test_query_instance(options);
+    test_torn_files(options);
+    test_resume(options);
+    test_checkpoint(options);
+
+    // clean up the files, --drop works when resuming too
+    options.droptemp = true;
+    middle_file_t mid;
+    output_null_t out_test(&mid, options);
+    mid.resume(&options);
+    osmium::thread::Pool pool(1);
+    mid.stop(pool);
+
+    for (auto const &name : {"tests/ways.dat", "tests/ways.dat.idx",
+                             "tests/node-ways.idx", "tests/node-ways.idx.log"}) {
+      if (file_exists(name)) {
+        throw std::runtime_error("resume with --drop left middle files behind.");
+      }
+    }
+
+    test_drop_on_import(options);
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "UNKNOWN ERROR" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -54,6 +54,18 @@ void run_tests(options_t options, const std::string cache_type) {
     mid_pgsql.commit();
     mid_pgsql.stop(pool);
   }
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
+    mid_pgsql.start(&options);
+
+    if (test_nodes_get_ways(&mid_pgsql) != 0) { throw std::runtime_error("test_nodes_get_ways failed."); }
+
+    osmium::thread::Pool pool(1);
+    mid_pgsql.commit();
+    mid_pgsql.stop(pool);
+  }
   /* This should work, but doesn't. More tests are needed that look at updates
      without the complication of ways.
   */
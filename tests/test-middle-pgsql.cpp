@@ -18,6 +18,100 @@
 #include "tests/middle-tests.hpp"
 #include "tests/common-pg.hpp"
 
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+// objects fetched ahead are the same as those fetched one by one
+void test_prefetch(options_t options)
+{
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    for (osmid_t i = 1; i <= 4; ++i) {
+      osmium::builder::add_node(buffer, _id(i),
+                                _location(osmium::Location(1.0 * i, 2.0 * i)));
+    }
+    osmium::builder::add_way(buffer, _id(1), _nodes({1, 2, 3}),
+                             _tag("highway", "primary"));
+    osmium::builder::add_way(buffer, _id(2), _nodes({3, 4}));
+    osmium::builder::add_relation(buffer, _id(5),
+                                  _member(osmium::item_type::way, 1, "outer"),
+                                  _member(osmium::item_type::node, 4, ""),
+                                  _tag("type", "multipolygon"));
+  }
+
+  options.append = false;
+  options.create = true;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+    mid_pgsql.start(&options);
+
+    for (auto const &node : buffer.select<osmium::Node>()) {
+      mid_pgsql.nodes_set(node);
+    }
+    for (auto const &way : buffer.select<osmium::Way>()) {
+      mid_pgsql.ways_set(way);
+    }
+    for (auto const &rel : buffer.select<osmium::Relation>()) {
+      mid_pgsql.relations_set(rel);
+    }
+
+    osmium::thread::Pool pool(1);
+    mid_pgsql.commit();
+    mid_pgsql.stop(pool);
+  }
+
+  // a new middle starts with an empty node cache
+  options.append = true;
+  options.create = false;
+  auto mid_pgsql = std::make_shared<middle_pgsql_t>();
+  output_null_t out_test(mid_pgsql.get(), options);
+  mid_pgsql->start(&options);
+  auto query = mid_pgsql->get_query_instance(mid_pgsql);
+
+  idlist_t ids;
+  ids.push_back(1);
+  ids.push_back(2);
+  ids.push_back(999);
+  query->ways_prefetch(ids);
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!query->ways_get(1, outbuf) || query->ways_get(999, outbuf)) {
+    throw std::runtime_error("test_prefetch: ways_get failed.");
+  }
+  auto &way = outbuf.get<osmium::Way>(0);
+  if (way.nodes().size() != 3 || strcmp(way.tags()["highway"], "primary") != 0) {
+    throw std::runtime_error("test_prefetch: wrong way.");
+  }
+  if (query->nodes_get_list(&way.nodes()) != 3 ||
+      way.nodes()[2].location() != osmium::Location(3.0, 6.0)) {
+    throw std::runtime_error("test_prefetch: wrong node locations.");
+  }
+
+  idlist_t rel_ids;
+  rel_ids.push_back(5);
+  query->relations_prefetch(rel_ids);
+  outbuf.clear();
+  if (!query->relations_get(5, outbuf) ||
+      outbuf.get<osmium::Relation>(0).members().size() != 2) {
+    throw std::runtime_error("test_prefetch: relations_get failed.");
+  }
+
+  // without anything prefetched the database is asked
+  query->ways_prefetch(idlist_t());
+  query->relations_prefetch(idlist_t());
+  outbuf.clear();
+  if (!query->ways_get(2, outbuf) || !query->relations_get(5, outbuf)) {
+    throw std::runtime_error("test_prefetch: lookup after prefetch failed.");
+  }
+
+  query.reset();
+  osmium::thread::Pool pool(1);
+  mid_pgsql->commit();
+  mid_pgsql->stop(pool);
+}
+
 void run_tests(options_t options, const std::string cache_type) {
   options.append = false;
   options.create = true;
@@ -49,6 +143,18 @@ void run_tests(options_t options, const std::string cache_type) {
     middle_pgsql_t mid_pgsql;
     output_null_t out_test(&mid_pgsql, options);
 
+    mid_pgsql.start(&options);
+
+    if (test_nodes_get_ways(&mid_pgsql) != 0) { throw std::runtime_error("test_nodes_get_ways failed."); }
+
+    osmium::thread::Pool pool(1);
+    mid_pgsql.commit();
+    mid_pgsql.stop(pool);
+  }
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+
     mid_pgsql.start(&options);
     {
         osmium::thread::Pool pool(1);
@@ -89,6 +195,7 @@ int main(int argc, char *argv[]) {
 
     options.alloc_chunkwise = ALLOC_SPARSE | ALLOC_DENSE; // what you get with optimized
     run_tests(options, "optimized");
+    test_prefetch(options);
     options.alloc_chunkwise = ALLOC_SPARSE;
     run_tests(options, "sparse");
 
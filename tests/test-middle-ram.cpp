@@ -4,6 +4,7 @@
 #include <string.h>
 #include <cassert>
 #include <stdexcept>
+#include <vector>
 
 #include "osmtypes.hpp"
 #include "output-null.hpp"
@@ -12,6 +13,9 @@
 
 #include "tests/middle-tests.hpp"
 
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
 void run_tests(const options_t options, const std::string cache_type) {
   {
     middle_ram_t mid_ram;
@@ -46,6 +50,118 @@ void run_tests(const options_t options, const std::string cache_type) {
     mid_ram.commit();
     mid_ram.stop(pool);
   }
+  {
+    middle_ram_t mid_ram;
+    output_null_t out_test(&mid_ram, options);
+
+    mid_ram.start(&options);
+
+    if (test_nodes_get_ways(&mid_ram) != 0) { throw std::runtime_error("test_nodes_get_ways failed with " + cache_type + " cache."); }
+    osmium::thread::Pool pool(1);
+    mid_ram.commit();
+    mid_ram.stop(pool);
+  }
+}
+
+// the index handles ids far beyond 32 bit and iterates in id order
+void test_elem_cache_64bit()
+{
+  elem_cache_t<uint64_t, 10> cache;
+  std::vector<osmid_t> const ids = {-(osmid_t(1) << 40), -5, 3, 1024,
+                                    (osmid_t(1) << 32) + 17,
+                                    (osmid_t(1) << 62) + 1};
+  for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+    cache.set(*it, static_cast<uint64_t>(*it) | 1);
+  }
+
+  for (auto id : ids) {
+    if (cache.get(id) != (static_cast<uint64_t>(id) | 1)) {
+      throw std::runtime_error("test_elem_cache_64bit: wrong value for id.");
+    }
+  }
+  if (cache.get(4) != 0 || cache.get(osmid_t(1) << 32) != 0) {
+    throw std::runtime_error("test_elem_cache_64bit: unset id found.");
+  }
+
+  std::vector<osmid_t> seen;
+  cache.for_each([&seen](osmid_t id, uint64_t) { seen.push_back(id); });
+  if (seen != ids) {
+    throw std::runtime_error("test_elem_cache_64bit: wrong iteration order.");
+  }
+
+  cache.clear();
+  if (cache.get(3) != 0) {
+    throw std::runtime_error("test_elem_cache_64bit: clear failed.");
+  }
+}
+
+// ways keep the node locations they came with, no nodes are needed
+void test_locations_on_ways(options_t options)
+{
+  options.locations_on_ways = true;
+
+  middle_ram_t mid_ram;
+  output_null_t out_test(&mid_ram, options);
+
+  mid_ram.start(&options);
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    osmium::builder::add_way(buffer, _id(1),
+                             _nodes({{1, {1.5, 2.5}}, {2, {3.5, 4.5}}}));
+  }
+  mid_ram.ways_set(buffer.get<osmium::Way>(0));
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid_ram.ways_get(1, outbuf)) {
+    throw std::runtime_error("test_locations_on_ways: way not found.");
+  }
+
+  auto &way = outbuf.get<osmium::Way>(0);
+  if (mid_ram.nodes_get_list(&(way.nodes())) != 2 ||
+      way.nodes()[0].location() != osmium::Location(1.5, 2.5) ||
+      way.nodes()[1].location() != osmium::Location(3.5, 4.5)) {
+    throw std::runtime_error("test_locations_on_ways: locations not kept.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid_ram.commit();
+  mid_ram.stop(pool);
+}
+
+// relations come back with tags and members but without metadata
+void test_relation_set(options_t options)
+{
+  middle_ram_t mid_ram;
+  output_null_t out_test(&mid_ram, options);
+
+  mid_ram.start(&options);
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    osmium::builder::add_relation(buffer, _id(7), _version(3), _user("someone"),
+                                  _member(osmium::item_type::way, 12, "outer"),
+                                  _tag("type", "multipolygon"));
+  }
+  mid_ram.relations_set(buffer.get<osmium::Relation>(0));
+
+  osmium::memory::Buffer outbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+  if (!mid_ram.relations_get(7, outbuf) || mid_ram.relations_get(8, outbuf)) {
+    throw std::runtime_error("test_relation_set: wrong relations found.");
+  }
+
+  auto const &rel = outbuf.get<osmium::Relation>(0);
+  if (rel.id() != 7 || rel.version() != 0 || rel.members().size() != 1 ||
+      strcmp(rel.members().begin()->role(), "outer") != 0 ||
+      strcmp(rel.tags()["type"], "multipolygon") != 0) {
+    throw std::runtime_error("test_relation_set: relation not stored correctly.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid_ram.commit();
+  mid_ram.stop(pool);
 }
 
 int main(int argc, char *argv[]) {
@@ -64,6 +180,10 @@ int main(int argc, char *argv[]) {
 
     options.alloc_chunkwise = ALLOC_DENSE | ALLOC_DENSE_CHUNK; // what you get with chunk
     run_tests(options, "chunk");
+
+    test_elem_cache_64bit();
+    test_locations_on_ways(options);
+    test_relation_set(options);
   } catch (const std::exception &e) {
     std::cerr << "ERROR: " << e.what() << std::endl;
     return 1;
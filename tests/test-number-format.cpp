@@ -0,0 +1,81 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <boost/format.hpp>
+
+#include "number-format.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+template <typename T>
+std::string int_str(T value)
+{
+    std::string out("x");
+    util::append_int(out, value);
+    return out;
+}
+
+std::string double_str(double value)
+{
+    std::string out;
+    util::append_double(out, value);
+    return out;
+}
+
+void test_int()
+{
+    ASSERT_EQ(int_str(0), "x0");
+    ASSERT_EQ(int_str(7), "x7");
+    ASSERT_EQ(int_str(-42), "x-42");
+    ASSERT_EQ(int_str(int64_t(4294967296)), "x4294967296");
+    ASSERT_EQ(int_str(std::numeric_limits<int64_t>::max()),
+              "x9223372036854775807");
+    ASSERT_EQ(int_str(std::numeric_limits<int64_t>::min()),
+              "x-9223372036854775808");
+    ASSERT_EQ(int_str(std::numeric_limits<int32_t>::min()), "x-2147483648");
+    ASSERT_EQ(int_str(size_t(1234567890)), "x1234567890");
+}
+
+void test_double()
+{
+    ASSERT_EQ(double_str(0.0), "0");
+    ASSERT_EQ(double_str(0.1), "0.1");
+    ASSERT_EQ(double_str(-311.289), "-311.289");
+    ASSERT_EQ(double_str(1.70718e-08), "1.70718e-08");
+    ASSERT_EQ(double_str(1e20), "1e+20");
+    ASSERT_EQ(double_str(1.0 / 3.0), "0.333333");
+    ASSERT_EQ(double_str(12.3456789), "12.3457");
+    ASSERT_EQ(double_str(1234567.0), "1.23457e+06");
+}
+
+} // anonymous namespace
+
+int main()
+{
+    RUN_TEST(test_int);
+    RUN_TEST(test_double);
+
+    return 0;
+}
@@ -1,3 +1,4 @@
+#include "checkpoint.hpp"
 #include "options.hpp"
 #include "middle-pgsql.hpp"
 #include "middle-ram.hpp"
@@ -63,13 +64,25 @@ void test_incompatible_args()
 
     const char* a3[] = {"osm2pgsql", "-j", "-k", "tests/liechtenstein-2013-08-03.osm.pbf"};
     parse_fail(len(a3), a3, "you can not specify both");
+
+    const char* a4[] = {"osm2pgsql", "-a", "--slim", "--resume", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    parse_fail(len(a4), a4, "--resume can only be used with imports");
+
+    const char* a5[] = {"osm2pgsql", "--slim", "--update-daemon"};
+    parse_fail(len(a5), a5, "--update-daemon can only be used with --append");
+
+    const char* a6[] = {"osm2pgsql", "--slim", "--locations-on-ways", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    parse_fail(len(a6), a6, "--locations-on-ways can not be used with --slim");
+
+    const char* a7[] = {"osm2pgsql", "-a", "--slim", "--checkpoints", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    parse_fail(len(a7), a7, "--checkpoints can only be used with imports");
 }
 
 void test_middles()
 {
     const char* a1[] = {"osm2pgsql", "--slim", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options_t options = options_t(len(a1), const_cast<char **>(a1));
-    std::shared_ptr<middle_t> mid = middle_t::create_middle(options.slim);
+    std::shared_ptr<middle_t> mid = middle_t::create_middle(options);
     if(dynamic_cast<middle_pgsql_t *>(mid.get()) == nullptr)
     {
         throw std::logic_error("Using slim mode we expected a pgsql middle");
@@ -77,7 +90,7 @@ void test_middles()
 
     const char* a2[] = {"osm2pgsql", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a2), const_cast<char **>(a2));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     if(dynamic_cast<middle_ram_t *>(mid.get()) == nullptr)
     {
         throw std::logic_error("Using without slim mode we expected a ram middle");
@@ -88,7 +101,7 @@ void test_outputs()
 {
     const char* a1[] = {"osm2pgsql", "-O", "pgsql", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options_t options = options_t(len(a1), const_cast<char **>(a1));
-    std::shared_ptr<middle_t> mid = middle_t::create_middle(options.slim);
+    std::shared_ptr<middle_t> mid = middle_t::create_middle(options);
     std::vector<std::shared_ptr<output_t> > outs = output_t::create_outputs(mid.get(), options);
     output_t* out = outs.front().get();
     if(dynamic_cast<output_pgsql_t *>(out) == nullptr)
@@ -98,7 +111,7 @@ void test_outputs()
 
     const char* a2[] = {"osm2pgsql", "-O", "gazetteer", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a2), const_cast<char **>(a2));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     outs = output_t::create_outputs(mid.get(), options);
     out = outs.front().get();
     if(dynamic_cast<output_gazetteer_t *>(out) == nullptr)
@@ -108,7 +121,7 @@ void test_outputs()
 
     const char* a3[] = {"osm2pgsql", "-O", "null", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a3), const_cast<char **>(a3));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     outs = output_t::create_outputs(mid.get(), options);
     out = outs.front().get();
     if(dynamic_cast<output_null_t *>(out) == nullptr)
@@ -118,7 +131,7 @@ void test_outputs()
 
     const char* a4[] = {"osm2pgsql", "-O", "keine_richtige_ausgabe", "--style", "default.style", "tests/liechtenstein-2013-08-03.osm.pbf"};
     options = options_t(len(a4), const_cast<char **>(a4));
-    mid = middle_t::create_middle(options.slim);
+    mid = middle_t::create_middle(options);
     try
     {
         outs = output_t::create_outputs(mid.get(), options);
@@ -444,6 +457,29 @@ void test_random_perms()
     }
 }
 
+void test_fingerprint()
+{
+    const char* a1[] = {"osm2pgsql", "--slim", "-j", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    const char* a2[] = {"osm2pgsql", "--slim", "-j", "--number-processes", "3", "--checkpoints", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    const char* a3[] = {"osm2pgsql", "--slim", "tests/liechtenstein-2013-08-03.osm.pbf"};
+    const char* a4[] = {"osm2pgsql", "--slim", "-j", "tests/test_multipolygon.osm"};
+
+    std::string const fingerprint = import_fingerprint(options_t(len(a1), const_cast<char **>(a1)));
+
+    if (fingerprint.find("input files=tests/liechtenstein-2013-08-03.osm.pbf (") == std::string::npos)
+        throw std::logic_error((boost::format("Input file missing in fingerprint: %1%") % fingerprint).str());
+
+    // options which don't change the data may differ
+    if (import_fingerprint(options_t(len(a2), const_cast<char **>(a2))) != fingerprint)
+        throw std::logic_error("Fingerprint changed by number of processes");
+
+    if (import_fingerprint(options_t(len(a3), const_cast<char **>(a3))) == fingerprint)
+        throw std::logic_error("Fingerprint not changed by hstore mode");
+
+    if (import_fingerprint(options_t(len(a4), const_cast<char **>(a4))) == fingerprint)
+        throw std::logic_error("Fingerprint not changed by input file");
+}
+
 int main(int argc, char *argv[])
 {
     srand(0);
@@ -459,6 +495,7 @@ int main(int argc, char *argv[])
              test_parsing_tile_expiry_zoom_levels_fails);
     run_test("test_parsing_tile_expiry_zoom_levels",
              test_parsing_tile_expiry_zoom_levels);
+    run_test("test_fingerprint", test_fingerprint);
 
     //passed
     return 0;
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include "osmium-builder.hpp"
+#include "reprojection.hpp"
+
+using namespace osmium::builder::attr;
+
+namespace {
+
+std::shared_ptr<reprojection> proj(reprojection::create_projection(PROJ_SPHERE_MERC));
+
+typedef std::vector<std::pair<double, double>> locations_t;
+
+// a way with the given node ids and locations, added to the buffer
+osmium::Way &add_way(osmium::memory::Buffer &buffer, osmid_t id,
+                     std::vector<osmid_t> const &ids, locations_t const &locs)
+{
+  std::vector<osmium::NodeRef> nodes;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    nodes.emplace_back(ids[i], osmium::Location(locs[i].first, locs[i].second));
+  }
+
+  auto const pos = osmium::builder::add_way(buffer, _id(id), _nodes(nodes));
+  return buffer.get<osmium::Way>(pos);
+}
+
+std::string line(geom::osmium_builder_t &builder, osmium::Way const &way)
+{
+  auto const wkbs = builder.get_wkb_line(way.nodes(), 0.0);
+  if (wkbs.size() != 1) {
+    throw std::runtime_error("Building a line failed.");
+  }
+  return wkbs[0];
+}
+
+std::string polygon(geom::osmium_builder_t &builder, osmium::Way const &way)
+{
+  auto const wkb = builder.get_wkb_polygon(way);
+  if (wkb.empty()) {
+    throw std::runtime_error("Building a polygon failed.");
+  }
+  return wkb;
+}
+
+// built without a cache
+std::string line(osmium::Way const &way)
+{
+  geom::osmium_builder_t builder(proj, false);
+  return line(builder, way);
+}
+
+std::string polygon(osmium::Way const &way)
+{
+  geom::osmium_builder_t builder(proj, false);
+  return polygon(builder, way);
+}
+
+locations_t const square = {
+    {9.0, 47.0}, {9.1, 47.0}, {9.1, 47.1}, {9.0, 47.1}, {9.0, 47.0}};
+
+// builders sharing a cache build lines and polygons of the same way like
+// builders without one
+void test_line_and_polygon()
+{
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  auto &way = add_way(buffer, 1, {1, 2, 3, 4, 1}, square);
+  auto &other = add_way(buffer, 3, {21, 22}, {{1.0, 1.0}, {2.0, 2.0}});
+
+  auto const expected_polygon = polygon(way);
+  auto const expected_line = line(way);
+  auto const expected_other = line(other);
+
+  auto cache = std::make_shared<geom::way_cache_t>();
+  geom::osmium_builder_t first(proj, false, cache);
+  geom::osmium_builder_t second(proj, false, cache);
+
+  // the polygon reuses the projected nodes of the line and the second
+  // polygon the assembled area as well
+  first.set_way(1, cache->generation());
+  second.set_way(1, cache->generation());
+  if (line(first, way) != expected_line ||
+      polygon(second, way) != expected_polygon ||
+      polygon(first, way) != expected_polygon ||
+      line(second, way) != expected_line) {
+    throw std::runtime_error("test_line_and_polygon: line first differs.");
+  }
+
+  first.set_way(3, cache->generation());
+  if (line(first, other) != expected_other) {
+    throw std::runtime_error("test_line_and_polygon: other way differs.");
+  }
+
+  second.set_way(1, cache->generation());
+  if (polygon(second, way) != expected_polygon ||
+      line(second, way) != expected_line) {
+    throw std::runtime_error("test_line_and_polygon: polygon first differs.");
+  }
+}
+
+// A way is only taken from the cache in the generation it was built in,
+// so the output has to start a new one when nodes move. Without a way
+// set nothing is cached.
+void test_generations()
+{
+  locations_t moved = square;
+  moved[2] = {9.2, 47.2};
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  auto &way = add_way(buffer, 1, {1, 2, 3, 4, 1}, square);
+  auto &way_moved = add_way(buffer, 1, {1, 2, 3, 4, 1}, moved);
+
+  auto const old_line = line(way);
+  auto const old_polygon = polygon(way);
+  auto const expected_line = line(way_moved);
+  auto const expected_polygon = polygon(way_moved);
+
+  auto cache = std::make_shared<geom::way_cache_t>();
+  geom::osmium_builder_t builder(proj, false, cache);
+
+  builder.set_way(1, cache->generation());
+  line(builder, way);
+  polygon(builder, way);
+  if (line(builder, way_moved) != old_line ||
+      polygon(builder, way_moved) != old_polygon) {
+    throw std::runtime_error("test_generations: cache not used.");
+  }
+
+  cache->next_generation();
+  builder.set_way(1, cache->generation());
+  if (line(builder, way_moved) != expected_line ||
+      polygon(builder, way_moved) != expected_polygon) {
+    throw std::runtime_error("test_generations: old generation used.");
+  }
+
+  builder.set_way(0, 0);
+  if (line(builder, way) != old_line || polygon(builder, way) != old_polygon) {
+    throw std::runtime_error("test_generations: cached without a way.");
+  }
+}
+
+// another projection never gets the geometries of the first one
+void test_projection()
+{
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  auto &way = add_way(buffer, 1, {1, 2, 3, 4, 1}, square);
+
+  std::shared_ptr<reprojection> latlon(reprojection::create_projection(PROJ_LATLONG));
+  geom::osmium_builder_t plain(latlon, false);
+  auto const expected = line(plain, way);
+
+  auto cache = std::make_shared<geom::way_cache_t>();
+  geom::osmium_builder_t merc(proj, false, cache);
+  geom::osmium_builder_t wgs84(latlon, false, cache);
+  merc.set_way(1, cache->generation());
+  wgs84.set_way(1, cache->generation());
+  line(merc, way);
+  if (line(wgs84, way) != expected) {
+    throw std::runtime_error("test_projection: other projection used.");
+  }
+}
+
+} // anonymous namespace
+
+int main()
+{
+  try {
+    test_line_and_polygon();
+    test_generations();
+    test_projection();
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <memory>
+
+#include "osmtypes.hpp"
+#include "osmdata.hpp"
+#include "output-gazetteer.hpp"
+#include "options.hpp"
+#include "middle-pgsql.hpp"
+
+#include "tests/common-pg.hpp"
+#include "tests/common.hpp"
+
+namespace {
+
+struct skip_test : public std::exception {
+    const char *what() const noexcept { return "Test skipped."; }
+};
+
+void run_test(const char* test_name, void (*testfunc)()) {
+    try {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+
+    } catch (const skip_test &) {
+        exit(77); // <-- code to skip this test.
+
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+
+void import(const char *filename, const options_t &options)
+{
+    std::shared_ptr<middle_pgsql_t> mid_pgsql(new middle_pgsql_t());
+    auto out_test = std::make_shared<output_gazetteer_t>(mid_pgsql.get(), options);
+
+    osmdata_t osmdata(mid_pgsql, out_test, options.projection);
+
+    testing::parse(filename, "", options, &osmdata);
+}
+
+// Classes an object does not have anymore are deleted on update. Without
+// triggers in the database the classes it still has are in the place table
+// twice afterwards.
+void test_unused_classes() {
+    std::unique_ptr<pg::tempdb> db;
+
+    try {
+        db.reset(new pg::tempdb);
+    } catch (const std::exception &e) {
+        std::cerr << "Unable to setup database: " << e.what() << "\n";
+        throw skip_test();
+    }
+
+    std::string proc_name("test-output-gazetteer"), input_file("-");
+    char *argv[] = { &proc_name[0], &input_file[0], nullptr };
+
+    options_t options = options_t(2, argv);
+    options.database_options = db->database_options;
+    options.num_procs = 1;
+    options.prefix = "osm2pgsql_test";
+    options.output_backend = "gazetteer";
+    options.slim = true;
+
+    import("tests/test_output_gazetteer.osm", options);
+
+    db->assert_has_table("place");
+    db->check_count(6, "SELECT count(*) FROM place");
+
+    options.append = true;
+    import("tests/test_output_gazetteer_diff.osc", options);
+
+    // node 1 loses one of its classes
+    db->check_count(2, "SELECT count(*) FROM place WHERE osm_type = 'N' AND osm_id = 1 AND class = 'amenity'");
+    db->check_count(0, "SELECT count(*) FROM place WHERE osm_type = 'N' AND osm_id = 1 AND class = 'shop'");
+
+    // node 2 has no classes left at all
+    db->check_count(0, "SELECT count(*) FROM place WHERE osm_type = 'N' AND osm_id = 2");
+
+    // The second version of node 3 in the diff brings back the class the
+    // first one dropped, the delete of the first version must not remove it.
+    db->check_count(1, "SELECT count(*) FROM place WHERE osm_type = 'N' AND osm_id = 3 AND class = 'tourism'");
+    db->check_count(3, "SELECT count(*) FROM place WHERE osm_type = 'N' AND osm_id = 3 AND class = 'amenity'");
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    RUN_TEST(test_unused_classes);
+
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "id-tracker.hpp"
+#include "metrics.hpp"
 #include "middle.hpp"
 #include "tests/mockups.hpp"
 #include "options.hpp"
@@ -14,6 +16,12 @@
 #include "output-null.hpp"
 #include "parse-osmium.hpp"
 
+#include <osmium/builder/attr.hpp>
+#include <osmium/io/opl_output.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/xml_output.hpp>
+#include <osmium/io/writer.hpp>
+
 void exit_nicely()
 {
     fprintf(stderr, "Error occurred, cleaning up\n");
@@ -22,6 +30,7 @@ void exit_nicely()
 
 struct test_output_t : public output_null_t {
     uint64_t sum_ids, num_nodes, num_ways, num_relations, num_nds, num_members;
+    uint64_t num_modified = 0, num_deleted = 0, sum_nds_modified = 0;
 
     explicit test_output_t(const options_t &options_)
         : output_null_t(nullptr, options_), sum_ids(0), num_nodes(0), num_ways(0), num_relations(0),
@@ -67,6 +76,37 @@ struct test_output_t : public output_null_t {
         num_members += uint64_t(rel.members().size());
         return 0;
     }
+
+    int node_modify(osmium::Node const &) override {
+        num_modified += 1;
+        return 0;
+    }
+
+    int way_modify(osmium::Way *way) override {
+        num_modified += 1;
+        sum_nds_modified += uint64_t(way->nodes().size());
+        return 0;
+    }
+
+    int relation_modify(osmium::Relation const &) override {
+        num_modified += 1;
+        return 0;
+    }
+
+    int node_delete(osmid_t) override {
+        num_deleted += 1;
+        return 0;
+    }
+
+    int way_delete(osmid_t) override {
+        num_deleted += 1;
+        return 0;
+    }
+
+    int relation_delete(osmid_t) override {
+        num_deleted += 1;
+        return 0;
+    }
 };
 
 
@@ -100,5 +140,181 @@ int main(int argc, char *argv[]) {
   assert_equal(out_test->num_nds,         186L);
   assert_equal(out_test->num_members,     146L);
 
+  // the live metrics count all objects of the file once it is read
+  assert_equal(metrics::counter("osm2pgsql_objects_read_total", "type=\"way\"").load(), 140L);
+  assert_equal(metrics::counter("osm2pgsql_objects_read_total", "type=\"relation\"").load(), 40L);
+
+  // objects contained in several input files are only processed once
+  auto out_merged_input = std::make_shared<test_output_t>(options);
+  osmdata_t osmdata_merged_input(std::make_shared<dummy_middle_t>(),
+                                 out_merged_input, options.projection);
+  parse_osmium_t parser_merged_input(bbox, false, &osmdata_merged_input);
+  parser_merged_input.stream_merged({inputfile, inputfile}, "");
+
+  assert_equal(out_merged_input->sum_ids,       out_test->sum_ids);
+  assert_equal(out_merged_input->num_ways,      out_test->num_ways);
+  assert_equal(out_merged_input->num_relations, out_test->num_relations);
+  assert_equal(out_merged_input->num_nds,       out_test->num_nds);
+
+  // ways and relations without anything inside the bounding box are dropped
+  auto out_bbox = std::make_shared<test_output_t>(options);
+  osmdata_t osmdata_bbox(std::make_shared<dummy_middle_t>(), out_bbox,
+                         options.projection);
+  parse_osmium_t parser_bbox(std::string("-0.01,-0.01,0.0,0.0"), false,
+                             &osmdata_bbox);
+  parser_bbox.stream_file(inputfile, "");
+
+  assert_equal(out_bbox->num_ways,         16L);
+  assert_equal(out_bbox->num_relations,    13L);
+
+  // relations with members only in relations coming later are kept
+  {
+    std::string const superfile = "test-parse-xml2-bbox.osm";
+    {
+      osmium::memory::Buffer wbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+      {
+        using namespace osmium::builder::attr;
+        osmium::builder::add_node(wbuf, _id(1), _location(0.5, 0.5));
+        osmium::builder::add_node(wbuf, _id(2), _location(5.0, 5.0));
+        osmium::builder::add_way(wbuf, _id(1), _nodes({1, 2}),
+                                 _tag("highway", "road"));
+        osmium::builder::add_way(wbuf, _id(2), _nodes({2}),
+                                 _tag("highway", "road"));
+        osmium::builder::add_relation(wbuf, _id(1),
+                                      _member(osmium::item_type::relation, 3, ""),
+                                      _tag("type", "route_master"));
+        osmium::builder::add_relation(wbuf, _id(2),
+                                      _member(osmium::item_type::way, 2, ""),
+                                      _tag("type", "route"));
+        osmium::builder::add_relation(wbuf, _id(3),
+                                      _member(osmium::item_type::way, 1, ""),
+                                      _tag("type", "route"));
+        osmium::builder::add_relation(wbuf, _id(4),
+                                      _member(osmium::item_type::relation, 2, ""),
+                                      _tag("type", "route_master"));
+      }
+      osmium::io::Writer writer(superfile, osmium::io::overwrite::allow);
+      writer(std::move(wbuf));
+      writer.close();
+    }
+
+    auto out_super = std::make_shared<test_output_t>(options);
+    osmdata_t osmdata_super(std::make_shared<dummy_middle_t>(), out_super,
+                            options.projection);
+    parse_osmium_t parser_super(std::string("0.0,0.0,1.0,1.0"), false,
+                                &osmdata_super);
+    parser_super.stream_file(superfile, "");
+    std::remove(superfile.c_str());
+
+    assert_equal(out_super->num_ways,      1L);
+    assert_equal(out_super->num_relations, 2L);
+  }
+
+  // unsorted files can not be merged
+  bool unsorted_failed = false;
+  try {
+    parse_osmium_t parser_unsorted(bbox, false, &osmdata_merged_input);
+    parser_unsorted.stream_merged({inputfile, "tests/test_multipolygon_diff.osc"}, "");
+  } catch (std::runtime_error const &) {
+    unsorted_failed = true;
+  }
+  assert_equal(unsorted_failed, true);
+
+  // relation pre-scan
+  id_tracker members;
+  scan_relation_members(inputfile, "", {"boundary"}, &members);
+  assert_equal(members.size(), 0L);
+
+  scan_relation_members(inputfile, "", {"multipolygon", "boundary"}, &members);
+  assert_equal(members.size(), 140L);
+  assert_equal(members.is_marked(1), true);
+
+  // no types means all relations
+  id_tracker all_members;
+  scan_relation_members(inputfile, "", {}, &all_members);
+  assert_equal(all_members.size(), 140L);
+
+  // applying the same diff twice squashed must be the same as applying it once
+  std::string const difffile = "tests/test_multipolygon_diff.osc";
+  auto out_single = std::make_shared<test_output_t>(options);
+  osmdata_t osmdata_single(std::make_shared<dummy_slim_middle_t>(), out_single,
+                           options.projection);
+  parse_osmium_t parser_single(bbox, true, &osmdata_single);
+  parser_single.stream_file(difffile, "");
+
+  assert_equal(out_single->num_modified,   31L);
+  assert_equal(out_single->num_deleted,     3L);
+
+  auto out_squashed = std::make_shared<test_output_t>(options);
+  osmdata_t osmdata_squashed(std::make_shared<dummy_slim_middle_t>(),
+                             out_squashed, options.projection);
+  parse_osmium_t parser_squashed(bbox, true, &osmdata_squashed);
+  parser_squashed.stream_squashed({difffile, difffile}, "");
+
+  assert_equal(out_squashed->num_modified, out_single->num_modified);
+  assert_equal(out_squashed->num_deleted,  out_single->num_deleted);
+  assert_equal(out_squashed->sum_nds_modified, out_single->sum_nds_modified);
+
+  // the newer version of the nodes in the diff replaces the original
+  auto out_merged = std::make_shared<test_output_t>(options);
+  osmdata_t osmdata_merged(std::make_shared<dummy_slim_middle_t>(),
+                           out_merged, options.projection);
+  parse_osmium_t parser_merged(bbox, true, &osmdata_merged);
+  parser_merged.stream_squashed({difffile, inputfile}, "");
+
+  assert_equal(out_merged->num_deleted,     3L);
+  assert_equal(out_merged->num_modified,  542L);
+
+
+  // detection of node locations in ways
+  assert_equal(lacks_locations_on_ways(inputfile, ""), false);
+  assert_equal(lacks_locations_on_ways("tests/liechtenstein-2013-08-03.osm.pbf", ""), true);
+
+  options_t located_options = options;
+  located_options.locations_on_ways = true;
+
+  // PBF announces them in the header, the other formats are checked
+  // at their first way during the import
+  for (auto const &format : {"pbf", "osm", "opl"}) {
+    for (bool const with_locations : {true, false}) {
+      std::string const located = std::string("test-parse-xml2-locations.") + format;
+      {
+        osmium::memory::Buffer wbuf(4096, osmium::memory::Buffer::auto_grow::yes);
+        {
+          using namespace osmium::builder::attr;
+          osmium::builder::add_node(wbuf, _id(1), _location(1.5, 2.5));
+          osmium::builder::add_way(wbuf, _id(1),
+                                   _nodes({{1, {1.5, 2.5}}, {2, {3.5, 4.5}}}));
+        }
+        osmium::io::Writer writer(
+            osmium::io::File(located, std::string(format) +
+                                          (with_locations ? ",locations_on_ways=true" : "")),
+            osmium::io::overwrite::allow);
+        writer(std::move(wbuf));
+        writer.close();
+      }
+      bool const lacks_locations = lacks_locations_on_ways(located, "");
+
+      bool import_failed = false;
+      try {
+        auto out_located = std::make_shared<test_output_t>(located_options);
+        osmdata_t osmdata_located(std::make_shared<dummy_middle_t>(),
+                                  out_located, options.projection);
+        parse_osmium_t parser_located(boost::none, false, &osmdata_located);
+        parser_located.stream_file(located, "");
+      } catch (std::runtime_error const &) {
+        import_failed = true;
+      }
+      std::remove(located.c_str());
+
+      if (std::string(format) == "pbf") {
+        assert_equal(lacks_locations, !with_locations);
+      } else {
+        assert_equal(lacks_locations, false);
+      }
+      assert_equal(import_failed, !with_locations);
+    }
+  }
+
   return 0;
 }
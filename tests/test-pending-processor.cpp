@@ -0,0 +1,202 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "osmtypes.hpp"
+#include "id-tracker.hpp"
+#include "osmdata.hpp"
+#include "middle-ram.hpp"
+#include "output-null.hpp"
+#include "options.hpp"
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+// what the pending jobs of all clones have been called for
+struct pending_record_t {
+  std::mutex mutex;
+  std::vector<osmid_t> ways, rels;
+  std::vector<std::thread::id> rel_threads;
+};
+
+// Queues its jobs without counting them, like the outputs do for ids
+// which are below the last one taken from their own trackers.
+class uncounted_output_t : public output_null_t {
+public:
+  uncounted_output_t(const middle_query_t *mid_, const options_t &options,
+                     std::shared_ptr<pending_record_t> record)
+  : output_null_t(mid_, options), m_record(record)
+  {}
+
+  std::shared_ptr<output_t> clone(const middle_query_t *) const override
+  {
+    return std::make_shared<uncounted_output_t>(*this);
+  }
+
+  void enqueue_ways(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t &) override
+  {
+    if (id == id_tracker::max()) {
+      for (osmid_t way : {1, 2, 3}) {
+        job_queue.push(pending_job_t(way, output_id));
+      }
+    }
+  }
+
+  int pending_way(osmid_t id, int) override
+  {
+    std::lock_guard<std::mutex> lock(m_record->mutex);
+    m_record->ways.push_back(id);
+    return 0;
+  }
+
+  void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t &) override
+  {
+    if (id == id_tracker::max()) {
+      job_queue.push(pending_job_t(10, output_id));
+    }
+  }
+
+  int pending_relation(osmid_t id, int) override
+  {
+    std::lock_guard<std::mutex> lock(m_record->mutex);
+    m_record->rels.push_back(id);
+    m_record->rel_threads.push_back(std::this_thread::get_id());
+    return 0;
+  }
+
+protected:
+  std::shared_ptr<pending_record_t> m_record;
+};
+
+// queued jobs are processed even if the output did not count them
+void test_uncounted_jobs()
+{
+  options_t options;
+  options.num_procs = 2;
+
+  auto record = std::make_shared<pending_record_t>();
+  auto mid = std::make_shared<middle_ram_t>();
+  auto out = std::make_shared<uncounted_output_t>(mid.get(), options, record);
+
+  osmdata_t osmdata(mid, out, options.projection);
+  osmdata.start();
+  osmdata.stop();
+
+  std::sort(record->ways.begin(), record->ways.end());
+  if (record->ways != std::vector<osmid_t>({1, 2, 3})) {
+    throw std::runtime_error("Pending ways were not processed.");
+  }
+  if (record->rels != std::vector<osmid_t>({10})) {
+    throw std::runtime_error("Pending relations were not processed.");
+  }
+}
+
+// Queues relations of different sizes, the large ones in between.
+class sized_output_t : public uncounted_output_t {
+public:
+  using uncounted_output_t::uncounted_output_t;
+
+  std::shared_ptr<output_t> clone(const middle_query_t *) const override
+  {
+    return std::make_shared<sized_output_t>(*this);
+  }
+
+  void enqueue_relations(pending_queue_t &job_queue, osmid_t id, size_t output_id, size_t &) override
+  {
+    if (id == id_tracker::max()) {
+      for (osmid_t rel : {10, 1, 2, 11, 3, 4, 5}) {
+        job_queue.push(pending_job_t(rel, output_id));
+      }
+    }
+  }
+};
+
+void add_relation(middle_t &mid, osmid_t id, osmid_t members)
+{
+  std::vector<osmium::builder::attr::member_type> list;
+  for (osmid_t i = 1; i <= members; ++i) {
+    list.emplace_back(osmium::item_type::way, i, "outer");
+  }
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    osmium::builder::add_relation(buffer, _id(id), _members(list),
+                                  _tag("type", "multipolygon"));
+  }
+  mid.relations_set(buffer.get<osmium::Relation>(0));
+}
+
+// relations with many members are processed before all others, the
+// largest first
+void test_large_relations_first()
+{
+  options_t options;
+  options.num_procs = 2;
+
+  auto record = std::make_shared<pending_record_t>();
+  auto mid = std::make_shared<middle_ram_t>();
+  auto out = std::make_shared<sized_output_t>(mid.get(), options, record);
+
+  osmdata_t osmdata(mid, out, options.projection);
+  osmdata.start();
+  for (osmid_t id = 1; id <= 5; ++id) {
+    add_relation(*mid, id, 3);
+  }
+  add_relation(*mid, 10, 1200);
+  add_relation(*mid, 11, 1500);
+  osmdata.stop();
+
+  auto sorted = record->rels;
+  std::sort(sorted.begin(), sorted.end());
+  if (sorted != std::vector<osmid_t>({1, 2, 3, 4, 5, 10, 11})) {
+    throw std::runtime_error("Not all pending relations were processed.");
+  }
+
+  // every thread does its large relations before the small ones and
+  // the largest is the first job of one of them
+  bool largest_first = false;
+  for (auto const &thread : record->rel_threads) {
+    bool small_seen = false;
+    bool first = true;
+    for (size_t i = 0; i < record->rels.size(); ++i) {
+      if (record->rel_threads[i] != thread) {
+        continue;
+      }
+      bool const large = record->rels[i] >= 10;
+      if (large && small_seen) {
+        throw std::runtime_error("Large relation after a small one.");
+      }
+      if (first && record->rels[i] == 11) {
+        largest_first = true;
+      }
+      small_seen = small_seen || !large;
+      first = false;
+    }
+  }
+  if (!largest_first) {
+    throw std::runtime_error("Largest relation was not processed first.");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    test_uncounted_jobs();
+    test_large_relations_first();
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "UNKNOWN ERROR" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
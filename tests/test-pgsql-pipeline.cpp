@@ -0,0 +1,348 @@
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "osmtypes.hpp"
+#include "output-null.hpp"
+#include "options.hpp"
+#include "middle-pgsql.hpp"
+#include "pgsql.hpp"
+
+#include "tests/common-pg.hpp"
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/memory/buffer.hpp>
+
+// the results of queued statements come in order, also across the
+// batches the pipeline sends on its own
+void test_results(pg::tempdb *db)
+{
+  auto conn = pg::conn::connect(db->database_options);
+  PGconn *sql_conn = conn->get();
+
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "CREATE TABLE pipeline_test (id int8)");
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE insert_id(int8) AS INSERT INTO pipeline_test VALUES ($1)");
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE double_id(int8) AS SELECT $1 * 2");
+
+  pg_pipeline_t pipeline(4);
+  std::vector<osmid_t> results;
+  for (int i = 1; i <= 10; ++i) {
+    std::string const id = std::to_string(i);
+    char const *params[1] = {id.c_str()};
+    pipeline.exec_prepared(sql_conn, "insert_id", 1, params, PGRES_COMMAND_OK);
+    pipeline.exec_prepared(sql_conn, "double_id", 1, params, PGRES_TUPLES_OK,
+                           [&](PGresult *res) {
+                             results.push_back(strtoosmid(PQgetvalue(res, 0, 0), nullptr, 10));
+                           });
+  }
+  pipeline.sync();
+
+  if (!pipeline.empty()) {
+    throw std::runtime_error("test_results: statements left after sync.");
+  }
+  if (results != std::vector<osmid_t>({2, 4, 6, 8, 10, 12, 14, 16, 18, 20})) {
+    throw std::runtime_error("test_results: wrong results.");
+  }
+  db->check_count(10, "SELECT count(*) FROM pipeline_test");
+}
+
+// a failing statement is reported by sync() and the connection can be
+// used again afterwards
+void test_error(pg::tempdb *db)
+{
+  auto conn = pg::conn::connect(db->database_options);
+  PGconn *sql_conn = conn->get();
+
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE divide(int8) AS SELECT 1 / $1");
+
+  pg_pipeline_t pipeline(4);
+  int handled = 0;
+  for (auto const *value : {"1", "0", "1"}) {
+    char const *params[1] = {value};
+    pipeline.exec_prepared(sql_conn, "divide", 1, params, PGRES_TUPLES_OK,
+                           [&](PGresult *) { ++handled; });
+  }
+
+  bool failed = false;
+  try {
+    pipeline.sync();
+  } catch (std::runtime_error const &) {
+    failed = true;
+  }
+  if (!failed || !pipeline.empty()) {
+    throw std::runtime_error("test_error: error not reported.");
+  }
+
+  pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, "SELECT 1");
+
+  int const before = handled;
+  char const *params[1] = {"2"};
+  pipeline.exec_prepared(sql_conn, "divide", 1, params, PGRES_TUPLES_OK,
+                         [&](PGresult *) { ++handled; });
+  pipeline.sync();
+  if (handled != before + 1) {
+    throw std::runtime_error("test_error: connection not usable after error.");
+  }
+}
+
+// an exception from a handler leaves the connection usable and the
+// failed batch is not sent again
+void test_handler_error(pg::tempdb *db)
+{
+  auto conn = pg::conn::connect(db->database_options);
+  PGconn *sql_conn = conn->get();
+
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE echo(int8) AS SELECT $1");
+
+  pg_pipeline_t pipeline(10);
+  int handled = 0;
+  for (auto const *value : {"1", "2", "3"}) {
+    char const *params[1] = {value};
+    pipeline.exec_prepared(sql_conn, "echo", 1, params, PGRES_TUPLES_OK,
+                           [&](PGresult *res) {
+                             ++handled;
+                             if (strcmp(PQgetvalue(res, 0, 0), "2") == 0) {
+                               throw std::runtime_error("handler failed");
+                             }
+                           });
+  }
+
+  bool failed = false;
+  try {
+    pipeline.sync();
+  } catch (std::runtime_error const &) {
+    failed = true;
+  }
+  if (!failed || !pipeline.empty() || handled != 2) {
+    throw std::runtime_error("test_handler_error: error not passed on.");
+  }
+
+  pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, "SELECT 1");
+
+  char const *params[1] = {"4"};
+  pipeline.exec_prepared(sql_conn, "echo", 1, params, PGRES_TUPLES_OK,
+                         [&](PGresult *) { ++handled; });
+  pipeline.sync();
+  if (handled != 3) {
+    throw std::runtime_error("test_handler_error: old batch sent again.");
+  }
+}
+
+// more statements than the default queue length are sent in batches,
+// results still come in order and the connection stays usable
+void test_default_batches(pg::tempdb *db)
+{
+  auto conn = pg::conn::connect(db->database_options);
+  PGconn *sql_conn = conn->get();
+
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE square(int8) AS SELECT $1 * $1");
+
+  pg_pipeline_t pipeline;
+  std::vector<osmid_t> results;
+  for (int i = 0; i < 1000; ++i) {
+    std::string const id = std::to_string(i);
+    char const *params[1] = {id.c_str()};
+    pipeline.exec_prepared(sql_conn, "square", 1, params, PGRES_TUPLES_OK,
+                           [&](PGresult *res) {
+                             results.push_back(strtoosmid(PQgetvalue(res, 0, 0), nullptr, 10));
+                           });
+  }
+  pipeline.sync();
+
+  if (results.size() != 1000) {
+    throw std::runtime_error("test_default_batches: results missing.");
+  }
+  for (osmid_t i = 0; i < 1000; ++i) {
+    if (results[i] != i * i) {
+      throw std::runtime_error("test_default_batches: wrong result order.");
+    }
+  }
+
+  pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, "SELECT 1");
+}
+
+// A statement fails in the second of the batches which the pipeline
+// sends on its own. The first batch is kept, the failing one is rolled
+// back and the connection and the pipeline can be used again.
+void test_error_mid_pipeline(pg::tempdb *db)
+{
+  auto conn = pg::conn::connect(db->database_options);
+  PGconn *sql_conn = conn->get();
+
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "CREATE TABLE pipeline_error_test (id int8 PRIMARY KEY)");
+  pgsql_exec_simple(sql_conn, PGRES_COMMAND_OK,
+                    "PREPARE insert_unique(int8) AS INSERT INTO pipeline_error_test VALUES ($1)");
+
+  pg_pipeline_t pipeline;
+  bool failed = false;
+  try {
+    for (int i = 1; i <= 600; ++i) {
+      // the 300th statement repeats an id
+      std::string const id = std::to_string(i == 300 ? 1 : i);
+      char const *params[1] = {id.c_str()};
+      pipeline.exec_prepared(sql_conn, "insert_unique", 1, params,
+                             PGRES_COMMAND_OK);
+    }
+    pipeline.sync();
+  } catch (std::runtime_error const &) {
+    failed = true;
+  }
+  if (!failed || !pipeline.empty()) {
+    throw std::runtime_error("test_error_mid_pipeline: error not reported.");
+  }
+  db->check_count(256, "SELECT count(*) FROM pipeline_error_test");
+
+  pgsql_exec_simple(sql_conn, PGRES_TUPLES_OK, "SELECT 1");
+
+  int handled = 0;
+  for (int i = 1000; i < 1300; ++i) {
+    std::string const id = std::to_string(i);
+    char const *params[1] = {id.c_str()};
+    pipeline.exec_prepared(sql_conn, "insert_unique", 1, params,
+                           PGRES_COMMAND_OK, [&](PGresult *) { ++handled; });
+  }
+  pipeline.sync();
+  if (handled != 300) {
+    throw std::runtime_error("test_error_mid_pipeline: pipeline not usable after error.");
+  }
+  db->check_count(556, "SELECT count(*) FROM pipeline_error_test");
+}
+
+struct counting_processor_t : public middle_t::pending_processor {
+  void enqueue_ways(osmid_t id) override
+  {
+    if (id_tracker::is_valid(id)) { ways.push_back(id); }
+  }
+  void process_ways() override {}
+  void enqueue_relations(osmid_t id) override
+  {
+    if (id_tracker::is_valid(id)) { rels.push_back(id); }
+  }
+  void process_relations() override {}
+
+  std::vector<osmid_t> ways, rels;
+};
+
+// changes in a diff mark more ways and relations than fit into one batch
+void test_mark_pending(options_t options)
+{
+  osmid_t const num_ways = 300;
+
+  osmium::memory::Buffer buffer(4096, osmium::memory::Buffer::auto_grow::yes);
+  {
+    using namespace osmium::builder::attr;
+    for (osmid_t i = 1; i <= num_ways; ++i) {
+      osmium::builder::add_way(buffer, _id(i), _nodes({2 * i - 1, 2 * i}));
+    }
+    osmium::builder::add_relation(buffer, _id(1),
+                                  _member(osmium::item_type::way, 1, "outer"),
+                                  _member(osmium::item_type::way, 2, "outer"),
+                                  _member(osmium::item_type::way, 3, "outer"));
+    osmium::builder::add_relation(buffer, _id(2),
+                                  _member(osmium::item_type::way, num_ways - 1, ""),
+                                  _member(osmium::item_type::way, num_ways, ""));
+  }
+
+  options.append = false;
+  options.create = true;
+  {
+    middle_pgsql_t mid_pgsql;
+    output_null_t out_test(&mid_pgsql, options);
+    mid_pgsql.start(&options);
+
+    for (auto const &way : buffer.select<osmium::Way>()) {
+      mid_pgsql.ways_set(way);
+    }
+    for (auto const &rel : buffer.select<osmium::Relation>()) {
+      mid_pgsql.relations_set(rel);
+    }
+
+    osmium::thread::Pool pool(1);
+    mid_pgsql.commit();
+    mid_pgsql.stop(pool);
+  }
+
+  options.append = true;
+  options.create = false;
+  middle_pgsql_t mid_pgsql;
+  output_null_t out_test(&mid_pgsql, options);
+  mid_pgsql.start(&options);
+
+  for (osmid_t i = 1; i <= 2 * num_ways; ++i) {
+    mid_pgsql.node_changed(i);
+  }
+  mid_pgsql.commit();
+
+  counting_processor_t proc;
+  mid_pgsql.iterate_ways(proc);
+  mid_pgsql.iterate_relations(proc);
+  if (proc.ways.size() != static_cast<size_t>(num_ways) ||
+      proc.ways.front() != 1 || proc.ways.back() != num_ways) {
+    throw std::runtime_error("test_mark_pending: ways not marked.");
+  }
+
+  for (osmid_t i = 1; i <= num_ways; ++i) {
+    mid_pgsql.way_changed(i);
+  }
+  mid_pgsql.commit();
+
+  if (mid_pgsql.pending_count() != 2) {
+    throw std::runtime_error("test_mark_pending: wrong pending count.");
+  }
+
+  counting_processor_t proc2;
+  mid_pgsql.iterate_relations(proc2);
+  if (proc2.rels != std::vector<osmid_t>({1, 2})) {
+    throw std::runtime_error("test_mark_pending: relations not marked.");
+  }
+
+  osmium::thread::Pool pool(1);
+  mid_pgsql.stop(pool);
+}
+
+int main(int argc, char *argv[]) {
+  std::unique_ptr<pg::tempdb> db;
+
+  try {
+    db.reset(new pg::tempdb);
+  } catch (const std::exception &e) {
+    std::cerr << "Unable to setup database: " << e.what() << "\n";
+    return 77; // <-- code to skip this test.
+  }
+
+  try {
+    test_results(db.get());
+    test_error(db.get());
+    test_handler_error(db.get());
+    test_default_batches(db.get());
+    test_error_mid_pipeline(db.get());
+
+    options_t options;
+    options.database_options = db->database_options;
+    options.cache = 1;
+    options.num_procs = 1;
+    options.prefix = "osm2pgsql_test";
+    options.slim = true;
+
+    test_mark_pending(options);
+  } catch (const std::exception &e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "UNKNOWN ERROR" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include "reprojection.hpp"
+
+namespace {
+
+void run_test(const char* test_name, void (*testfunc)())
+{
+    try
+    {
+        fprintf(stderr, "%s\n", test_name);
+        testfunc();
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        fprintf(stderr, "FAIL\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "PASS\n");
+}
+#define RUN_TEST(x) run_test(#x, &(x))
+#define ASSERT_EQ(a, b) { if (!((a) == (b))) { throw std::runtime_error((boost::format("Expecting %1% == %2%, but %3% != %4%") % #a % #b % (a) % (b)).str()); } }
+
+osmium::WayNodeList const &make_nodes(osmium::memory::Buffer &buffer)
+{
+    {
+        osmium::builder::WayNodeListBuilder builder(buffer);
+        builder.add_node_ref(1, osmium::Location(9.5, 47.1));
+        builder.add_node_ref(2, osmium::Location(-179.9999999, 89.9999));
+        builder.add_node_ref(3, osmium::Location());
+        builder.add_node_ref(4, osmium::Location(0.0, 0.0));
+        builder.add_node_ref(5, osmium::Location(179.5, -85.2));
+        builder.add_node_ref(6, osmium::Location(-12.3456789, 78.00001));
+        builder.add_node_ref(7, osmium::Location());
+    }
+    buffer.commit();
+
+    return buffer.get<osmium::WayNodeList>(0);
+}
+
+void check_bulk_matches_single(int srs)
+{
+    std::unique_ptr<reprojection> proj(reprojection::create_projection(srs));
+    osmium::memory::Buffer buffer(1024);
+    auto const &nodes = make_nodes(buffer);
+
+    std::vector<osmium::geom::Coordinates> coords;
+    coords.emplace_back(1.0, 2.0); // results are appended
+    proj->reproject(nodes, &coords);
+
+    ASSERT_EQ(coords.size(), 6);
+    ASSERT_EQ(coords[0].x, 1.0);
+
+    size_t i = 1;
+    for (auto const &node : nodes) {
+        if (node.location().valid()) {
+            auto const c = proj->reproject(node.location());
+            ASSERT_EQ(coords[i].x, c.x);
+            ASSERT_EQ(coords[i].y, c.y);
+            ++i;
+        }
+    }
+}
+
+void test_bulk_latlon()
+{
+    check_bulk_matches_single(PROJ_LATLONG);
+}
+
+void test_bulk_merc()
+{
+    check_bulk_matches_single(PROJ_SPHERE_MERC);
+}
+
+void test_bulk_empty()
+{
+    std::unique_ptr<reprojection> proj(
+        reprojection::create_projection(PROJ_SPHERE_MERC));
+    osmium::memory::Buffer buffer(1024);
+    {
+        osmium::builder::WayNodeListBuilder builder(buffer);
+        builder.add_node_ref(1, osmium::Location());
+    }
+    buffer.commit();
+
+    std::vector<osmium::geom::Coordinates> coords;
+    proj->reproject(buffer.get<osmium::WayNodeList>(0), &coords);
+    ASSERT_EQ(coords.size(), 0);
+}
+
+// a point proj can not project must not end up as HUGE_VAL in the output
+void test_bulk_failed_point()
+{
+    std::unique_ptr<reprojection> proj;
+    try {
+        // Lambert azimuthal equal area, centered at 10E 52N
+        proj.reset(reprojection::create_projection(3035));
+    } catch (const osmium::projection_error &e) {
+        fprintf(stderr, "EPSG:3035 not available, skipped: %s\n", e.what());
+        return;
+    }
+
+    osmium::memory::Buffer buffer(1024);
+    {
+        osmium::builder::WayNodeListBuilder builder(buffer);
+        builder.add_node_ref(1, osmium::Location(9.5, 47.1));
+        builder.add_node_ref(2, osmium::Location());
+        // the antipode of the center
+        builder.add_node_ref(3, osmium::Location(-170.0, -52.0));
+        builder.add_node_ref(4, osmium::Location(12.0, 50.0));
+    }
+    buffer.commit();
+
+    // newer versions of proj can project the antipode just fine
+    bool single_failed = false;
+    try {
+        proj->reproject(osmium::Location(-170.0, -52.0));
+    } catch (const osmium::projection_error &) {
+        single_failed = true;
+    }
+    if (!single_failed) {
+        fprintf(stderr, "proj projects the antipode of EPSG:3035, skipped\n");
+        return;
+    }
+
+    bool bulk_failed = false;
+    std::vector<osmium::geom::Coordinates> coords;
+    try {
+        proj->reproject(buffer.get<osmium::WayNodeList>(0), &coords);
+    } catch (const osmium::projection_error &) {
+        bulk_failed = true;
+    }
+    ASSERT_EQ(bulk_failed, true);
+}
+
+} // anonymous namespace
+
+int main()
+{
+    RUN_TEST(test_bulk_latlon);
+    RUN_TEST(test_bulk_merc);
+    RUN_TEST(test_bulk_empty);
+    RUN_TEST(test_bulk_failed_point);
+
+    return 0;
+}